@@ -0,0 +1,859 @@
+/* Copyright (c) 2025, Joel Díaz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+
+#include "gembed_backfill.h"
+
+#include <mysql/components/services/mysql_command_services.h>
+#include <mysql/components/services/mysql_current_thread_reader.h>
+#include <mysql/components/services/security_context.h>
+#include <mysql/mysql_lex_string.h>
+#include <strings.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include "gembed_embed.h"
+#include "gembed_models.h"
+#include "gembed_services.h"
+#include "gembed_vars.h"
+
+#define MYSQL_ERRMSG_SIZE 512
+#define CHECKPOINT_TABLE "gembed_backfill_checkpoint"
+
+enum Backfill_state {
+    BACKFILL_RUNNING,
+    BACKFILL_THROTTLED,
+    BACKFILL_DONE,
+    BACKFILL_FAILED,
+    BACKFILL_CANCELLED
+};
+
+static const char *state_names[] = {"running", "throttled", "done", "failed", "cancelled"};
+
+/* How the primary key is written in SQL */
+enum Key_kind { KEY_NUMBER, KEY_STRING, KEY_BINARY };
+
+struct Backfill_job {
+    long long id = 0;
+    std::string key;  /* row of the job in the checkpoint table */
+    std::string checkpoint_schema;
+    std::string schema;
+    std::string table;
+    std::string pk_col;
+    std::string text_col;
+    std::string vec_col;
+    Model_entry *model = nullptr;
+
+    /* The account that started the job, which it runs as */
+    std::string user;
+    std::string host;
+
+    std::atomic<int> state{BACKFILL_RUNNING};
+    std::atomic<bool> cancel{false};
+    std::atomic<bool> finished{false};
+    std::atomic<long long> rows{0};
+
+    std::mutex lock;  /* protects last_pk and error */
+    Key_kind key_kind = KEY_STRING;
+    std::string last_pk;
+    std::string error;
+
+    std::thread thread;
+};
+
+static std::mutex jobs_lock;
+static std::vector<std::unique_ptr<Backfill_job>> jobs;
+static long long next_job_id = 1;
+
+namespace {
+
+struct Sql_value {
+    bool null = true;
+    std::string value;
+};
+
+typedef std::vector<std::vector<Sql_value>> Sql_rows;
+
+/* A connection through the SQL command service, used from a job thread */
+class Sql_session {
+  public:
+    ~Sql_session() {
+        if (mysql) {
+            mysql_service_mysql_command_factory->close(mysql);
+        }
+    }
+
+    bool connect(const std::string &user, const std::string &host) {
+        if (mysql_service_mysql_command_factory->init(&mysql) || !mysql) {
+            mysql = nullptr;
+            last_error = "could not create a SQL session";
+            return true;
+        }
+
+        if (mysql_service_mysql_command_options->set(mysql, MYSQL_COMMAND_USER_NAME, user.c_str()) ||
+            mysql_service_mysql_command_options->set(mysql, MYSQL_COMMAND_HOST_NAME, host.c_str()) ||
+            mysql_service_mysql_command_factory->connect(mysql)) {
+            return fail();
+        }
+
+        // Only quotes need escaping in literals, whatever the global sql_mode
+        return execute("SET NAMES utf8mb4") ||
+               execute("SET SESSION sql_mode = CONCAT_WS(',', NULLIF(@@GLOBAL.sql_mode, ''), "
+                       "'NO_BACKSLASH_ESCAPES')");
+    }
+
+    /* Runs a statement that returns no rows. Returns true on error */
+    bool execute(const std::string &sql) {
+        if (mysql_service_mysql_command_query->query(mysql, sql.data(), sql.size())) {
+            return fail();
+        }
+        return false;
+    }
+
+    /* Runs a query and copies its rows. Returns true on error */
+    bool query(const std::string &sql, Sql_rows &rows) {
+        rows.clear();
+        if (execute(sql)) {
+            return true;
+        }
+
+        MYSQL_RES_H res = nullptr;
+        if (mysql_service_mysql_command_query_result->store_result(mysql, &res) || !res) {
+            return fail();
+        }
+
+        unsigned int n_fields = 0;
+        mysql_service_mysql_command_field_info->num_fields(res, &n_fields);
+
+        MYSQL_ROW_H row = nullptr;
+        while (!mysql_service_mysql_command_query_result->fetch_row(res, &row) && row) {
+            ulong *lengths = nullptr;
+            mysql_service_mysql_command_query_result->fetch_lengths(res, &lengths);
+
+            std::vector<Sql_value> values(n_fields);
+            for (unsigned int i = 0; i < n_fields; i++) {
+                if (row[i]) {
+                    values[i].null = false;
+                    values[i].value.assign(row[i], lengths ? lengths[i] : strlen(row[i]));
+                }
+            }
+            rows.push_back(std::move(values));
+        }
+
+        mysql_service_mysql_command_query_result->free_result(res);
+        return false;
+    }
+
+    const std::string &error() const { return last_error; }
+
+  private:
+    bool fail() {
+        char *msg = nullptr;
+        if (mysql && !mysql_service_mysql_command_error_info->sql_error(mysql, &msg) &&
+            msg && *msg) {
+            last_error = msg;
+        } else {
+            last_error = "SQL command failed";
+        }
+        return true;
+    }
+
+    MYSQL_H mysql = nullptr;
+    std::string last_error;
+};
+
+}  // namespace
+
+static std::string quote_identifier(const std::string &name) {
+    std::string quoted = "`";
+    for (char c : name) {
+        if (c == '`') quoted.push_back('`');
+        quoted.push_back(c);
+    }
+    quoted.push_back('`');
+    return quoted;
+}
+
+/* Quotes a string literal; the session runs with NO_BACKSLASH_ESCAPES */
+static std::string quote_string(const std::string &value) {
+    std::string quoted = "'";
+    for (char c : value) {
+        if (c == '\'') quoted.push_back('\'');
+        quoted.push_back(c);
+    }
+    quoted.push_back('\'');
+    return quoted;
+}
+
+static void append_hex(std::string &sql, const void *data, size_t len) {
+    static const char digits[] = "0123456789ABCDEF";
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+
+    sql += "X'";
+    for (size_t i = 0; i < len; i++) {
+        sql.push_back(digits[bytes[i] >> 4]);
+        sql.push_back(digits[bytes[i] & 0xF]);
+    }
+    sql += "'";
+}
+
+static std::string key_literal(Key_kind kind, const std::string &value) {
+    if (kind == KEY_NUMBER) {
+        return value;
+    }
+    if (kind == KEY_STRING) {
+        return quote_string(value);
+    }
+    std::string literal;
+    append_hex(literal, value.data(), value.size());
+    return literal;
+}
+
+/* Same bytes EMBED_TEXT returns, so the column ends up identical */
+static void append_vector(std::string &sql, const float *vec, size_t dim) {
+    std::string bytes(sizeof(uint32_t) + dim * sizeof(float), '\0');
+    uint32_t n = static_cast<uint32_t>(dim);
+    memcpy(&bytes[0], &n, sizeof(n));
+    memcpy(&bytes[sizeof(n)], vec, dim * sizeof(float));
+    append_hex(sql, bytes.data(), bytes.size());
+}
+
+static std::string table_name(const Backfill_job &job, const char *table) {
+    return quote_identifier(job.schema) + "." + quote_identifier(table);
+}
+
+static std::string checkpoint_table(const Backfill_job &job) {
+    return quote_identifier(job.checkpoint_schema) + "." + quote_identifier(CHECKPOINT_TABLE);
+}
+
+/* Runs a query returning one number. Returns false when there is none */
+static bool query_number(Sql_session &session, const std::string &sql, double *value) {
+    Sql_rows rows;
+    if (session.query(sql, rows) || rows.empty() || rows[0].empty() || rows[0][0].null) {
+        return false;
+    }
+    *value = strtod(rows[0][0].value.c_str(), nullptr);
+    return true;
+}
+
+/* True while Threads_running or replication lag is over its limit */
+static bool over_capacity(Sql_session &session, bool *warned) {
+    static const char *default_lag_query =
+        "SELECT IFNULL(MAX(TIMESTAMPDIFF(MICROSECOND, "
+        "APPLYING_TRANSACTION_ORIGINAL_COMMIT_TIMESTAMP, NOW(6))), 0) / 1000000 "
+        "FROM performance_schema.replication_applier_status_by_worker "
+        "WHERE APPLYING_TRANSACTION <> ''";
+
+    double value = 0;
+
+    if (gembed_backfill_max_threads_running > 0) {
+        // The job's own session is running the query
+        if (query_number(session,
+                         "SELECT VARIABLE_VALUE FROM performance_schema.global_status "
+                         "WHERE VARIABLE_NAME = 'Threads_running'",
+                         &value)) {
+            if (value - 1 > gembed_backfill_max_threads_running) {
+                return true;
+            }
+        } else if (!*warned) {
+            *warned = true;
+            log_message(WARNING_LEVEL, "backfill cannot read Threads_running, "
+                                       "not throttling on it");
+        }
+    }
+
+    if (gembed_backfill_max_lag_s > 0) {
+        const char *lag_query = gembed_backfill_lag_query && *gembed_backfill_lag_query
+                                    ? gembed_backfill_lag_query
+                                    : default_lag_query;
+        if (query_number(session, lag_query, &value)) {
+            return value > gembed_backfill_max_lag_s;
+        }
+        if (!*warned) {
+            *warned = true;
+            log_message(WARNING_LEVEL, "backfill cannot read replication lag, "
+                                       "not throttling on it");
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Blocks while the server is over capacity, see over_capacity().
+ * Returns false when the job is cancelled meanwhile.
+ */
+static bool wait_for_capacity(Backfill_job &job, Sql_session &session, bool *warned) {
+    for (;;) {
+        if (job.cancel.load()) {
+            return false;
+        }
+
+        if (!over_capacity(session, warned)) {
+            job.state.store(BACKFILL_RUNNING);
+            return true;
+        }
+
+        job.state.store(BACKFILL_THROTTLED);
+        gembed_status.backfill_throttle_waits.fetch_add(1, std::memory_order_relaxed);
+        for (int i = 0; i < 10 && !job.cancel.load(); i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+    }
+}
+
+/* Checks the columns and works out how to write primary key values */
+static bool inspect_table(Backfill_job &job, Sql_session &session, std::string &error) {
+    Sql_rows rows;
+    if (session.query("SELECT COLUMN_NAME, DATA_TYPE, COLUMN_KEY "
+                      "FROM information_schema.COLUMNS WHERE TABLE_SCHEMA = " +
+                          quote_string(job.schema) +
+                          " AND TABLE_NAME = " + quote_string(job.table),
+                      rows)) {
+        error = session.error();
+        return true;
+    }
+
+    if (rows.empty()) {
+        error = "Table " + job.schema + "." + job.table + " does not exist";
+        return true;
+    }
+
+    int primary_columns = 0;
+    bool pk_found = false, text_found = false, vec_found = false;
+
+    for (const auto &row : rows) {
+        const char *column = row[0].value.c_str();
+        const std::string &type = row[1].value;
+
+        if (row[2].value == "PRI") {
+            primary_columns++;
+        }
+
+        if (!strcasecmp(column, job.pk_col.c_str())) {
+            pk_found = row[2].value == "PRI";
+            if (type == "tinyint" || type == "smallint" || type == "mediumint" ||
+                type == "int" || type == "bigint" || type == "decimal") {
+                job.key_kind = KEY_NUMBER;
+            } else if (type == "binary" || type == "varbinary" || type.find("blob") != std::string::npos) {
+                job.key_kind = KEY_BINARY;
+            } else {
+                job.key_kind = KEY_STRING;
+            }
+        }
+        text_found |= !strcasecmp(column, job.text_col.c_str());
+        vec_found |= !strcasecmp(column, job.vec_col.c_str());
+    }
+
+    if (!pk_found || primary_columns != 1) {
+        error = job.pk_col + " must be the single-column primary key";
+        return true;
+    }
+    if (!text_found || !vec_found) {
+        error = "Unknown column " + (text_found ? job.vec_col : job.text_col);
+        return true;
+    }
+
+    return false;
+}
+
+/*
+ * Writes one chunk of vectors and its checkpoint in one transaction.
+ * rows are (pk, text) pairs; vectors holds one per row with a text. If the
+ * server went over capacity while it was written, the transaction is rolled
+ * back rather than committed and *deferred is set, for a later retry.
+ */
+static bool write_chunk(Backfill_job &job, Sql_session &session, const Sql_rows &rows,
+                        size_t begin, size_t end, const float *vectors, size_t dim,
+                        bool *warned, bool *deferred, std::string &error) {
+    std::string keys;
+    std::string cases;
+    size_t n_vectors = 0;
+
+    for (size_t i = begin; i < end; i++) {
+        if (rows[i][1].null) {
+            continue;
+        }
+        std::string pk = key_literal(job.key_kind, rows[i][0].value);
+        if (n_vectors++ > 0) keys += ",";
+        keys += pk;
+        cases += " WHEN " + pk + " THEN ";
+        append_vector(cases, vectors + (i - begin) * dim, dim);
+    }
+
+    const std::string &last = rows[end - 1][0].value;
+    long long rows_done = job.rows.load() + static_cast<long long>(end - begin);
+
+    std::string checkpoint = "INSERT INTO " + checkpoint_table(job) +
+                             " (job, last_pk, rows_done) VALUES (" + quote_string(job.key) + ", ";
+    append_hex(checkpoint, last.data(), last.size());
+    checkpoint += ", " + std::to_string(rows_done) +
+                  ") AS new ON DUPLICATE KEY UPDATE last_pk = new.last_pk, "
+                  "rows_done = new.rows_done";
+
+    if (session.execute("START TRANSACTION")) {
+        error = session.error();
+        return true;
+    }
+
+    if ((n_vectors > 0 &&
+         session.execute("UPDATE " + table_name(job, job.table.c_str()) + " SET " +
+                         quote_identifier(job.vec_col) + " = CASE " +
+                         quote_identifier(job.pk_col) + cases + " END WHERE " +
+                         quote_identifier(job.pk_col) + " IN (" + keys + ")")) ||
+        session.execute(checkpoint)) {
+        error = session.error();
+        session.execute("ROLLBACK");
+        return true;
+    }
+
+    // The write can take long enough for the load to change
+    *deferred = over_capacity(session, warned);
+    if (*deferred) {
+        if (session.execute("ROLLBACK")) {
+            error = session.error();
+            return true;
+        }
+        return false;
+    }
+
+    if (session.execute("COMMIT")) {
+        error = session.error();
+        session.execute("ROLLBACK");
+        return true;
+    }
+
+    job.rows.store(rows_done);
+    gembed_status.backfill_rows.fetch_add(end - begin, std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> guard(job.lock);
+    job.last_pk = last;
+    return false;
+}
+
+static bool run_job(Backfill_job &job, Sql_session &session, std::string &error) {
+    if (session.connect(job.user, job.host) || inspect_table(job, session, error)) {
+        if (error.empty()) error = session.error();
+        return true;
+    }
+
+    Sql_rows rows;
+    if (session.execute("CREATE TABLE IF NOT EXISTS " + checkpoint_table(job) +
+                        " (job VARCHAR(512) NOT NULL PRIMARY KEY,"
+                        " last_pk VARBINARY(3072) NOT NULL,"
+                        " rows_done BIGINT UNSIGNED NOT NULL,"
+                        " updated_at TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP"
+                        " ON UPDATE CURRENT_TIMESTAMP)") ||
+        session.query("SELECT last_pk, rows_done FROM " + checkpoint_table(job) +
+                          " WHERE job = " + quote_string(job.key),
+                      rows)) {
+        error = session.error();
+        return true;
+    }
+
+    bool resumed = !rows.empty();
+    if (resumed) {
+        std::lock_guard<std::mutex> guard(job.lock);
+        job.last_pk = rows[0][0].value;
+        job.rows.store(strtoll(rows[0][1].value.c_str(), nullptr, 10));
+    }
+
+    std::string select = "SELECT " + quote_identifier(job.pk_col) + ", " +
+                         quote_identifier(job.text_col) + " FROM " +
+                         table_name(job, job.table.c_str());
+    std::string order = " ORDER BY " + quote_identifier(job.pk_col) + " LIMIT ";
+
+    Embed_options opts;
+    opts.priority = PRIORITY_BULK;
+    bool warned = false;
+    std::vector<StringSlice> texts;
+    std::vector<float> embedded;
+    std::vector<float> vectors;
+
+    for (;;) {
+        if (job.cancel.load()) {
+            return false;
+        }
+
+        if (!wait_for_capacity(job, session, &warned)) {
+            return false;
+        }
+
+        std::string sql = select;
+        if (resumed) {
+            std::lock_guard<std::mutex> guard(job.lock);
+            sql += " WHERE " + quote_identifier(job.pk_col) + " > " +
+                   key_literal(job.key_kind, job.last_pk);
+        }
+        sql += order + std::to_string(std::max(1U, gembed_backfill_batch_rows));
+
+        if (session.query(sql, rows)) {
+            error = session.error();
+            return true;
+        }
+        if (rows.empty()) {
+            break;
+        }
+        resumed = true;
+
+        // One large embedding call per batch, spread over the pool
+        texts.clear();
+        for (const auto &row : rows) {
+            if (!row[1].null) {
+                texts.push_back({row[1].value.data(), row[1].value.size()});
+            }
+        }
+
+        size_t dim = 0;
+        if (!texts.empty() &&
+            embed_with_cache(job.model, texts.data(), texts.size(), opts, embedded, &dim) != 0) {
+            error = "Embedding generation failed";
+            return true;
+        }
+
+        // Spread vectors back over the rows, so chunk offsets line up
+        vectors.assign(rows.size() * dim, 0.0f);
+        for (size_t i = 0, k = 0; i < rows.size(); i++) {
+            if (!rows[i][1].null) {
+                memcpy(vectors.data() + i * dim, embedded.data() + k++ * dim, dim * sizeof(float));
+            }
+        }
+
+        size_t chunk = std::max(1U, gembed_backfill_chunk_rows);
+        for (size_t begin = 0; begin < rows.size();) {
+            if (!wait_for_capacity(job, session, &warned)) {
+                return false;
+            }
+
+            size_t end = std::min(rows.size(), begin + chunk);
+            bool deferred = false;
+            if (write_chunk(job, session, rows, begin, end,
+                            vectors.data() + begin * dim, dim, &warned, &deferred, error)) {
+                return true;
+            }
+            if (!deferred) {
+                begin = end;
+            }
+        }
+    }
+
+    if (session.execute("DELETE FROM " + checkpoint_table(job) +
+                        " WHERE job = " + quote_string(job.key))) {
+        error = session.error();
+        return true;
+    }
+
+    return false;
+}
+
+static void job_main(Backfill_job *job) {
+    std::string error;
+    bool thread_attached = !mysql_service_mysql_command_thread->init();
+
+    bool failed;
+    {
+        Sql_session session;
+        failed = !thread_attached || run_job(*job, session, error);
+        if (!thread_attached) error = "could not attach the job thread to the server";
+    }
+
+    if (thread_attached) {
+        mysql_service_mysql_command_thread->end();
+    }
+
+    if (failed) {
+        {
+            std::lock_guard<std::mutex> guard(job->lock);
+            job->error = error;
+        }
+        job->state.store(BACKFILL_FAILED);
+
+        char msg[MYSQL_ERRMSG_SIZE];
+        snprintf(msg, sizeof(msg), "backfill %lld of %s.%s failed: %s", job->id,
+                 job->schema.c_str(), job->table.c_str(), error.c_str());
+        log_message(ERROR_LEVEL, msg);
+    } else {
+        job->state.store(job->cancel.load() ? BACKFILL_CANCELLED : BACKFILL_DONE);
+    }
+
+    gembed_status.backfill_jobs_running.fetch_sub(1, std::memory_order_relaxed);
+    job->finished.store(true);
+}
+
+/* The account of the calling session */
+static bool current_user(std::string &user, std::string &host) {
+    MYSQL_THD thd = nullptr;
+    Security_context_handle ctx = nullptr;
+    MYSQL_LEX_CSTRING priv_user{nullptr, 0};
+    MYSQL_LEX_CSTRING priv_host{nullptr, 0};
+
+    if (mysql_service_mysql_current_thread_reader->get(&thd) || !thd ||
+        mysql_service_mysql_thd_security_context->get(thd, &ctx) ||
+        mysql_service_mysql_security_context_options->get(ctx, "priv_user", &priv_user) ||
+        mysql_service_mysql_security_context_options->get(ctx, "priv_host", &priv_host) ||
+        !priv_user.str || !priv_host.str) {
+        return false;
+    }
+
+    user.assign(priv_user.str, priv_user.length);
+    host.assign(priv_host.str, priv_host.length);
+    return true;
+}
+
+static Backfill_job *find_job(long long id) {
+    for (const auto &job : jobs) {
+        if (job->id == id) return job.get();
+    }
+    return nullptr;
+}
+
+void backfill_stop() {
+    std::lock_guard<std::mutex> guard(jobs_lock);
+
+    for (const auto &job : jobs) {
+        job->cancel.store(true);
+    }
+    // A cancelled job stops after its current chunk; the checkpoint stays
+    for (const auto &job : jobs) {
+        if (job->thread.joinable()) {
+            job->thread.join();
+        }
+    }
+    jobs.clear();
+}
+
+bool gembed_backfill_init(UDF_INIT *initid, UDF_ARGS *args, char *message) {
+    if (args->arg_count != 6) {
+        snprintf(message, MYSQL_ERRMSG_SIZE,
+                 "GEMBED_BACKFILL requires 6 arguments: schema.table, pk_col, "
+                 "text_col, vec_col, method, model");
+        return true;
+    }
+
+    for (unsigned int i = 0; i < args->arg_count; i++) {
+        if (args->arg_type[i] != STRING_RESULT) {
+            snprintf(message, MYSQL_ERRMSG_SIZE, "All arguments must be strings");
+            return true;
+        }
+    }
+
+    initid->maybe_null = true;
+    return false;
+}
+
+long long gembed_backfill(UDF_INIT *, UDF_ARGS *args, unsigned char *is_null,
+                          unsigned char *error) {
+    for (unsigned int i = 0; i < 6; i++) {
+        if (!args->args[i]) {
+            *is_null = 1;
+            return 0;
+        }
+    }
+
+    auto job = std::make_unique<Backfill_job>();
+    std::string table(args->args[0], args->lengths[0]);
+    size_t dot = table.find('.');
+    if (dot == std::string::npos || dot == 0 || dot + 1 == table.size()) {
+        *error = 1;
+        log_message(ERROR_LEVEL, "GEMBED_BACKFILL needs a schema-qualified table name");
+        return 0;
+    }
+    job->schema = table.substr(0, dot);
+    job->table = table.substr(dot + 1);
+    job->checkpoint_schema = gembed_backfill_checkpoint_schema &&
+                                     *gembed_backfill_checkpoint_schema
+                                 ? gembed_backfill_checkpoint_schema
+                                 : job->schema;
+    job->pk_col.assign(args->args[1], args->lengths[1]);
+    job->text_col.assign(args->args[2], args->lengths[2]);
+    job->vec_col.assign(args->args[3], args->lengths[3]);
+
+    char message[MYSQL_ERRMSG_SIZE];
+    job->model = model_registry_get(args->args[4], args->args[5], message, sizeof(message));
+    if (!job->model) {
+        *error = 1;
+        log_message(ERROR_LEVEL, message);
+        return 0;
+    }
+
+    if (!current_user(job->user, job->host)) {
+        *error = 1;
+        log_message(ERROR_LEVEL, "GEMBED_BACKFILL could not determine the calling account");
+        return 0;
+    }
+
+    job->key = table + "(" + job->pk_col + "," + job->text_col + "," + job->vec_col + ") " +
+               job->model->method + "/" + job->model->model;
+    if (job->key.size() > 512) {
+        *error = 1;
+        log_message(ERROR_LEVEL, "GEMBED_BACKFILL arguments are too long");
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> guard(jobs_lock);
+
+    for (const auto &other : jobs) {
+        // Reap threads of finished jobs while we are here
+        if (other->finished.load() && other->thread.joinable()) {
+            other->thread.join();
+        }
+        if (other->key == job->key && !other->finished.load()) {
+            *error = 1;
+            log_message(ERROR_LEVEL, "A backfill with these arguments is already running");
+            return 0;
+        }
+    }
+
+    job->id = next_job_id++;
+    Backfill_job *started = job.get();
+    jobs.push_back(std::move(job));
+    gembed_status.backfill_jobs_running.fetch_add(1, std::memory_order_relaxed);
+
+    try {
+        started->thread = std::thread(job_main, started);
+    } catch (const std::system_error &) {
+        gembed_status.backfill_jobs_running.fetch_sub(1, std::memory_order_relaxed);
+        jobs.pop_back();
+        *error = 1;
+        log_message(ERROR_LEVEL, "failed to start the backfill thread");
+        return 0;
+    }
+
+    return started->id;
+}
+
+bool gembed_backfill_status_init(UDF_INIT *initid, UDF_ARGS *args, char *message) {
+    if (args->arg_count != 1) {
+        snprintf(message, MYSQL_ERRMSG_SIZE, "GEMBED_BACKFILL_STATUS requires 1 argument: job");
+        return true;
+    }
+    args->arg_type[0] = INT_RESULT;
+
+    initid->maybe_null = true;
+    initid->max_length = 65535;
+    initid->ptr = nullptr;
+    return false;
+}
+
+void gembed_backfill_status_deinit(UDF_INIT *initid) {
+    if (initid->ptr) {
+        delete[] initid->ptr;
+        initid->ptr = nullptr;
+    }
+}
+
+static void append_json_string(std::string &out, const std::string &value) {
+    out.push_back('"');
+    for (unsigned char c : value) {
+        if (c == '"' || c == '\\') {
+            out.push_back('\\');
+            out.push_back(c);
+        } else if (c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        } else {
+            out.push_back(c);
+        }
+    }
+    out.push_back('"');
+}
+
+char *gembed_backfill_status(UDF_INIT *initid, UDF_ARGS *args, char *,
+                             unsigned long *length, unsigned char *is_null,
+                             unsigned char *) {
+    if (!args->args[0]) {
+        *is_null = 1;
+        return nullptr;
+    }
+
+    long long id = *reinterpret_cast<long long *>(args->args[0]);
+    std::string json;
+    {
+        std::lock_guard<std::mutex> guard(jobs_lock);
+        Backfill_job *job = find_job(id);
+        if (!job) {
+            *is_null = 1;
+            return nullptr;
+        }
+
+        std::lock_guard<std::mutex> job_guard(job->lock);
+        json = "{\"job\": " + std::to_string(job->id) + ", \"table\": ";
+        append_json_string(json, job->schema + "." + job->table);
+        json += ", \"state\": \"";
+        json += state_names[job->state.load()];
+        json += "\", \"rows\": " + std::to_string(job->rows.load()) + ", \"last_pk\": ";
+        if (job->last_pk.empty()) {
+            json += "null";
+        } else if (job->key_kind == KEY_BINARY) {
+            std::string hex;
+            append_hex(hex, job->last_pk.data(), job->last_pk.size());
+            append_json_string(json, hex);
+        } else {
+            append_json_string(json, job->last_pk);
+        }
+        json += ", \"error\": ";
+        if (job->error.empty()) {
+            json += "null";
+        } else {
+            append_json_string(json, job->error);
+        }
+        json += "}";
+    }
+
+    char *out = new char[json.size()];
+    memcpy(out, json.data(), json.size());
+    if (initid->ptr) {
+        delete[] initid->ptr;
+    }
+    initid->ptr = out;
+    *length = json.size();
+    return out;
+}
+
+bool gembed_backfill_cancel_init(UDF_INIT *, UDF_ARGS *args, char *message) {
+    if (args->arg_count != 1) {
+        snprintf(message, MYSQL_ERRMSG_SIZE, "GEMBED_BACKFILL_CANCEL requires 1 argument: job");
+        return true;
+    }
+    args->arg_type[0] = INT_RESULT;
+    return false;
+}
+
+long long gembed_backfill_cancel(UDF_INIT *, UDF_ARGS *args, unsigned char *is_null,
+                                 unsigned char *) {
+    if (!args->args[0]) {
+        *is_null = 1;
+        return 0;
+    }
+
+    long long id = *reinterpret_cast<long long *>(args->args[0]);
+    std::lock_guard<std::mutex> guard(jobs_lock);
+    Backfill_job *job = find_job(id);
+    if (!job || job->finished.load()) {
+        return 0;
+    }
+    job->cancel.store(true);
+    return 1;
+}
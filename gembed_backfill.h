@@ -0,0 +1,62 @@
+/* Copyright (c) 2025, Joel Díaz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+#ifndef GEMBED_BACKFILL_H
+#define GEMBED_BACKFILL_H
+
+#include <mysql/udf_registration_types.h>
+
+/*
+ * Background re-embedding of a whole table.
+ *
+ * GEMBED_BACKFILL() starts a job on its own thread that walks the table in
+ * primary key order through the SQL command service, as the calling user.
+ * Rows are read and embedded gembed.backfill_batch_rows at a time on the
+ * inference pool, at bulk priority. Vectors are then written back in
+ * transactions of gembed.backfill_chunk_rows rows.
+ *
+ * Each chunk also records the last primary key written in
+ * gembed_backfill_checkpoint, in the same transaction. The table lives in
+ * gembed.backfill_checkpoint_schema, or the backfilled table's schema. Calling
+ * GEMBED_BACKFILL() again with the same arguments after a failure or
+ * restart resumes from there. The checkpoint row is deleted once the whole
+ * table is done.
+ *
+ * Before each read and each chunk the job waits while Threads_running,
+ * less its own session, is above gembed.backfill_max_threads_running or
+ * replication lag is above gembed.backfill_max_lag_s. A chunk that finds
+ * the server over either limit before its commit is rolled back and retried.
+ */
+
+/* Cancels every job and waits for their threads */
+void backfill_stop();
+
+/* UDF: GEMBED_BACKFILL(schema.table, pk_col, text_col, vec_col, method, model) -> job id */
+bool gembed_backfill_init(UDF_INIT *initid, UDF_ARGS *args, char *message);
+long long gembed_backfill(UDF_INIT *initid, UDF_ARGS *args,
+                          unsigned char *is_null, unsigned char *error);
+
+/* UDF: GEMBED_BACKFILL_STATUS(job) -> JSON object with the job's progress */
+bool gembed_backfill_status_init(UDF_INIT *initid, UDF_ARGS *args, char *message);
+char *gembed_backfill_status(UDF_INIT *initid, UDF_ARGS *args, char *result,
+                             unsigned long *length, unsigned char *is_null,
+                             unsigned char *error);
+void gembed_backfill_status_deinit(UDF_INIT *initid);
+
+/* UDF: GEMBED_BACKFILL_CANCEL(job) -> 1 if the job was running */
+bool gembed_backfill_cancel_init(UDF_INIT *initid, UDF_ARGS *args, char *message);
+long long gembed_backfill_cancel(UDF_INIT *initid, UDF_ARGS *args,
+                                 unsigned char *is_null, unsigned char *error);
+
+#endif /* GEMBED_BACKFILL_H */
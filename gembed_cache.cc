@@ -0,0 +1,167 @@
+/* Copyright (c) 2025, Joel Díaz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+
+#include "gembed_cache.h"
+
+#include <atomic>
+#include <cstdint>
+#include <iterator>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "gembed_hash.h"
+#include "gembed_vars.h"
+
+/* Shards keep lock hold times short when many sessions hit the cache */
+#define CACHE_SHARDS 16
+
+/* Rough per-entry bookkeeping cost: list node, map node, string header */
+#define ENTRY_OVERHEAD 128
+
+namespace {
+
+struct Cache_entry {
+    uint64_t hash;
+    int method_id;
+    int model_id;
+    std::string text;
+    std::vector<float> vec;
+
+    size_t footprint() const {
+        return ENTRY_OVERHEAD + text.size() + vec.size() * sizeof(float);
+    }
+};
+
+struct Cache_shard {
+    std::mutex lock;
+    std::list<Cache_entry> lru;  // most recently used first
+    std::unordered_map<uint64_t, std::list<Cache_entry>::iterator> index;
+    size_t bytes = 0;
+};
+
+}  // namespace
+
+static Cache_shard shards[CACHE_SHARDS];
+static std::atomic<size_t> shard_capacity{0};
+
+static uint64_t cache_key(int method_id, int model_id,
+                          const char *text, size_t len) {
+    uint64_t seed = (static_cast<uint64_t>(static_cast<uint32_t>(method_id)) << 32) |
+                    static_cast<uint32_t>(model_id);
+    return xxh64(text, len, seed);
+}
+
+static Cache_shard &shard_for(uint64_t hash) {
+    // The low bits pick the bucket inside the map, use the high ones here
+    return shards[(hash >> 60) % CACHE_SHARDS];
+}
+
+static void erase_entry(Cache_shard &shard,
+                        std::list<Cache_entry>::iterator it) {
+    shard.bytes -= it->footprint();
+    gembed_status.cache_entries.fetch_sub(1, std::memory_order_relaxed);
+    gembed_status.cache_bytes.fetch_sub(it->footprint(), std::memory_order_relaxed);
+    shard.index.erase(it->hash);
+    shard.lru.erase(it);
+}
+
+static void evict_to(Cache_shard &shard, size_t limit) {
+    while (shard.bytes > limit && !shard.lru.empty()) {
+        erase_entry(shard, std::prev(shard.lru.end()));
+        gembed_status.cache_evictions.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+bool embedding_cache_get(int method_id, int model_id,
+                         const char *text, size_t len,
+                         std::vector<float> &out) {
+    if (shard_capacity.load(std::memory_order_relaxed) == 0) {
+        return false;
+    }
+
+    uint64_t hash = cache_key(method_id, model_id, text, len);
+    Cache_shard &shard = shard_for(hash);
+    std::lock_guard<std::mutex> guard(shard.lock);
+
+    auto found = shard.index.find(hash);
+    if (found == shard.index.end()) {
+        gembed_status.cache_misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    const Cache_entry &entry = *found->second;
+    if (entry.method_id != method_id || entry.model_id != model_id ||
+        entry.text.size() != len || memcmp(entry.text.data(), text, len) != 0) {
+        gembed_status.cache_misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    shard.lru.splice(shard.lru.begin(), shard.lru, found->second);
+    out.assign(entry.vec.begin(), entry.vec.end());
+    gembed_status.cache_hits.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void embedding_cache_put(int method_id, int model_id,
+                         const char *text, size_t len,
+                         const float *vec, size_t dim) {
+    size_t capacity = shard_capacity.load(std::memory_order_relaxed);
+    if (capacity == 0) {
+        return;
+    }
+
+    uint64_t hash = cache_key(method_id, model_id, text, len);
+    Cache_entry entry{hash, method_id, model_id, std::string(text, len),
+                      std::vector<float>(vec, vec + dim)};
+    size_t footprint = entry.footprint();
+    if (footprint > capacity) {
+        return;
+    }
+
+    Cache_shard &shard = shard_for(hash);
+    std::lock_guard<std::mutex> guard(shard.lock);
+
+    // A colliding or stale entry is simply replaced
+    auto found = shard.index.find(hash);
+    if (found != shard.index.end()) {
+        erase_entry(shard, found->second);
+    }
+
+    evict_to(shard, capacity - footprint);
+
+    shard.lru.push_front(std::move(entry));
+    shard.index.emplace(hash, shard.lru.begin());
+    shard.bytes += footprint;
+    gembed_status.cache_entries.fetch_add(1, std::memory_order_relaxed);
+    gembed_status.cache_bytes.fetch_add(footprint, std::memory_order_relaxed);
+}
+
+void embedding_cache_set_capacity(size_t bytes) {
+    size_t capacity = bytes / CACHE_SHARDS;
+    shard_capacity.store(capacity, std::memory_order_relaxed);
+
+    for (Cache_shard &shard : shards) {
+        std::lock_guard<std::mutex> guard(shard.lock);
+        evict_to(shard, capacity);
+    }
+}
+
+void embedding_cache_clear() {
+    for (Cache_shard &shard : shards) {
+        std::lock_guard<std::mutex> guard(shard.lock);
+        evict_to(shard, 0);
+    }
+}
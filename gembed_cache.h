@@ -0,0 +1,43 @@
+/* Copyright (c) 2025, Joel Díaz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+#ifndef GEMBED_CACHE_H
+#define GEMBED_CACHE_H
+
+#include <cstddef>
+#include <vector>
+
+/*
+ * In-memory embedding cache shared by all sessions.
+ * Keyed by (method, model, text) and bounded by gembed.cache_size_mb;
+ * least recently used entries are evicted first.
+ */
+
+/* Copies the cached vector for text into out, returns false on a miss */
+bool embedding_cache_get(int method_id, int model_id,
+                         const char *text, size_t len,
+                         std::vector<float> &out);
+
+/* Stores a freshly generated vector */
+void embedding_cache_put(int method_id, int model_id,
+                         const char *text, size_t len,
+                         const float *vec, size_t dim);
+
+/* Changes the memory budget, evicting entries as needed. 0 disables the cache */
+void embedding_cache_set_capacity(size_t bytes);
+
+/* Drops every entry */
+void embedding_cache_clear();
+
+#endif /* GEMBED_CACHE_H */
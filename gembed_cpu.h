@@ -0,0 +1,48 @@
+/* Copyright (c) 2025, Joel Díaz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+#ifndef GEMBED_CPU_H
+#define GEMBED_CPU_H
+
+/*
+ * Instruction set extensions of the CPU, for kernels picked at run time:
+ * the component is built for the baseline ISA and uses wider instructions
+ * only where the CPU has them.
+ */
+struct Cpu_features {
+    bool avx2 = false;
+    bool fma = false;
+    bool f16c = false;
+    bool avx512f = false;
+    bool avx512bf16 = false;
+};
+
+inline const Cpu_features &cpu_features() {
+    static const Cpu_features features = [] {
+        Cpu_features f;
+#if defined(__x86_64__)
+        // May run from a static constructor, before libgcc's own
+        __builtin_cpu_init();
+        f.avx2 = __builtin_cpu_supports("avx2");
+        f.fma = __builtin_cpu_supports("fma");
+        f.f16c = __builtin_cpu_supports("f16c");
+        f.avx512f = __builtin_cpu_supports("avx512f");
+        f.avx512bf16 = __builtin_cpu_supports("avx512bf16");
+#endif
+        return f;
+    }();
+    return features;
+}
+
+#endif /* GEMBED_CPU_H */
@@ -0,0 +1,550 @@
+/* Copyright (c) 2025, Joel Díaz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+
+#include "gembed_disk_cache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "gembed_hash.h"
+#include "gembed_services.h"
+#include "gembed_vars.h"
+
+#define SEGMENT_MAGIC 0x43444547U  /* "GEDC" */
+#define SEGMENT_VERSION 1
+#define RECORD_MAGIC 0x52434547U   /* "GECR" */
+#define SEGMENT_SIZE (64UL * 1024 * 1024)
+#define INDEX_SHARDS 16
+#define MB (1024UL * 1024UL)
+
+/* Seed of the second hash that confirms a key match */
+#define CHECK_SEED 0x9E3779B97F4A7C15ULL
+
+struct Segment_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t id;
+    uint32_t reserved;
+};
+
+/* Followed by dim floats. Records start 8-byte aligned */
+struct Record_header {
+    std::atomic<uint32_t> magic;  /* stored last: a record without it was torn */
+    uint32_t dim;
+    uint64_t key;
+    uint64_t check;
+    uint64_t fingerprint;
+    uint64_t checksum;            /* of the floats, seeded with key */
+};
+
+static_assert(sizeof(Record_header) == 40, "record header is part of the file format");
+
+#define FIRST_RECORD sizeof(Segment_header)
+
+struct Disk_segment {
+    uint32_t id = 0;
+    int fd = -1;
+    unsigned char *base = nullptr;
+    size_t size = 0;
+
+    ~Disk_segment() {
+        if (base) {
+            munmap(base, size);
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+};
+
+struct Location {
+    uint32_t segment;
+    uint32_t offset;
+    bool recent;  /* read since the last compaction pass */
+};
+
+struct Index_shard {
+    std::mutex lock;
+    std::unordered_map<uint64_t, Location> entries;
+};
+
+static std::atomic<bool> enabled{false};
+static std::string cache_dir;
+static int lock_fd = -1;
+
+static Index_shard index_shards[INDEX_SHARDS];
+
+static std::shared_mutex segments_lock;
+static std::map<uint32_t, std::shared_ptr<Disk_segment>> segments;
+
+/* Records are appended to the newest segment one at a time */
+static std::mutex append_lock;
+static std::shared_ptr<Disk_segment> active;
+static size_t active_used = 0;
+static uint32_t next_segment_id = 1;  /* past every file the directory held */
+
+static std::mutex compactor_lock;
+static std::condition_variable compactor_cv;
+static std::thread compactor;
+static bool compactor_stopping = false;
+
+static size_t record_size(uint32_t dim) {
+    return (sizeof(Record_header) + dim * sizeof(float) + 7) & ~static_cast<size_t>(7);
+}
+
+static Index_shard &shard_for(uint64_t key) {
+    return index_shards[(key >> 60) % INDEX_SHARDS];
+}
+
+static std::string segment_path(uint32_t id) {
+    char name[32];
+    snprintf(name, sizeof(name), "/seg-%08u.gec", id);
+    return cache_dir + name;
+}
+
+static void index_set(uint64_t key, const Location &location) {
+    Index_shard &shard = shard_for(key);
+    std::lock_guard<std::mutex> guard(shard.lock);
+    if (shard.entries.insert_or_assign(key, location).second) {
+        gembed_status.persistent_cache_entries.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+/*
+ * Reserves the blocks of a segment. Records are stored through the
+ * mapping, where a full disk would raise SIGBUS rather than fail a write.
+ */
+static bool reserve_segment(int fd, size_t size) {
+    int err = posix_fallocate(fd, 0, static_cast<off_t>(size));
+    if (err != 0) {
+        errno = err;
+        return false;
+    }
+    return true;
+}
+
+/* Unlinks a partly created segment, keeping errno for the caller's message */
+static void discard_segment(const std::string &path) {
+    int err = errno;
+    unlink(path.c_str());
+    errno = err;
+}
+
+/* Maps segment id, creating the file if asked to. Returns NULL on failure */
+static std::shared_ptr<Disk_segment> map_segment(uint32_t id, bool create) {
+    std::string path = segment_path(id);
+    auto segment = std::make_shared<Disk_segment>();
+    segment->id = id;
+
+    segment->fd = open(path.c_str(), O_RDWR | O_CLOEXEC | (create ? O_CREAT | O_EXCL : 0), 0640);
+    if (segment->fd < 0) {
+        return nullptr;
+    }
+    if (create && !reserve_segment(segment->fd, SEGMENT_SIZE)) {
+        discard_segment(path);
+        return nullptr;
+    }
+
+    struct stat st;
+    if (fstat(segment->fd, &st) != 0 || static_cast<size_t>(st.st_size) < FIRST_RECORD) {
+        return nullptr;
+    }
+    segment->size = static_cast<size_t>(st.st_size);
+
+    void *mapping = mmap(nullptr, segment->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                         segment->fd, 0);
+    if (mapping == MAP_FAILED) {
+        if (create) {
+            discard_segment(path);
+        }
+        return nullptr;
+    }
+    segment->base = static_cast<unsigned char *>(mapping);
+
+    Segment_header *header = reinterpret_cast<Segment_header *>(segment->base);
+    if (create) {
+        header->magic = SEGMENT_MAGIC;
+        header->version = SEGMENT_VERSION;
+        header->id = id;
+    } else if (header->magic != SEGMENT_MAGIC || header->version != SEGMENT_VERSION ||
+               header->id != id) {
+        return nullptr;
+    }
+    return segment;
+}
+
+/* Indexes the records of segment. Returns the offset past the last one */
+static size_t scan_segment(const Disk_segment *segment) {
+    size_t offset = FIRST_RECORD;
+
+    while (offset + sizeof(Record_header) <= segment->size) {
+        const Record_header *record =
+            reinterpret_cast<const Record_header *>(segment->base + offset);
+        if (record->magic.load(std::memory_order_acquire) != RECORD_MAGIC ||
+            record->dim == 0 || offset + record_size(record->dim) > segment->size) {
+            break;
+        }
+        index_set(record->key, {segment->id, static_cast<uint32_t>(offset), false});
+        offset += record_size(record->dim);
+    }
+    return offset;
+}
+
+static bool over_budget() {
+    size_t budget = static_cast<size_t>(gembed_persistent_cache_size_mb) * MB;
+    std::shared_lock<std::shared_mutex> guard(segments_lock);
+    return segments.size() > 2 && segments.size() * SEGMENT_SIZE > budget;
+}
+
+static void wake_compactor() {
+    // Under the lock, so the wakeup cannot slip in between check and wait
+    std::lock_guard<std::mutex> guard(compactor_lock);
+    compactor_cv.notify_one();
+}
+
+/* Called with append_lock held. Returns false if no segment could be made */
+static bool start_segment() {
+    // Never an id a failed attempt or a leftover file may still hold
+    uint32_t id = next_segment_id++;
+
+    std::shared_ptr<Disk_segment> segment = map_segment(id, true);
+    if (!segment) {
+        char msg[512];
+        snprintf(msg, sizeof(msg), "cannot create persistent cache segment %s: %s",
+                 segment_path(id).c_str(), strerror(errno));
+        log_message(ERROR_LEVEL, msg);
+        return false;
+    }
+
+    {
+        std::unique_lock<std::shared_mutex> guard(segments_lock);
+        segments[id] = segment;
+    }
+    gembed_status.persistent_cache_bytes.fetch_add(SEGMENT_SIZE, std::memory_order_relaxed);
+
+    active = segment;
+    active_used = FIRST_RECORD;
+
+    if (over_budget()) {
+        wake_compactor();
+    }
+    return true;
+}
+
+static void append_record(uint64_t key, uint64_t check, uint64_t fingerprint,
+                          const float *vec, uint32_t dim) {
+    size_t size = record_size(dim);
+    if (size > SEGMENT_SIZE - FIRST_RECORD) {
+        return;
+    }
+
+    uint32_t segment_id;
+    size_t offset;
+    {
+        std::lock_guard<std::mutex> guard(append_lock);
+        if (!active || active_used + size > active->size) {
+            if (!start_segment()) {
+                return;
+            }
+        }
+
+        segment_id = active->id;
+        offset = active_used;
+        active_used += size;
+
+        Record_header *record = reinterpret_cast<Record_header *>(active->base + offset);
+        record->dim = dim;
+        record->key = key;
+        record->check = check;
+        record->fingerprint = fingerprint;
+        record->checksum = xxh64(vec, dim * sizeof(float), key);
+        memcpy(reinterpret_cast<unsigned char *>(record) + sizeof(Record_header), vec,
+               dim * sizeof(float));
+        record->magic.store(RECORD_MAGIC, std::memory_order_release);
+    }
+
+    index_set(key, {segment_id, static_cast<uint32_t>(offset), false});
+}
+
+/* Keeps the records of the oldest segment read since the last pass, then drops it */
+static void compact_oldest() {
+    std::shared_ptr<Disk_segment> oldest;
+    {
+        std::shared_lock<std::shared_mutex> guard(segments_lock);
+        oldest = segments.begin()->second;
+    }
+
+    size_t offset = FIRST_RECORD;
+    while (offset + sizeof(Record_header) <= oldest->size) {
+        const Record_header *record =
+            reinterpret_cast<const Record_header *>(oldest->base + offset);
+        if (record->magic.load(std::memory_order_acquire) != RECORD_MAGIC ||
+            record->dim == 0 || offset + record_size(record->dim) > oldest->size) {
+            break;
+        }
+
+        bool keep = false;
+        {
+            Index_shard &shard = shard_for(record->key);
+            std::lock_guard<std::mutex> guard(shard.lock);
+            auto it = shard.entries.find(record->key);
+            // Superseded copies are already dead
+            if (it != shard.entries.end() && it->second.segment == oldest->id &&
+                it->second.offset == offset) {
+                keep = it->second.recent;
+                if (!keep) {
+                    shard.entries.erase(it);
+                    gembed_status.persistent_cache_entries.fetch_sub(
+                        1, std::memory_order_relaxed);
+                }
+            }
+        }
+
+        if (keep) {
+            append_record(record->key, record->check, record->fingerprint,
+                          reinterpret_cast<const float *>(record + 1), record->dim);
+        }
+        offset += record_size(record->dim);
+    }
+
+    // Readers holding a hit keep the mapping until they are done
+    {
+        std::unique_lock<std::shared_mutex> guard(segments_lock);
+        segments.erase(oldest->id);
+    }
+    unlink(segment_path(oldest->id).c_str());
+    gembed_status.persistent_cache_bytes.fetch_sub(SEGMENT_SIZE, std::memory_order_relaxed);
+    gembed_status.persistent_cache_compactions.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void run_compactor() {
+    std::unique_lock<std::mutex> guard(compactor_lock);
+
+    while (!compactor_stopping) {
+        if (!over_budget()) {
+            compactor_cv.wait(guard);
+            continue;
+        }
+        guard.unlock();
+        compact_oldest();
+        guard.lock();
+    }
+}
+
+void disk_cache_open() {
+    if (!gembed_persistent_cache_dir || !*gembed_persistent_cache_dir) {
+        return;
+    }
+
+    cache_dir = gembed_persistent_cache_dir;
+    while (cache_dir.size() > 1 && cache_dir.back() == '/') {
+        cache_dir.pop_back();
+    }
+
+    char msg[512];
+    if (mkdir(cache_dir.c_str(), 0750) != 0 && errno != EEXIST) {
+        snprintf(msg, sizeof(msg), "cannot create persistent cache directory %s: %s",
+                 cache_dir.c_str(), strerror(errno));
+        log_message(ERROR_LEVEL, msg);
+        return;
+    }
+
+    // Segments are written in place, so only one server may use a directory
+    std::string lock_path = cache_dir + "/lock";
+    lock_fd = open(lock_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0640);
+    if (lock_fd < 0 || flock(lock_fd, LOCK_EX | LOCK_NB) != 0) {
+        snprintf(msg, sizeof(msg), "persistent cache directory %s is not usable or "
+                 "is in use by another server", cache_dir.c_str());
+        log_message(ERROR_LEVEL, msg);
+        if (lock_fd >= 0) {
+            close(lock_fd);
+            lock_fd = -1;
+        }
+        return;
+    }
+
+    std::vector<uint32_t> ids;
+    if (DIR *dir = opendir(cache_dir.c_str())) {
+        while (struct dirent *entry = readdir(dir)) {
+            unsigned int id;
+            char tail;
+            if (strlen(entry->d_name) == 16 &&
+                sscanf(entry->d_name, "seg-%8u.ge%c", &id, &tail) == 2 && tail == 'c') {
+                ids.push_back(id);
+            }
+        }
+        closedir(dir);
+    }
+    std::sort(ids.begin(), ids.end());
+    next_segment_id = ids.empty() ? 1 : ids.back() + 1;
+
+    // Later segments hold the newer copy of a key, so they are indexed last
+    size_t used = 0;
+    for (uint32_t id : ids) {
+        std::shared_ptr<Disk_segment> segment = map_segment(id, false);
+        if (!segment) {
+            snprintf(msg, sizeof(msg), "removing damaged persistent cache segment %s",
+                     segment_path(id).c_str());
+            log_message(WARNING_LEVEL, msg);
+            unlink(segment_path(id).c_str());
+            continue;
+        }
+        used = scan_segment(segment.get());
+        segments[id] = segment;
+        active = segment;
+        gembed_status.persistent_cache_bytes.fetch_add(segment->size,
+                                                       std::memory_order_relaxed);
+    }
+    active_used = used;
+
+    // A segment of an older build may be sparse: append to a fresh one instead
+    if (active && !reserve_segment(active->fd, active->size)) {
+        active.reset();
+    }
+
+    compactor_stopping = false;
+    try {
+        compactor = std::thread(run_compactor);
+    } catch (const std::system_error &) {
+        log_message(ERROR_LEVEL, "failed to start the persistent cache compactor");
+        active.reset();
+        segments.clear();
+        for (Index_shard &shard : index_shards) {
+            shard.entries.clear();
+        }
+        gembed_status.persistent_cache_entries.store(0, std::memory_order_relaxed);
+        gembed_status.persistent_cache_bytes.store(0, std::memory_order_relaxed);
+        close(lock_fd);
+        lock_fd = -1;
+        return;
+    }
+
+    snprintf(msg, sizeof(msg), "persistent cache %s: %lld vectors in %zu segments",
+             cache_dir.c_str(),
+             static_cast<long long>(gembed_status.persistent_cache_entries.load()),
+             segments.size());
+    log_message(INFORMATION_LEVEL, msg);
+    enabled.store(true, std::memory_order_release);
+}
+
+void disk_cache_close() {
+    if (!enabled.exchange(false)) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(compactor_lock);
+        compactor_stopping = true;
+    }
+    compactor_cv.notify_all();
+    compactor.join();
+
+    {
+        std::lock_guard<std::mutex> guard(append_lock);
+        active.reset();
+    }
+    {
+        std::unique_lock<std::shared_mutex> guard(segments_lock);
+        segments.clear();
+    }
+    for (Index_shard &shard : index_shards) {
+        std::lock_guard<std::mutex> guard(shard.lock);
+        shard.entries.clear();
+    }
+    gembed_status.persistent_cache_entries.store(0, std::memory_order_relaxed);
+    gembed_status.persistent_cache_bytes.store(0, std::memory_order_relaxed);
+
+    close(lock_fd);
+    lock_fd = -1;
+}
+
+bool disk_cache_enabled() {
+    return enabled.load(std::memory_order_acquire);
+}
+
+bool disk_cache_get(uint64_t fingerprint, const char *text, size_t len,
+                    Disk_cache_hit *hit) {
+    uint64_t key = xxh64(text, len, fingerprint);
+    Location location;
+    {
+        Index_shard &shard = shard_for(key);
+        std::lock_guard<std::mutex> guard(shard.lock);
+        auto it = shard.entries.find(key);
+        if (it == shard.entries.end()) {
+            gembed_status.persistent_cache_misses.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        it->second.recent = true;
+        location = it->second;
+    }
+
+    std::shared_ptr<Disk_segment> segment;
+    {
+        std::shared_lock<std::shared_mutex> guard(segments_lock);
+        auto it = segments.find(location.segment);
+        if (it != segments.end()) {
+            segment = it->second;
+        }
+    }
+
+    // A compacted segment, a hash collision or a torn write all read as a miss
+    const Record_header *record =
+        segment ? reinterpret_cast<const Record_header *>(segment->base + location.offset)
+                : nullptr;
+    const float *vec = record ? reinterpret_cast<const float *>(record + 1) : nullptr;
+    if (!record || record->fingerprint != fingerprint ||
+        record->check != xxh64(text, len, fingerprint ^ CHECK_SEED) ||
+        record->checksum != xxh64(vec, record->dim * sizeof(float), key)) {
+        gembed_status.persistent_cache_misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    hit->segment = std::move(segment);
+    hit->vec = vec;
+    hit->dim = record->dim;
+    gembed_status.persistent_cache_hits.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void disk_cache_put(uint64_t fingerprint, const char *text, size_t len,
+                    const float *vec, size_t dim) {
+    if (!disk_cache_enabled() || dim == 0 || dim > UINT32_MAX / sizeof(float)) {
+        return;
+    }
+    append_record(xxh64(text, len, fingerprint),
+                  xxh64(text, len, fingerprint ^ CHECK_SEED), fingerprint, vec,
+                  static_cast<uint32_t>(dim));
+}
+
+void disk_cache_size_changed() {
+    wake_compactor();
+}
@@ -0,0 +1,68 @@
+/* Copyright (c) 2025, Joel Díaz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+#ifndef GEMBED_DISK_CACHE_H
+#define GEMBED_DISK_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/*
+ * Persistent embedding cache in gembed.persistent_cache_dir, consulted
+ * after the in-memory cache.
+ *
+ * Vectors are appended to memory-mapped segment files. An in-memory index
+ * is rebuilt from the segments at startup, so a restarted server serves
+ * repeated texts without inference. Records are addressed by a 128-bit
+ * hash of the text seeded with the model fingerprint; the text itself is
+ * not stored, and vectors of a changed model are simply never found again.
+ *
+ * Once the segments outgrow gembed.persistent_cache_size_mb, a background
+ * thread compacts the oldest one: records read since the previous pass are
+ * appended again, the rest are dropped with the file.
+ */
+
+struct Disk_segment;
+
+/* A vector inside a mapped segment, valid while the hit is held */
+struct Disk_cache_hit {
+    std::shared_ptr<const Disk_segment> segment;
+    const float *vec = nullptr;
+    size_t dim = 0;
+};
+
+/*
+ * Opens the cache if gembed.persistent_cache_dir is set. Problems are
+ * logged and leave the cache off; the component works without it.
+ */
+void disk_cache_open();
+
+/* Stops compaction and unmaps every segment */
+void disk_cache_close();
+
+bool disk_cache_enabled();
+
+/* Finds the vector of text under the model fingerprint. Returns false on a miss */
+bool disk_cache_get(uint64_t fingerprint, const char *text, size_t len,
+                    Disk_cache_hit *hit);
+
+/* Appends a freshly generated vector */
+void disk_cache_put(uint64_t fingerprint, const char *text, size_t len,
+                    const float *vec, size_t dim);
+
+/* Wakes the compactor after gembed.persistent_cache_size_mb changed */
+void disk_cache_size_changed();
+
+#endif /* GEMBED_DISK_CACHE_H */
@@ -0,0 +1,1361 @@
+/* Copyright (c) 2025, Joel Díaz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+
+#include "gembed_distance.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+#include "gembed_cpu.h"
+#include "gembed_half.h"
+#include "gembed_options.h"
+#include "gembed_quantize.h"
+#include "gembed_services.h"
+#include "gembed_vars.h"
+
+#if defined(__x86_64__)
+// GCC 12's AVX-512 intrinsics start from _mm512_undefined_ps() and warn once inlined
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#include <immintrin.h>
+#pragma GCC diagnostic pop
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#define MYSQL_ERRMSG_SIZE 512
+
+namespace {
+
+enum Metric { METRIC_DOT, METRIC_COSINE, METRIC_L2, N_METRICS };
+
+/* Element types of the stored vectors, indexing the kernel table */
+enum Element { ELEMENT_F32, ELEMENT_F16, ELEMENT_BF16, N_ELEMENTS };
+
+/* Sums taken over the two vectors: dot or squared L2 in s0, norms in s1 and s2 */
+struct Sums {
+    float s0 = 0;
+    float s1 = 0;
+    float s2 = 0;
+};
+
+/*
+ * Loaders of each element type, widening to float: one value, and a
+ * register of 4, 8 or 16 for the SIMD kernels. Pointers are to the first
+ * element, which need not be aligned.
+ */
+struct F32 {
+    static float load(const char *p, size_t i) {
+        float value;
+        memcpy(&value, p + i * sizeof(float), sizeof(value));
+        return value;
+    }
+#if defined(__x86_64__)
+    __attribute__((target("avx2,fma,f16c")))
+    static __m256 load8(const char *p, size_t i) {
+        return _mm256_loadu_ps(reinterpret_cast<const float *>(p) + i);
+    }
+    __attribute__((target("avx512f")))
+    static __m512 load16(const char *p, size_t i) {
+        return _mm512_loadu_ps(reinterpret_cast<const float *>(p) + i);
+    }
+#elif defined(__aarch64__)
+    static float32x4_t load4(const char *p, size_t i) {
+        return vld1q_f32(reinterpret_cast<const float *>(p) + i);
+    }
+#endif
+};
+
+struct F16 {
+    static float load(const char *p, size_t i) {
+        uint16_t half;
+        memcpy(&half, p + i * sizeof(half), sizeof(half));
+        return fp16_to_float(half);
+    }
+#if defined(__x86_64__)
+    __attribute__((target("avx2,fma,f16c")))
+    static __m256 load8(const char *p, size_t i) {
+        return _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i * 2)));
+    }
+    __attribute__((target("avx512f")))
+    static __m512 load16(const char *p, size_t i) {
+        return _mm512_cvtph_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i * 2)));
+    }
+#elif defined(__aarch64__)
+    static float32x4_t load4(const char *p, size_t i) {
+        return vcvt_f32_f16(vreinterpret_f16_u16(
+            vld1_u16(reinterpret_cast<const uint16_t *>(p) + i)));
+    }
+#endif
+};
+
+struct BF16 {
+    static float load(const char *p, size_t i) {
+        uint16_t half;
+        memcpy(&half, p + i * sizeof(half), sizeof(half));
+        return bf16_to_float(half);
+    }
+#if defined(__x86_64__)
+    __attribute__((target("avx2,fma,f16c")))
+    static __m256 load8(const char *p, size_t i) {
+        __m256i words = _mm256_cvtepu16_epi32(
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i * 2)));
+        return _mm256_castsi256_ps(_mm256_slli_epi32(words, 16));
+    }
+    __attribute__((target("avx512f")))
+    static __m512 load16(const char *p, size_t i) {
+        __m512i words = _mm512_cvtepu16_epi32(
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i * 2)));
+        return _mm512_castsi512_ps(_mm512_slli_epi32(words, 16));
+    }
+#elif defined(__aarch64__)
+    static float32x4_t load4(const char *p, size_t i) {
+        return vreinterpretq_f32_u32(
+            vshll_n_u16(vld1_u16(reinterpret_cast<const uint16_t *>(p) + i), 16));
+    }
+#endif
+};
+
+}  // namespace
+
+typedef Sums (*Distance_kernel)(const char *a, const char *b, size_t dim);
+
+/*
+ * Common model sizes get kernels of their own: with the trip count known
+ * the compiler unrolls the loop and drops the tail.
+ */
+enum Size { SIZE_ANY, SIZE_384, SIZE_768, SIZE_1024, N_SIZES };
+
+static Size size_of(size_t dim) {
+    switch (dim) {
+        case 384: return SIZE_384;
+        case 768: return SIZE_768;
+        case 1024: return SIZE_1024;
+        default: return SIZE_ANY;
+    }
+}
+
+template <class T, Metric M>
+static void accumulate_scalar(const char *a, const char *b, size_t from, size_t dim,
+                              Sums *sums) {
+    for (size_t i = from; i < dim; i++) {
+        float x = T::load(a, i);
+        float y = T::load(b, i);
+        if (M == METRIC_L2) {
+            sums->s0 += (x - y) * (x - y);
+        } else {
+            sums->s0 += x * y;
+        }
+        if (M == METRIC_COSINE) {
+            sums->s1 += x * x;
+            sums->s2 += y * y;
+        }
+    }
+}
+
+/*
+ * One struct per instruction set, each with run<T, M, D>(): metric M over
+ * vectors of element type T, D dimensions, or dim ones when D is 0.
+ */
+struct Scalar_isa {
+    static constexpr const char *name = "scalar";
+    static const size_t tile_rows = 2;
+    static const size_t tile_queries = 2;
+
+    template <class T, Metric M, size_t D>
+    static Sums run(const char *a, const char *b, size_t dim) {
+        Sums sums;
+        accumulate_scalar<T, M>(a, b, 0, D ? D : dim, &sums);
+        return sums;
+    }
+
+    template <size_t R, size_t Q>
+    static void tile(const float *rows, const float *queries, size_t dim, float *dots,
+                     size_t stride) {
+        float acc[R][Q] = {};
+        for (size_t i = 0; i < dim; i++) {
+            for (size_t r = 0; r < R; r++) {
+                for (size_t q = 0; q < Q; q++) {
+                    acc[r][q] += rows[r * dim + i] * queries[q * dim + i];
+                }
+            }
+        }
+        for (size_t r = 0; r < R; r++) {
+            for (size_t q = 0; q < Q; q++) {
+                dots[r * stride + q] = acc[r][q];
+            }
+        }
+    }
+};
+
+/* row . query over dimensions from..dim, the tail a SIMD tile leaves */
+static float dot_tail(const float *row, const float *query, size_t from, size_t dim) {
+    float sum = 0;
+    for (size_t i = from; i < dim; i++) {
+        sum += row[i] * query[i];
+    }
+    return sum;
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("avx2,fma,f16c")))
+static float reduce_avx2(__m256 v) {
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+    return _mm_cvtss_f32(sum);
+}
+
+struct Avx2_isa {
+    static constexpr const char *name = "avx2";
+    // 12 accumulators and 3 queries of the 16 registers
+    static const size_t tile_rows = 4;
+    static const size_t tile_queries = 3;
+
+    template <class T, Metric M, size_t D>
+    __attribute__((target("avx2,fma,f16c")))
+    static Sums run(const char *a, const char *b, size_t dim) {
+        const size_t n = D ? D : dim;
+        // Two accumulators for s0 hide the FMA latency
+        __m256 s0 = _mm256_setzero_ps(), s0b = _mm256_setzero_ps();
+        __m256 s1 = _mm256_setzero_ps(), s2 = _mm256_setzero_ps();
+        size_t i = 0;
+
+        for (; i + 16 <= n; i += 16) {
+            __m256 x = T::load8(a, i), y = T::load8(b, i);
+            __m256 xb = T::load8(a, i + 8), yb = T::load8(b, i + 8);
+            if (M == METRIC_L2) {
+                __m256 d = _mm256_sub_ps(x, y), db = _mm256_sub_ps(xb, yb);
+                s0 = _mm256_fmadd_ps(d, d, s0);
+                s0b = _mm256_fmadd_ps(db, db, s0b);
+            } else {
+                s0 = _mm256_fmadd_ps(x, y, s0);
+                s0b = _mm256_fmadd_ps(xb, yb, s0b);
+            }
+            if (M == METRIC_COSINE) {
+                s1 = _mm256_fmadd_ps(xb, xb, _mm256_fmadd_ps(x, x, s1));
+                s2 = _mm256_fmadd_ps(yb, yb, _mm256_fmadd_ps(y, y, s2));
+            }
+        }
+
+        Sums sums;
+        sums.s0 = reduce_avx2(_mm256_add_ps(s0, s0b));
+        sums.s1 = reduce_avx2(s1);
+        sums.s2 = reduce_avx2(s2);
+        // Fixed sizes are whole steps, an empty tail loop only draws warnings
+        if (D == 0 || D % 16 != 0) {
+            accumulate_scalar<T, M>(a, b, i, n, &sums);
+        }
+        return sums;
+    }
+
+    /*
+     * dots[r * stride + q] = rows[r] . queries[q] for an R x Q tile. Every
+     * register of a row is used against all Q queries before moving on.
+     * The loops over R and Q are unrolled so the tile stays in registers.
+     */
+    template <size_t R, size_t Q>
+    __attribute__((target("avx2,fma,f16c")))
+    static void tile(const float *rows, const float *queries, size_t dim, float *dots,
+                     size_t stride) {
+        __m256 acc[R][Q];
+        #pragma GCC unroll 4
+        for (size_t r = 0; r < R; r++) {
+            #pragma GCC unroll 4
+            for (size_t q = 0; q < Q; q++) {
+                acc[r][q] = _mm256_setzero_ps();
+            }
+        }
+
+        size_t i = 0;
+        for (; i + 8 <= dim; i += 8) {
+            __m256 y[Q];
+            #pragma GCC unroll 4
+            for (size_t q = 0; q < Q; q++) {
+                y[q] = _mm256_loadu_ps(queries + q * dim + i);
+            }
+            #pragma GCC unroll 4
+            for (size_t r = 0; r < R; r++) {
+                __m256 x = _mm256_loadu_ps(rows + r * dim + i);
+                #pragma GCC unroll 4
+                for (size_t q = 0; q < Q; q++) {
+                    acc[r][q] = _mm256_fmadd_ps(x, y[q], acc[r][q]);
+                }
+            }
+        }
+
+        #pragma GCC unroll 4
+        for (size_t r = 0; r < R; r++) {
+            #pragma GCC unroll 4
+            for (size_t q = 0; q < Q; q++) {
+                dots[r * stride + q] = reduce_avx2(acc[r][q]) +
+                                       dot_tail(rows + r * dim, queries + q * dim, i, dim);
+            }
+        }
+    }
+};
+
+struct Avx512_isa {
+    static constexpr const char *name = "avx512";
+    // 16 accumulators and 4 queries of the 32 registers
+    static const size_t tile_rows = 4;
+    static const size_t tile_queries = 4;
+
+    template <class T, Metric M, size_t D>
+    __attribute__((target("avx512f")))
+    static Sums run(const char *a, const char *b, size_t dim) {
+        const size_t n = D ? D : dim;
+        __m512 s0 = _mm512_setzero_ps(), s0b = _mm512_setzero_ps();
+        __m512 s1 = _mm512_setzero_ps(), s2 = _mm512_setzero_ps();
+        size_t i = 0;
+
+        for (; i + 32 <= n; i += 32) {
+            __m512 x = T::load16(a, i), y = T::load16(b, i);
+            __m512 xb = T::load16(a, i + 16), yb = T::load16(b, i + 16);
+            if (M == METRIC_L2) {
+                __m512 d = _mm512_sub_ps(x, y), db = _mm512_sub_ps(xb, yb);
+                s0 = _mm512_fmadd_ps(d, d, s0);
+                s0b = _mm512_fmadd_ps(db, db, s0b);
+            } else {
+                s0 = _mm512_fmadd_ps(x, y, s0);
+                s0b = _mm512_fmadd_ps(xb, yb, s0b);
+            }
+            if (M == METRIC_COSINE) {
+                s1 = _mm512_fmadd_ps(xb, xb, _mm512_fmadd_ps(x, x, s1));
+                s2 = _mm512_fmadd_ps(yb, yb, _mm512_fmadd_ps(y, y, s2));
+            }
+        }
+
+        for (; i + 16 <= n; i += 16) {
+            __m512 x = T::load16(a, i), y = T::load16(b, i);
+            if (M == METRIC_L2) {
+                __m512 d = _mm512_sub_ps(x, y);
+                s0 = _mm512_fmadd_ps(d, d, s0);
+            } else {
+                s0 = _mm512_fmadd_ps(x, y, s0);
+            }
+            if (M == METRIC_COSINE) {
+                s1 = _mm512_fmadd_ps(x, x, s1);
+                s2 = _mm512_fmadd_ps(y, y, s2);
+            }
+        }
+
+        Sums sums;
+        sums.s0 = _mm512_reduce_add_ps(_mm512_add_ps(s0, s0b));
+        sums.s1 = _mm512_reduce_add_ps(s1);
+        sums.s2 = _mm512_reduce_add_ps(s2);
+        // Fixed sizes are whole steps, an empty tail loop only draws warnings
+        if (D == 0 || D % 16 != 0) {
+            accumulate_scalar<T, M>(a, b, i, n, &sums);
+        }
+        return sums;
+    }
+
+    template <size_t R, size_t Q>
+    __attribute__((target("avx512f")))
+    static void tile(const float *rows, const float *queries, size_t dim, float *dots,
+                     size_t stride) {
+        __m512 acc[R][Q];
+        #pragma GCC unroll 4
+        for (size_t r = 0; r < R; r++) {
+            #pragma GCC unroll 4
+            for (size_t q = 0; q < Q; q++) {
+                acc[r][q] = _mm512_setzero_ps();
+            }
+        }
+
+        size_t i = 0;
+        for (; i + 16 <= dim; i += 16) {
+            __m512 y[Q];
+            #pragma GCC unroll 4
+            for (size_t q = 0; q < Q; q++) {
+                y[q] = _mm512_loadu_ps(queries + q * dim + i);
+            }
+            #pragma GCC unroll 4
+            for (size_t r = 0; r < R; r++) {
+                __m512 x = _mm512_loadu_ps(rows + r * dim + i);
+                #pragma GCC unroll 4
+                for (size_t q = 0; q < Q; q++) {
+                    acc[r][q] = _mm512_fmadd_ps(x, y[q], acc[r][q]);
+                }
+            }
+        }
+
+        #pragma GCC unroll 4
+        for (size_t r = 0; r < R; r++) {
+            #pragma GCC unroll 4
+            for (size_t q = 0; q < Q; q++) {
+                dots[r * stride + q] = _mm512_reduce_add_ps(acc[r][q]) +
+                                       dot_tail(rows + r * dim, queries + q * dim, i, dim);
+            }
+        }
+    }
+};
+
+#elif defined(__aarch64__)
+
+struct Neon_isa {
+    static constexpr const char *name = "neon";
+    static const size_t tile_rows = 4;
+    static const size_t tile_queries = 4;
+
+    template <class T, Metric M, size_t D>
+    static Sums run(const char *a, const char *b, size_t dim) {
+        const size_t n = D ? D : dim;
+        float32x4_t s0 = vdupq_n_f32(0), s0b = vdupq_n_f32(0);
+        float32x4_t s1 = vdupq_n_f32(0), s2 = vdupq_n_f32(0);
+        size_t i = 0;
+
+        for (; i + 8 <= n; i += 8) {
+            float32x4_t x = T::load4(a, i), y = T::load4(b, i);
+            float32x4_t xb = T::load4(a, i + 4), yb = T::load4(b, i + 4);
+            if (M == METRIC_L2) {
+                float32x4_t d = vsubq_f32(x, y), db = vsubq_f32(xb, yb);
+                s0 = vfmaq_f32(s0, d, d);
+                s0b = vfmaq_f32(s0b, db, db);
+            } else {
+                s0 = vfmaq_f32(s0, x, y);
+                s0b = vfmaq_f32(s0b, xb, yb);
+            }
+            if (M == METRIC_COSINE) {
+                s1 = vfmaq_f32(vfmaq_f32(s1, x, x), xb, xb);
+                s2 = vfmaq_f32(vfmaq_f32(s2, y, y), yb, yb);
+            }
+        }
+
+        Sums sums;
+        sums.s0 = vaddvq_f32(vaddq_f32(s0, s0b));
+        sums.s1 = vaddvq_f32(s1);
+        sums.s2 = vaddvq_f32(s2);
+        // Fixed sizes are whole steps, an empty tail loop only draws warnings
+        if (D == 0 || D % 8 != 0) {
+            accumulate_scalar<T, M>(a, b, i, n, &sums);
+        }
+        return sums;
+    }
+
+    template <size_t R, size_t Q>
+    static void tile(const float *rows, const float *queries, size_t dim, float *dots,
+                     size_t stride) {
+        float32x4_t acc[R][Q];
+        #pragma GCC unroll 4
+        for (size_t r = 0; r < R; r++) {
+            #pragma GCC unroll 4
+            for (size_t q = 0; q < Q; q++) {
+                acc[r][q] = vdupq_n_f32(0);
+            }
+        }
+
+        size_t i = 0;
+        for (; i + 4 <= dim; i += 4) {
+            float32x4_t y[Q];
+            #pragma GCC unroll 4
+            for (size_t q = 0; q < Q; q++) {
+                y[q] = vld1q_f32(queries + q * dim + i);
+            }
+            #pragma GCC unroll 4
+            for (size_t r = 0; r < R; r++) {
+                float32x4_t x = vld1q_f32(rows + r * dim + i);
+                #pragma GCC unroll 4
+                for (size_t q = 0; q < Q; q++) {
+                    acc[r][q] = vfmaq_f32(acc[r][q], x, y[q]);
+                }
+            }
+        }
+
+        #pragma GCC unroll 4
+        for (size_t r = 0; r < R; r++) {
+            #pragma GCC unroll 4
+            for (size_t q = 0; q < Q; q++) {
+                dots[r * stride + q] = vaddvq_f32(acc[r][q]) +
+                                       dot_tail(rows + r * dim, queries + q * dim, i, dim);
+            }
+        }
+    }
+};
+
+#endif
+
+/*
+ * dots[r * n_queries + q] = rows[r] . queries[q], for n_rows rows and
+ * n_queries queries of dim floats each.
+ */
+typedef void (*Block_kernel)(const float *rows, size_t n_rows, const float *queries,
+                             size_t n_queries, size_t dim, float *dots);
+
+/*
+ * Covers the block with the ISA's register tiles, and narrower tiles at
+ * the edges, so each row is read from cache once per tile of queries
+ * rather than once per query.
+ */
+template <class Isa>
+static void block_dots(const float *rows, size_t n_rows, const float *queries,
+                       size_t n_queries, size_t dim, float *dots) {
+    const size_t R = Isa::tile_rows, Q = Isa::tile_queries;
+    size_t r = 0;
+
+    for (; r + R <= n_rows; r += R) {
+        size_t q = 0;
+        for (; q + Q <= n_queries; q += Q) {
+            Isa::template tile<R, Q>(rows + r * dim, queries + q * dim, dim,
+                                     dots + r * n_queries + q, n_queries);
+        }
+        for (; q < n_queries; q++) {
+            Isa::template tile<R, 1>(rows + r * dim, queries + q * dim, dim,
+                                     dots + r * n_queries + q, n_queries);
+        }
+    }
+
+    for (; r < n_rows; r++) {
+        size_t q = 0;
+        for (; q + Q <= n_queries; q += Q) {
+            Isa::template tile<1, Q>(rows + r * dim, queries + q * dim, dim,
+                                     dots + r * n_queries + q, n_queries);
+        }
+        for (; q < n_queries; q++) {
+            Isa::template tile<1, 1>(rows + r * dim, queries + q * dim, dim,
+                                     dots + r * n_queries + q, n_queries);
+        }
+    }
+}
+
+/* Kernels for every element type, metric and size, picked once for the CPU */
+struct Distance_kernels {
+    const char *isa = Scalar_isa::name;
+    Distance_kernel kernel[N_ELEMENTS][N_METRICS][N_SIZES] = {};
+    Block_kernel block = nullptr;
+};
+
+template <class Isa, class T, Metric M>
+static void fill_sizes(Distance_kernel *sizes) {
+    sizes[SIZE_ANY] = Isa::template run<T, M, 0>;
+    sizes[SIZE_384] = Isa::template run<T, M, 384>;
+    sizes[SIZE_768] = Isa::template run<T, M, 768>;
+    sizes[SIZE_1024] = Isa::template run<T, M, 1024>;
+}
+
+template <class Isa, class T>
+static void fill_metrics(Distance_kernel (*metrics)[N_SIZES]) {
+    fill_sizes<Isa, T, METRIC_DOT>(metrics[METRIC_DOT]);
+    fill_sizes<Isa, T, METRIC_COSINE>(metrics[METRIC_COSINE]);
+    fill_sizes<Isa, T, METRIC_L2>(metrics[METRIC_L2]);
+}
+
+template <class Isa>
+static void fill_kernels(Distance_kernels *kernels) {
+    kernels->isa = Isa::name;
+    kernels->block = block_dots<Isa>;
+    fill_metrics<Isa, F32>(kernels->kernel[ELEMENT_F32]);
+    fill_metrics<Isa, F16>(kernels->kernel[ELEMENT_F16]);
+    fill_metrics<Isa, BF16>(kernels->kernel[ELEMENT_BF16]);
+}
+
+static const Distance_kernels &distance_kernels() {
+    static const Distance_kernels kernels = [] {
+        Distance_kernels k;
+        fill_kernels<Scalar_isa>(&k);
+#if defined(__x86_64__)
+        const Cpu_features &cpu = cpu_features();
+        if (cpu.avx512f) {
+            fill_kernels<Avx512_isa>(&k);
+        } else if (cpu.avx2 && cpu.fma && cpu.f16c) {
+            fill_kernels<Avx2_isa>(&k);
+        }
+#elif defined(__aarch64__)
+        fill_kernels<Neon_isa>(&k);
+#endif
+        return k;
+    }();
+    return kernels;
+}
+
+void distance_kernels_init() {
+    distance_kernels();
+}
+
+int distance_isa_show(MYSQL_THD, SHOW_VAR *var, char *buf) {
+    snprintf(buf, SHOW_VAR_FUNC_BUFF_SIZE, "%s", distance_kernels().isa);
+    var->type = SHOW_CHAR;
+    var->value = buf;
+    return 0;
+}
+
+/* Reads the format argument at index. Returns true if it is not a distance format */
+static bool read_format(UDF_ARGS *args, unsigned int index, Output_format *format,
+                        Element *element) {
+    static const struct {
+        const char *name;
+        Output_format format;
+        Element element;
+    } formats[] = {
+        {"float32", OUTPUT_FLOAT32, ELEMENT_F32},
+        {"fp16", OUTPUT_FP16, ELEMENT_F16},
+        {"bf16", OUTPUT_BF16, ELEMENT_BF16},
+    };
+
+    *format = OUTPUT_FLOAT32;
+    *element = ELEMENT_F32;
+    if (args->arg_count <= index || !args->args[index]) {
+        return false;
+    }
+
+    // Runs for every row, so no std::string
+    for (const auto &f : formats) {
+        if (args->lengths[index] == strlen(f.name) &&
+            memcmp(args->args[index], f.name, args->lengths[index]) == 0) {
+            *format = f.format;
+            *element = f.element;
+            return false;
+        }
+    }
+    return true;
+}
+
+/* The dimension count of a stored vector, 0 if its size does not fit format */
+static size_t vector_dim(const char *data, unsigned long length, Output_format format) {
+    uint32_t dim;
+    if (length < sizeof(dim)) {
+        return 0;
+    }
+    memcpy(&dim, data, sizeof(dim));
+    return dim > 0 && quantized_size(format, dim) == length ? dim : 0;
+}
+
+bool gembed_distance_init(UDF_INIT *initid, UDF_ARGS *args, char *message) {
+    if (args->arg_count != 2 && args->arg_count != 3) {
+        snprintf(message, MYSQL_ERRMSG_SIZE,
+                 "Distance functions take 2 or 3 arguments: a, b [, format]");
+        return true;
+    }
+
+    for (unsigned int i = 0; i < args->arg_count; i++) {
+        args->arg_type[i] = STRING_RESULT;
+    }
+
+    // A constant format is checked up front
+    Output_format format;
+    Element element;
+    if (read_format(args, 2, &format, &element)) {
+        snprintf(message, MYSQL_ERRMSG_SIZE,
+                 "format must be \"float32\", \"fp16\" or \"bf16\"");
+        return true;
+    }
+
+    initid->maybe_null = true;
+    return false;
+}
+
+static double distance(UDF_ARGS *args, Metric metric, unsigned char *is_null,
+                       unsigned char *error) {
+    if (!args->args[0] || !args->args[1]) {
+        *is_null = 1;
+        return 0;
+    }
+
+    Output_format format;
+    Element element;
+    if (read_format(args, 2, &format, &element)) {
+        *error = 1;
+        log_message(ERROR_LEVEL, "format must be \"float32\", \"fp16\" or \"bf16\"");
+        return 0;
+    }
+
+    size_t dim = vector_dim(args->args[0], args->lengths[0], format);
+    if (dim == 0 || dim != vector_dim(args->args[1], args->lengths[1], format)) {
+        *error = 1;
+        log_message(ERROR_LEVEL, "Vectors are not of the given format and one dimension");
+        return 0;
+    }
+
+    const char *a = args->args[0] + sizeof(uint32_t);
+    const char *b = args->args[1] + sizeof(uint32_t);
+    Sums sums = distance_kernels().kernel[element][metric][size_of(dim)](a, b, dim);
+
+    switch (metric) {
+        case METRIC_DOT:
+            return sums.s0;
+        case METRIC_L2:
+            return std::sqrt(static_cast<double>(sums.s0));
+        default:
+            if (sums.s1 == 0 || sums.s2 == 0) {
+                *is_null = 1;
+                return 0;
+            }
+            return 1 - sums.s0 / std::sqrt(static_cast<double>(sums.s1) * sums.s2);
+    }
+}
+
+double gembed_dot(UDF_INIT *, UDF_ARGS *args, unsigned char *is_null,
+                  unsigned char *error) {
+    return distance(args, METRIC_DOT, is_null, error);
+}
+
+double gembed_cosine(UDF_INIT *, UDF_ARGS *args, unsigned char *is_null,
+                     unsigned char *error) {
+    return distance(args, METRIC_COSINE, is_null, error);
+}
+
+double gembed_l2(UDF_INIT *, UDF_ARGS *args, unsigned char *is_null,
+                 unsigned char *error) {
+    return distance(args, METRIC_L2, is_null, error);
+}
+
+/* Bytes per element, to address a block of dimensions */
+static const size_t element_size[N_ELEMENTS] = {sizeof(float), sizeof(uint16_t),
+                                                sizeof(uint16_t)};
+
+/* Dimensions scored between two early-abandoning checks */
+static const size_t TOPK_BLOCK = 64;
+
+static const long long TOPK_MAX_K = 10000;
+
+/* Rows GEMBED_TOPK_MULTI scores against its queries at once */
+static const size_t TOPK_ROW_BLOCK = 32;
+
+/* Bound on k times the number of queries of GEMBED_TOPK_MULTI */
+static const size_t TOPK_MAX_HELD = 1000000;
+
+namespace {
+
+/* A row kept by GEMBED_TOPK; lower keys are closer */
+struct Topk_entry {
+    float key;
+    std::string id;
+
+    bool operator<(const Topk_entry &other) const { return key < other.key; }
+};
+
+/* Aggregate state of a GEMBED_TOPK call site, kept in initid->ptr */
+struct Topk_state {
+    /* Taken from the first row of each group */
+    bool ready = false;
+    bool failed = false;
+    size_t k = 0;
+    Metric metric = METRIC_DOT;
+    Output_format format = OUTPUT_FLOAT32;
+    Element element = ELEMENT_F32;
+    size_t dim = 0;
+    std::string query;               /* elements of the query vector */
+    float query_norm = 0;
+    std::vector<float> query_tail;   /* query_tail[i]: sum of q[j]^2 for j >= i */
+
+    /* Max-heap on key: the front is the k-th best so far */
+    std::vector<Topk_entry> heap;
+    long long rows = 0;
+    long long abandoned = 0;
+
+    std::string result;
+};
+
+/*
+ * Aggregate state of a GEMBED_TOPK_MULTI call site. Rows are widened to
+ * float and buffered, then scored against all queries a block at a time.
+ */
+struct Topk_multi_state {
+    /* Taken from the first row of each group */
+    bool ready = false;
+    bool failed = false;
+    size_t k = 0;
+    Metric metric = METRIC_DOT;
+    Output_format format = OUTPUT_FLOAT32;
+    Element element = ELEMENT_F32;
+    size_t dim = 0;
+    size_t n_queries = 0;
+    std::vector<float> queries;       /* n_queries x dim */
+    std::vector<float> query_norms2;  /* squared norm of each query */
+
+    /* Rows waiting to be scored */
+    size_t n_rows = 0;
+    std::vector<float> rows;          /* TOPK_ROW_BLOCK x dim */
+    std::vector<float> row_norms2;
+    std::vector<std::string> ids;
+    std::vector<float> dots;          /* TOPK_ROW_BLOCK x n_queries */
+
+    /* One max-heap per query, as in Topk_state */
+    std::vector<std::vector<Topk_entry>> heaps;
+
+    std::string result;
+};
+
+}  // namespace
+
+/* Reads the metric argument at index. Returns true if it is not a metric */
+static bool read_metric(UDF_ARGS *args, unsigned int index, Metric *metric) {
+    static const struct {
+        const char *name;
+        Metric metric;
+    } metrics[] = {
+        {"dot", METRIC_DOT},
+        {"cosine", METRIC_COSINE},
+        {"l2", METRIC_L2},
+    };
+
+    if (!args->args[index]) {
+        return true;
+    }
+    for (const auto &m : metrics) {
+        if (args->lengths[index] == strlen(m.name) &&
+            memcmp(args->args[index], m.name, args->lengths[index]) == 0) {
+            *metric = m.metric;
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool read_k(UDF_ARGS *args, size_t *k) {
+    if (!args->args[3]) {
+        return true;
+    }
+    long long value = *reinterpret_cast<long long *>(args->args[3]);
+    if (value < 1 || value > TOPK_MAX_K) {
+        return true;
+    }
+    *k = static_cast<size_t>(value);
+    return false;
+}
+
+/* Reads k, metric, format and query from the first row of a group */
+static bool topk_prepare(Topk_state *state, UDF_ARGS *args) {
+    if (read_k(args, &state->k) || read_metric(args, 4, &state->metric) ||
+        read_format(args, 5, &state->format, &state->element)) {
+        log_message(ERROR_LEVEL, "GEMBED_TOPK: invalid k, metric or format");
+        return true;
+    }
+
+    state->dim = vector_dim(args->args[2], args->lengths[2], state->format);
+    if (state->dim == 0) {
+        log_message(ERROR_LEVEL, "GEMBED_TOPK: the query is not a vector of the given format");
+        return true;
+    }
+    state->query.assign(args->args[2] + sizeof(uint32_t),
+                        args->lengths[2] - sizeof(uint32_t));
+
+    // Suffix sums of the query bound what the unscored dimensions can add
+    const Distance_kernel sum_squares =
+        distance_kernels().kernel[state->element][METRIC_COSINE][SIZE_ANY];
+    size_t esize = element_size[state->element];
+    double tail = 0;
+    state->query_tail.assign(state->dim + 1, 0);
+    for (size_t i = state->dim; i > 0; i--) {
+        const char *q = state->query.data() + (i - 1) * esize;
+        tail += sum_squares(q, q, 1).s1;
+        state->query_tail[i - 1] = static_cast<float>(tail);
+    }
+    state->query_norm = std::sqrt(state->query_tail[0]);
+
+    if (state->metric == METRIC_COSINE && state->query_norm == 0) {
+        log_message(ERROR_LEVEL, "GEMBED_TOPK: cosine distance to a zero vector");
+        return true;
+    }
+
+    state->heap.reserve(state->k);
+    state->ready = true;
+    return false;
+}
+
+/* The heap key of a fully scored row; NaN for a zero vector under cosine */
+static float topk_key(const Topk_state &state, const Sums &sums) {
+    switch (state.metric) {
+        case METRIC_DOT:
+            return -sums.s0;
+        case METRIC_L2:
+            return sums.s0;  // squared, the root is taken for the result
+        default:
+            if (sums.s1 == 0) {
+                return std::numeric_limits<float>::quiet_NaN();
+            }
+            return 1 - sums.s0 / (std::sqrt(sums.s1) * state.query_norm);
+    }
+}
+
+/*
+ * A lower bound on the cosine distance of a row from the sums over its
+ * first `to` dimensions: by Cauchy-Schwarz over the scored prefix and the
+ * unscored rest, the rest of the row at best lines up with the rest of
+ * the query.
+ */
+static float cosine_lower_bound(const Topk_state &state, const Sums &prefix, size_t to) {
+    float dot = std::max(prefix.s0, 0.0f);
+    float reach = prefix.s1 > 0 ? dot * dot / prefix.s1 : 0;
+    float best = std::sqrt(reach + state.query_tail[to]) / state.query_norm;
+    return 1 - best - 1e-5f;  // rounding must not drop a tie
+}
+
+/*
+ * Scores row against the query into *key. Once the heap is full, L2 and
+ * cosine rows are scored a block at a time and given up as soon as a
+ * bound on their distance is past the k-th best: the partial sum for L2,
+ * and for cosine the best the rest of the row could do given the norm
+ * of the query's remaining dimensions. Returns false for a row given up.
+ */
+static bool topk_score(Topk_state *state, const char *row, float *key) {
+    const Distance_kernels &kernels = distance_kernels();
+
+    if (state->heap.size() < state->k || state->metric == METRIC_DOT) {
+        Sums sums = kernels.kernel[state->element][state->metric][size_of(state->dim)](
+            row, state->query.data(), state->dim);
+        *key = topk_key(*state, sums);
+        return true;
+    }
+
+    const Distance_kernel block = kernels.kernel[state->element][state->metric][SIZE_ANY];
+    const float bound = state->heap.front().key;
+    const size_t esize = element_size[state->element];
+    Sums sums;
+
+    for (size_t from = 0; from < state->dim; from += TOPK_BLOCK) {
+        size_t n = std::min(TOPK_BLOCK, state->dim - from);
+        Sums part = block(row + from * esize, state->query.data() + from * esize, n);
+        sums.s0 += part.s0;
+        sums.s1 += part.s1;
+
+        size_t to = from + n;
+        if (to == state->dim) {
+            break;
+        }
+
+        float lower_bound = state->metric == METRIC_L2
+                                ? sums.s0
+                                : cosine_lower_bound(*state, sums, to);
+        if (lower_bound > bound) {
+            return false;
+        }
+    }
+
+    *key = topk_key(*state, sums);
+    return true;
+}
+
+/* Shared by GEMBED_TOPK and GEMBED_TOPK_MULTI, which differ in the queries */
+static bool check_topk_args(UDF_INIT *initid, UDF_ARGS *args, char *message,
+                            const char *usage) {
+    if (args->arg_count != 5 && args->arg_count != 6) {
+        snprintf(message, MYSQL_ERRMSG_SIZE, "%s", usage);
+        return true;
+    }
+
+    args->arg_type[0] = STRING_RESULT;
+    if (args->arg_type[1] != INT_RESULT) {
+        args->arg_type[1] = STRING_RESULT;
+    }
+    args->arg_type[2] = STRING_RESULT;
+    args->arg_type[3] = INT_RESULT;
+    args->arg_type[4] = STRING_RESULT;
+    if (args->arg_count == 6) {
+        args->arg_type[5] = STRING_RESULT;
+    }
+
+    // Constant arguments are checked up front
+    size_t k;
+    Metric metric;
+    Output_format format;
+    Element element;
+    if (args->args[3] && read_k(args, &k)) {
+        snprintf(message, MYSQL_ERRMSG_SIZE, "k must be between 1 and %lld", TOPK_MAX_K);
+        return true;
+    }
+    if (args->args[4] && read_metric(args, 4, &metric)) {
+        snprintf(message, MYSQL_ERRMSG_SIZE, "metric must be \"dot\", \"cosine\" or \"l2\"");
+        return true;
+    }
+    if (read_format(args, 5, &format, &element)) {
+        snprintf(message, MYSQL_ERRMSG_SIZE,
+                 "format must be \"float32\", \"fp16\" or \"bf16\"");
+        return true;
+    }
+
+    initid->maybe_null = true;
+    initid->max_length = gembed_max_output_size;
+    return false;
+}
+
+bool gembed_topk_init(UDF_INIT *initid, UDF_ARGS *args, char *message) {
+    if (check_topk_args(initid, args, message,
+                        "GEMBED_TOPK requires 5 or 6 arguments: vector, id, query, k, "
+                        "metric [, format]")) {
+        return true;
+    }
+
+    initid->ptr = reinterpret_cast<char *>(new Topk_state());
+    return false;
+}
+
+void gembed_topk_deinit(UDF_INIT *initid) {
+    delete reinterpret_cast<Topk_state *>(initid->ptr);
+    initid->ptr = nullptr;
+}
+
+void gembed_topk_clear(UDF_INIT *initid, unsigned char *, unsigned char *) {
+    Topk_state *state = reinterpret_cast<Topk_state *>(initid->ptr);
+    state->ready = false;
+    state->failed = false;
+    state->heap.clear();
+}
+
+/* Appends id as a JSON string */
+static void append_json_string(std::string *out, const std::string &id) {
+    out->push_back('"');
+    for (char c : id) {
+        if (c == '"' || c == '\\') {
+            out->push_back('\\');
+            out->push_back(c);
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out->append(escaped);
+        } else {
+            out->push_back(c);
+        }
+    }
+    out->push_back('"');
+}
+
+/* Whether a row with key gets into a heap of at most k, not NaN keys */
+static bool topk_wants(const std::vector<Topk_entry> &heap, size_t k, float key) {
+    return !std::isnan(key) && (heap.size() < k || key < heap.front().key);
+}
+
+/* Adds a row to a heap of at most k, dropping the farthest once full */
+static void topk_push(std::vector<Topk_entry> *heap, size_t k, float key, std::string id) {
+    if (heap->size() == k) {
+        std::pop_heap(heap->begin(), heap->end());
+        heap->pop_back();
+    }
+
+    Topk_entry entry;
+    entry.key = key;
+    entry.id = std::move(id);
+    heap->push_back(std::move(entry));
+    std::push_heap(heap->begin(), heap->end());
+}
+
+/* The id argument as text: digits for integers, the bytes otherwise */
+static void read_id(UDF_ARGS *args, std::string *id) {
+    if (args->arg_type[1] == INT_RESULT) {
+        *id = std::to_string(*reinterpret_cast<long long *>(args->args[1]));
+    } else {
+        id->assign(args->args[1], args->lengths[1]);
+    }
+}
+
+/*
+ * Appends the heap closest first as [[id, score], ...], scores in the
+ * units of GEMBED_DOT, GEMBED_COSINE and GEMBED_L2. Sorts the heap.
+ */
+static void append_topk_json(std::string *json, std::vector<Topk_entry> *heap, Metric metric,
+                             bool int_ids) {
+    std::sort_heap(heap->begin(), heap->end());
+    json->push_back('[');
+    for (size_t i = 0; i < heap->size(); i++) {
+        const Topk_entry &entry = (*heap)[i];
+        double score = metric == METRIC_DOT  ? -entry.key
+                       : metric == METRIC_L2 ? std::sqrt(entry.key)
+                                             : entry.key;
+        json->append(i ? ",[" : "[");
+        if (int_ids) {
+            json->append(entry.id);
+        } else {
+            append_json_string(json, entry.id);
+        }
+        char number[32];
+        snprintf(number, sizeof(number), ",%.7g]", score);
+        json->append(number);
+    }
+    json->push_back(']');
+}
+
+void gembed_topk_add(UDF_INIT *initid, UDF_ARGS *args, unsigned char *,
+                     unsigned char *error) {
+    Topk_state *state = reinterpret_cast<Topk_state *>(initid->ptr);
+
+    // Rows without a vector or an id cannot be ranked
+    if (state->failed || !args->args[0] || !args->args[1] || !args->args[2]) {
+        return;
+    }
+
+    if (!state->ready && topk_prepare(state, args)) {
+        state->failed = true;
+        *error = 1;
+        return;
+    }
+
+    if (vector_dim(args->args[0], args->lengths[0], state->format) != state->dim) {
+        state->failed = true;
+        *error = 1;
+        log_message(ERROR_LEVEL, "GEMBED_TOPK: vectors are not of the query's format and dimension");
+        return;
+    }
+
+    state->rows++;
+    float key;
+    if (!topk_score(state, args->args[0] + sizeof(uint32_t), &key)) {
+        state->abandoned++;
+        return;
+    }
+    if (topk_wants(state->heap, state->k, key)) {
+        std::string id;
+        read_id(args, &id);
+        topk_push(&state->heap, state->k, key, std::move(id));
+    }
+}
+
+char *gembed_topk(UDF_INIT *initid, UDF_ARGS *args, char *, unsigned long *length,
+                  unsigned char *is_null, unsigned char *error) {
+    Topk_state *state = reinterpret_cast<Topk_state *>(initid->ptr);
+
+    gembed_status.topk_rows.fetch_add(state->rows, std::memory_order_relaxed);
+    gembed_status.topk_rows_abandoned.fetch_add(state->abandoned, std::memory_order_relaxed);
+    state->rows = 0;
+    state->abandoned = 0;
+
+    if (state->failed) {
+        *error = 1;
+        return nullptr;
+    }
+    if (state->heap.empty()) {
+        *is_null = 1;
+        return nullptr;
+    }
+
+    std::string &json = state->result;
+    json.clear();
+    append_topk_json(&json, &state->heap, state->metric, args->arg_type[1] == INT_RESULT);
+
+    if (json.size() > initid->max_length) {
+        *error = 1;
+        log_message(ERROR_LEVEL, "Output exceeds gembed.max_output_size");
+        return nullptr;
+    }
+
+    *length = json.size();
+    return &json[0];
+}
+
+template <class T>
+static void widen(const char *p, size_t dim, float *out) {
+    for (size_t i = 0; i < dim; i++) {
+        out[i] = T::load(p, i);
+    }
+}
+
+/* Widens a vector of each element type to float */
+static void (*const widen_element[N_ELEMENTS])(const char *, size_t, float *) = {
+    widen<F32>, widen<F16>, widen<BF16>};
+
+/* The squared norm of a widened vector */
+static float norm2(const float *v, size_t dim) {
+    const char *p = reinterpret_cast<const char *>(v);
+    return distance_kernels().kernel[ELEMENT_F32][METRIC_COSINE][SIZE_ANY](p, p, dim).s1;
+}
+
+/*
+ * Reads k, metric, format and the queries from the first row of a group.
+ * The queries argument is vectors of the format and one dimension count
+ * laid end to end, as CONCAT() or GROUP_CONCAT(... SEPARATOR '') make.
+ */
+static bool topk_multi_prepare(Topk_multi_state *state, UDF_ARGS *args) {
+    if (read_k(args, &state->k) || read_metric(args, 4, &state->metric) ||
+        read_format(args, 5, &state->format, &state->element)) {
+        log_message(ERROR_LEVEL, "GEMBED_TOPK_MULTI: invalid k, metric or format");
+        return true;
+    }
+
+    const char *queries = args->args[2];
+    size_t length = args->lengths[2];
+    uint32_t header = 0;
+    if (length >= sizeof(header)) {
+        memcpy(&header, queries, sizeof(header));
+    }
+    size_t vector_size = quantized_size(state->format, header);
+    if (header == 0 || length % vector_size != 0) {
+        log_message(ERROR_LEVEL,
+                    "GEMBED_TOPK_MULTI: the queries are not vectors of the given format");
+        return true;
+    }
+
+    state->dim = header;
+    state->n_queries = length / vector_size;
+    if (state->n_queries * state->k > TOPK_MAX_HELD) {
+        log_message(ERROR_LEVEL, "GEMBED_TOPK_MULTI: k times the number of queries is too large");
+        return true;
+    }
+
+    state->queries.resize(state->n_queries * state->dim);
+    state->query_norms2.resize(state->n_queries);
+    for (size_t q = 0; q < state->n_queries; q++) {
+        const char *vector = queries + q * vector_size;
+        if (vector_dim(vector, vector_size, state->format) != state->dim) {
+            log_message(ERROR_LEVEL,
+                        "GEMBED_TOPK_MULTI: the queries differ in dimension count");
+            return true;
+        }
+
+        float *query = &state->queries[q * state->dim];
+        widen_element[state->element](vector + sizeof(uint32_t), state->dim, query);
+        state->query_norms2[q] = norm2(query, state->dim);
+        if (state->metric == METRIC_COSINE && state->query_norms2[q] == 0) {
+            log_message(ERROR_LEVEL, "GEMBED_TOPK_MULTI: cosine distance to a zero vector");
+            return true;
+        }
+    }
+
+    state->rows.resize(TOPK_ROW_BLOCK * state->dim);
+    state->row_norms2.resize(TOPK_ROW_BLOCK);
+    state->ids.resize(TOPK_ROW_BLOCK);
+    state->dots.resize(TOPK_ROW_BLOCK * state->n_queries);
+    state->heaps.assign(state->n_queries, std::vector<Topk_entry>());
+    state->ready = true;
+    return false;
+}
+
+/* Scores the buffered rows against every query and offers them to the heaps */
+static void topk_multi_flush(Topk_multi_state *state) {
+    if (state->n_rows == 0) {
+        return;
+    }
+
+    distance_kernels().block(state->rows.data(), state->n_rows, state->queries.data(),
+                             state->n_queries, state->dim, state->dots.data());
+
+    for (size_t r = 0; r < state->n_rows; r++) {
+        const float *dots = &state->dots[r * state->n_queries];
+        float row_norm2 = state->row_norms2[r];
+
+        for (size_t q = 0; q < state->n_queries; q++) {
+            float key;
+            switch (state->metric) {
+                case METRIC_DOT:
+                    key = -dots[q];
+                    break;
+                case METRIC_L2:
+                    // |a - b|^2 from the dot product; rounding can take it below 0
+                    key = std::max(row_norm2 + state->query_norms2[q] - 2 * dots[q], 0.0f);
+                    break;
+                default:
+                    key = row_norm2 == 0 ? std::numeric_limits<float>::quiet_NaN()
+                                         : 1 - dots[q] / std::sqrt(row_norm2 *
+                                                                   state->query_norms2[q]);
+                    break;
+            }
+            if (topk_wants(state->heaps[q], state->k, key)) {
+                topk_push(&state->heaps[q], state->k, key, state->ids[r]);
+            }
+        }
+    }
+
+    state->n_rows = 0;
+}
+
+bool gembed_topk_multi_init(UDF_INIT *initid, UDF_ARGS *args, char *message) {
+    if (check_topk_args(initid, args, message,
+                        "GEMBED_TOPK_MULTI requires 5 or 6 arguments: vector, id, queries, "
+                        "k, metric [, format]")) {
+        return true;
+    }
+
+    initid->ptr = reinterpret_cast<char *>(new Topk_multi_state());
+    return false;
+}
+
+void gembed_topk_multi_deinit(UDF_INIT *initid) {
+    delete reinterpret_cast<Topk_multi_state *>(initid->ptr);
+    initid->ptr = nullptr;
+}
+
+void gembed_topk_multi_clear(UDF_INIT *initid, unsigned char *, unsigned char *) {
+    Topk_multi_state *state = reinterpret_cast<Topk_multi_state *>(initid->ptr);
+    state->ready = false;
+    state->failed = false;
+    state->n_rows = 0;
+    state->heaps.clear();
+}
+
+void gembed_topk_multi_add(UDF_INIT *initid, UDF_ARGS *args, unsigned char *,
+                           unsigned char *error) {
+    Topk_multi_state *state = reinterpret_cast<Topk_multi_state *>(initid->ptr);
+
+    // Rows without a vector or an id cannot be ranked
+    if (state->failed || !args->args[0] || !args->args[1] || !args->args[2]) {
+        return;
+    }
+
+    if (!state->ready && topk_multi_prepare(state, args)) {
+        state->failed = true;
+        *error = 1;
+        return;
+    }
+
+    if (vector_dim(args->args[0], args->lengths[0], state->format) != state->dim) {
+        state->failed = true;
+        *error = 1;
+        log_message(ERROR_LEVEL,
+                    "GEMBED_TOPK_MULTI: vectors are not of the queries' format and dimension");
+        return;
+    }
+
+    float *row = &state->rows[state->n_rows * state->dim];
+    widen_element[state->element](args->args[0] + sizeof(uint32_t), state->dim, row);
+    state->row_norms2[state->n_rows] = norm2(row, state->dim);
+    read_id(args, &state->ids[state->n_rows]);
+
+    if (++state->n_rows == TOPK_ROW_BLOCK) {
+        topk_multi_flush(state);
+    }
+}
+
+char *gembed_topk_multi(UDF_INIT *initid, UDF_ARGS *args, char *, unsigned long *length,
+                        unsigned char *is_null, unsigned char *error) {
+    Topk_multi_state *state = reinterpret_cast<Topk_multi_state *>(initid->ptr);
+
+    if (state->failed) {
+        *error = 1;
+        return nullptr;
+    }
+    if (!state->ready) {
+        *is_null = 1;
+        return nullptr;
+    }
+
+    topk_multi_flush(state);
+
+    // One array per query, in the order of the queries
+    std::string &json = state->result;
+    json.assign("[");
+    for (size_t q = 0; q < state->n_queries; q++) {
+        if (q > 0) {
+            json.push_back(',');
+        }
+        append_topk_json(&json, &state->heaps[q], state->metric,
+                         args->arg_type[1] == INT_RESULT);
+        if (json.size() > initid->max_length) {
+            *error = 1;
+            log_message(ERROR_LEVEL, "Output exceeds gembed.max_output_size");
+            return nullptr;
+        }
+    }
+    json.push_back(']');
+
+    *length = json.size();
+    return &json[0];
+}
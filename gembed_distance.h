@@ -0,0 +1,81 @@
+/* Copyright (c) 2025, Joel Díaz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+#ifndef GEMBED_DISTANCE_H
+#define GEMBED_DISTANCE_H
+
+#include <mysql/components/services/status_variable_registration.h>
+#include <mysql/udf_registration_types.h>
+
+/*
+ * Vector distances computed on stored vectors in their own format:
+ *
+ *   GEMBED_DOT(a, b [, format])     dot product, larger is closer
+ *   GEMBED_COSINE(a, b [, format])  1 - cosine similarity, NULL for a zero vector
+ *   GEMBED_L2(a, b [, format])      Euclidean distance
+ *
+ * format is "float32" (the default), "fp16" or "bf16", as produced by
+ * EMBED_TEXT; see gembed_quantize.h for the layouts. Half-precision values
+ * are widened a register at a time inside the kernels, which use AVX-512,
+ * AVX2 with FMA and F16C, or NEON when the CPU has them.
+ */
+
+/* Picks the kernels for this CPU, so the first query does not */
+void distance_kernels_init();
+
+/* SHOW_FUNC for gembed.distance_isa: "avx512", "avx2", "neon" or "scalar" */
+int distance_isa_show(MYSQL_THD thd, SHOW_VAR *var, char *buf);
+
+bool gembed_distance_init(UDF_INIT *initid, UDF_ARGS *args, char *message);
+
+double gembed_dot(UDF_INIT *initid, UDF_ARGS *args, unsigned char *is_null,
+                  unsigned char *error);
+double gembed_cosine(UDF_INIT *initid, UDF_ARGS *args, unsigned char *is_null,
+                     unsigned char *error);
+double gembed_l2(UDF_INIT *initid, UDF_ARGS *args, unsigned char *is_null,
+                 unsigned char *error);
+
+/*
+ * GEMBED_TOPK(vector, id, query, k, metric [, format]) is an aggregate that
+ * keeps the k rows of a group closest to query under metric ("dot",
+ * "cosine" or "l2") in a bounded heap, and returns them closest first as
+ * a JSON array of [id, score] pairs. Once k rows are held, l2 and cosine
+ * rows are scored a block of dimensions at a time and given up as soon as
+ * they cannot beat the k-th best.
+ */
+bool gembed_topk_init(UDF_INIT *initid, UDF_ARGS *args, char *message);
+void gembed_topk_deinit(UDF_INIT *initid);
+void gembed_topk_clear(UDF_INIT *initid, unsigned char *is_null, unsigned char *error);
+void gembed_topk_add(UDF_INIT *initid, UDF_ARGS *args, unsigned char *is_null,
+                     unsigned char *error);
+char *gembed_topk(UDF_INIT *initid, UDF_ARGS *args, char *result, unsigned long *length,
+                  unsigned char *is_null, unsigned char *error);
+
+/*
+ * GEMBED_TOPK_MULTI(vector, id, queries, k, metric [, format]) is
+ * GEMBED_TOPK for many queries in one scan. queries holds vectors of one
+ * format and dimension count end to end, and the result is an array with
+ * the top k of each query, in their order. Rows are buffered and scored
+ * against all queries at once, a tile of rows and queries held in
+ * registers, so each row is read once rather than once per query.
+ */
+bool gembed_topk_multi_init(UDF_INIT *initid, UDF_ARGS *args, char *message);
+void gembed_topk_multi_deinit(UDF_INIT *initid);
+void gembed_topk_multi_clear(UDF_INIT *initid, unsigned char *is_null, unsigned char *error);
+void gembed_topk_multi_add(UDF_INIT *initid, UDF_ARGS *args, unsigned char *is_null,
+                           unsigned char *error);
+char *gembed_topk_multi(UDF_INIT *initid, UDF_ARGS *args, char *result, unsigned long *length,
+                        unsigned char *is_null, unsigned char *error);
+
+#endif /* GEMBED_DISTANCE_H */
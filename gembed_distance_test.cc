@@ -0,0 +1,492 @@
+/* Copyright (c) 2025, Joel Díaz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+
+/*
+ * Standalone test of the distance kernels and GEMBED_TOPK: the SIMD paths
+ * of this CPU against the scalar ones, the cosine abandoning bound, the
+ * order of the JSON result, and GEMBED_TOPK and GEMBED_TOPK_MULTI against
+ * a brute-force ranking. The unit is included whole to reach its kernels.
+ */
+
+// Included, the unit's types in an anonymous namespace look like a header's
+#pragma GCC diagnostic ignored "-Wsubobject-linkage"
+#include "gembed_distance.cc"
+
+#include <cstdlib>
+#include <random>
+
+/* What the component defines elsewhere */
+void log_message(int, const char *message) {
+    fprintf(stderr, "log: %s\n", message);
+}
+unsigned long gembed_max_output_size = 1 << 20;
+gembed_status_t gembed_status;
+
+static int failures = 0;
+
+#define CHECK(cond)                                                          \
+    do {                                                                     \
+        if (!(cond)) {                                                       \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, \
+                    #cond);                                                  \
+            failures++;                                                      \
+        }                                                                    \
+    } while (0)
+
+static std::vector<float> random_vector(std::mt19937 &rng, size_t dim, float range) {
+    std::uniform_real_distribution<float> dist(-range, range);
+    std::vector<float> vec(dim);
+    for (float &x : vec) {
+        x = dist(rng);
+    }
+    return vec;
+}
+
+/* The elements of vec as stored for element type e, without the header */
+static std::string encode(Element e, const std::vector<float> &vec) {
+    std::string out(vec.size() * element_size[e], '\0');
+    for (size_t i = 0; i < vec.size(); i++) {
+        uint16_t half = e == ELEMENT_F16 ? float_to_fp16(vec[i]) : float_to_bf16(vec[i]);
+        if (e == ELEMENT_F32) {
+            memcpy(&out[i * sizeof(float)], &vec[i], sizeof(float));
+        } else {
+            memcpy(&out[i * sizeof(half)], &half, sizeof(half));
+        }
+    }
+    return out;
+}
+
+/* Whether got is within a relative tolerance of want, scaled by magnitude */
+static bool within(double got, double want, double magnitude, double tolerance) {
+    return std::fabs(got - want) <= tolerance * magnitude + 1e-6;
+}
+
+/* Every kernel and the block kernel of Isa against the scalar ones */
+template <class Isa>
+static void test_isa_against_scalar(std::mt19937 &rng) {
+    Distance_kernels fast, scalar;
+    fill_kernels<Isa>(&fast);
+    fill_kernels<Scalar_isa>(&scalar);
+
+    for (size_t dim : {1, 7, 8, 15, 16, 17, 33, 100, 384, 768, 1024, 1031}) {
+        std::vector<float> a = random_vector(rng, dim, 1.0f);
+        std::vector<float> b = random_vector(rng, dim, 1.0f);
+        Size size = size_of(dim);
+
+        for (int e = 0; e < N_ELEMENTS; e++) {
+            std::string x = encode(static_cast<Element>(e), a);
+            std::string y = encode(static_cast<Element>(e), b);
+            // Every term is at most 4 in magnitude, so the sums are too
+            double magnitude = 4.0 * dim;
+
+            for (int m = 0; m < N_METRICS; m++) {
+                Sums want = scalar.kernel[e][m][size](x.data(), y.data(), dim);
+                Sums got = fast.kernel[e][m][size](x.data(), y.data(), dim);
+                CHECK(within(got.s0, want.s0, magnitude, 1e-6));
+                CHECK(within(got.s1, want.s1, magnitude, 1e-6));
+                CHECK(within(got.s2, want.s2, magnitude, 1e-6));
+
+                // The generic kernel agrees with the sized one
+                Sums any = fast.kernel[e][m][SIZE_ANY](x.data(), y.data(), dim);
+                CHECK(within(any.s0, want.s0, magnitude, 1e-6));
+            }
+        }
+    }
+
+    // Every tile shape, including the narrow ones at the edges of a block
+    for (size_t dim : {1, 17, 64, 100}) {
+        for (size_t n_rows = 1; n_rows <= 9; n_rows++) {
+            for (size_t n_queries = 1; n_queries <= 7; n_queries++) {
+                std::vector<float> rows = random_vector(rng, n_rows * dim, 1.0f);
+                std::vector<float> queries = random_vector(rng, n_queries * dim, 1.0f);
+                std::vector<float> got(n_rows * n_queries, -1), want(n_rows * n_queries);
+                fast.block(rows.data(), n_rows, queries.data(), n_queries, dim, got.data());
+                scalar.block(rows.data(), n_rows, queries.data(), n_queries, dim,
+                             want.data());
+                for (size_t i = 0; i < got.size(); i++) {
+                    CHECK(within(got[i], want[i], dim, 1e-6));
+                }
+            }
+        }
+    }
+}
+
+static void test_simd_against_scalar(std::mt19937 &rng) {
+#if defined(__x86_64__)
+    const Cpu_features &cpu = cpu_features();
+    if (cpu.avx2 && cpu.fma && cpu.f16c) {
+        test_isa_against_scalar<Avx2_isa>(rng);
+    }
+    if (cpu.avx512f) {
+        test_isa_against_scalar<Avx512_isa>(rng);
+    }
+#elif defined(__aarch64__)
+    test_isa_against_scalar<Neon_isa>(rng);
+#endif
+    (void)rng;
+}
+
+/* Holds the arguments of a GEMBED_TOPK or GEMBED_TOPK_MULTI call */
+struct Topk_call {
+    long long k;
+    long long id = 0;
+    std::string metric;
+    std::string format;
+    std::string queries;
+    char *args[6];
+    unsigned long lengths[6];
+    Item_result types[6] = {STRING_RESULT, INT_RESULT,    STRING_RESULT,
+                            INT_RESULT,    STRING_RESULT, STRING_RESULT};
+    UDF_ARGS udf_args{};
+
+    Topk_call(long long k_, const char *metric_, const char *format_, std::string queries_)
+        : k(k_), metric(metric_), format(format_), queries(std::move(queries_)) {
+        args[0] = nullptr;
+        lengths[0] = 0;
+        args[1] = reinterpret_cast<char *>(&id);
+        lengths[1] = sizeof(id);
+        args[2] = &queries[0];
+        lengths[2] = queries.size();
+        args[3] = reinterpret_cast<char *>(&k);
+        lengths[3] = sizeof(k);
+        args[4] = &metric[0];
+        lengths[4] = metric.size();
+        args[5] = &format[0];
+        lengths[5] = format.size();
+        udf_args.arg_count = 6;
+        udf_args.arg_type = types;
+        udf_args.args = args;
+        udf_args.lengths = lengths;
+    }
+
+    void row(const std::string &vector, long long row_id) {
+        args[0] = const_cast<char *>(vector.data());
+        lengths[0] = vector.size();
+        id = row_id;
+    }
+};
+
+/* A packed vector of format, header included */
+static std::string pack(Output_format format, const std::vector<float> &vec) {
+    std::string out(quantized_size(format, vec.size()), '\0');
+    quantize_vector(format, nullptr, vec.data(), vec.size(), &out[0]);
+    return out;
+}
+
+/* Distance of a packed row to a packed query in double, as the metric's score */
+static double brute_score(Output_format format, Metric metric, const std::string &row,
+                          const std::string &query) {
+    Element element = format == OUTPUT_FLOAT32 ? ELEMENT_F32
+                      : format == OUTPUT_FP16  ? ELEMENT_F16
+                                               : ELEMENT_BF16;
+    size_t dim = (row.size() - sizeof(uint32_t)) / element_size[element];
+    std::vector<float> x(dim), y(dim);
+    widen_element[element](row.data() + sizeof(uint32_t), dim, x.data());
+    widen_element[element](query.data() + sizeof(uint32_t), dim, y.data());
+
+    double dot = 0, l2 = 0, xx = 0, yy = 0;
+    for (size_t i = 0; i < dim; i++) {
+        dot += double(x[i]) * y[i];
+        l2 += (double(x[i]) - y[i]) * (double(x[i]) - y[i]);
+        xx += double(x[i]) * x[i];
+        yy += double(y[i]) * y[i];
+    }
+    switch (metric) {
+        case METRIC_DOT: return dot;
+        case METRIC_L2: return std::sqrt(l2);
+        default: return 1 - dot / std::sqrt(xx * yy);
+    }
+}
+
+/* Reads [[id,score],...] from p, leaving p past the closing bracket */
+static std::vector<std::pair<long long, double>> parse_result(const char *&p) {
+    std::vector<std::pair<long long, double>> out;
+    CHECK(*p == '[');
+    p++;
+    while (*p == '[' || *p == ',') {
+        if (*p == ',') p++;
+        CHECK(*p == '[');
+        char *end;
+        long long id = strtoll(p + 1, &end, 10);
+        CHECK(*end == ',');
+        double score = strtod(end + 1, &end);
+        CHECK(*end == ']');
+        out.emplace_back(id, score);
+        p = end + 1;
+    }
+    CHECK(*p == ']');
+    p++;
+    return out;
+}
+
+/*
+ * Checks one ranking against the brute-force scores of all rows: closest
+ * first, each score right, and nothing closer left out.
+ */
+static void check_ranking(const std::vector<std::pair<long long, double>> &got,
+                          const std::vector<double> &scores, Metric metric, size_t k) {
+    // Distances, lower is closer
+    std::vector<double> sorted;
+    for (double score : scores) {
+        sorted.push_back(metric == METRIC_DOT ? -score : score);
+    }
+    std::sort(sorted.begin(), sorted.end());
+    double kth = sorted[k - 1];
+    double tolerance = 1e-4 * std::max(1.0, std::fabs(kth));
+
+    CHECK(got.size() == k);
+    for (size_t i = 0; i < got.size(); i++) {
+        long long id = got[i].first;
+        CHECK(id >= 0 && static_cast<size_t>(id) < scores.size());
+        if (id < 0 || static_cast<size_t>(id) >= scores.size()) {
+            continue;
+        }
+        CHECK(within(got[i].second, scores[id], std::max(1.0, std::fabs(scores[id])), 1e-4));
+        double distance = metric == METRIC_DOT ? -got[i].second : got[i].second;
+        CHECK(distance <= kth + tolerance);
+        if (i > 0) {
+            double previous = metric == METRIC_DOT ? -got[i - 1].second : got[i - 1].second;
+            CHECK(previous <= distance);
+        }
+    }
+}
+
+/*
+ * GEMBED_TOPK over clustered rows against a brute-force ranking. A few
+ * rows lie near the query, so once the heap fills most L2 and cosine rows
+ * are given up early, and the test makes sure that loses none.
+ */
+static void test_topk_against_brute_force(std::mt19937 &rng) {
+    const size_t N = 2000, K = 10;
+    static const char *const metrics[] = {"dot", "cosine", "l2"};
+    static const struct {
+        const char *name;
+        Output_format format;
+    } formats[] = {{"float32", OUTPUT_FLOAT32}, {"fp16", OUTPUT_FP16}, {"bf16", OUTPUT_BF16}};
+
+    for (size_t dim : {7, 100, 384, 1031}) {
+        for (int m = 0; m < N_METRICS; m++) {
+            for (const auto &f : formats) {
+                std::vector<float> q = random_vector(rng, dim, 0.5f);
+                std::string query = pack(f.format, q);
+
+                std::vector<std::string> rows(N);
+                std::vector<double> scores(N);
+                for (size_t r = 0; r < N; r++) {
+                    std::vector<float> x = random_vector(rng, dim, 0.5f);
+                    float pull = r % 97 == 0 ? 1.0f : 0.1f;
+                    for (size_t i = 0; i < dim; i++) {
+                        x[i] += q[i] * pull;
+                    }
+                    rows[r] = pack(f.format, x);
+                    scores[r] = brute_score(f.format, static_cast<Metric>(m), rows[r], query);
+                }
+
+                Topk_call call(K, metrics[m], f.name, query);
+                UDF_INIT init{};
+                char message[MYSQL_ERRMSG_SIZE];
+                unsigned char is_null = 0, error = 0;
+                CHECK(!gembed_topk_init(&init, &call.udf_args, message));
+                gembed_topk_clear(&init, &is_null, &error);
+                for (size_t r = 0; r < N; r++) {
+                    call.row(rows[r], static_cast<long long>(r));
+                    gembed_topk_add(&init, &call.udf_args, &is_null, &error);
+                }
+                CHECK(!error);
+
+                const Topk_state *state = reinterpret_cast<Topk_state *>(init.ptr);
+                if (m != METRIC_DOT && dim > TOPK_BLOCK) {
+                    CHECK(state->abandoned > 0);
+                }
+
+                unsigned long length = 0;
+                const char *json =
+                    gembed_topk(&init, &call.udf_args, nullptr, &length, &is_null, &error);
+                CHECK(json && !is_null && !error);
+                if (json) {
+                    std::string result(json, length);
+                    const char *p = result.c_str();
+                    check_ranking(parse_result(p), scores, static_cast<Metric>(m), K);
+                    CHECK(*p == '\0');
+                }
+                gembed_topk_deinit(&init);
+            }
+        }
+    }
+}
+
+/* GEMBED_TOPK_MULTI ranks each of its queries as GEMBED_TOPK would */
+static void test_topk_multi_against_brute_force(std::mt19937 &rng) {
+    const size_t N = 500, K = 7, N_QUERIES = 5;
+    static const char *const metrics[] = {"dot", "cosine", "l2"};
+
+    for (size_t dim : {7, 100, 384}) {
+        for (int m = 0; m < N_METRICS; m++) {
+            std::vector<std::string> queries;
+            std::string all;
+            for (size_t q = 0; q < N_QUERIES; q++) {
+                queries.push_back(pack(OUTPUT_FP16, random_vector(rng, dim, 1.0f)));
+                all += queries.back();
+            }
+
+            std::vector<std::string> rows(N);
+            for (std::string &row : rows) {
+                row = pack(OUTPUT_FP16, random_vector(rng, dim, 1.0f));
+            }
+
+            Topk_call call(K, metrics[m], "fp16", all);
+            UDF_INIT init{};
+            char message[MYSQL_ERRMSG_SIZE];
+            unsigned char is_null = 0, error = 0;
+            CHECK(!gembed_topk_multi_init(&init, &call.udf_args, message));
+            gembed_topk_multi_clear(&init, &is_null, &error);
+            for (size_t r = 0; r < N; r++) {
+                call.row(rows[r], static_cast<long long>(r));
+                gembed_topk_multi_add(&init, &call.udf_args, &is_null, &error);
+            }
+
+            unsigned long length = 0;
+            const char *json =
+                gembed_topk_multi(&init, &call.udf_args, nullptr, &length, &is_null, &error);
+            CHECK(json && !is_null && !error);
+            if (json) {
+                std::string result(json, length);
+                const char *p = result.c_str();
+                CHECK(*p == '[');
+                p++;
+                for (size_t q = 0; q < N_QUERIES; q++) {
+                    if (q > 0) {
+                        CHECK(*p == ',');
+                        p++;
+                    }
+                    std::vector<double> scores(N);
+                    for (size_t r = 0; r < N; r++) {
+                        scores[r] =
+                            brute_score(OUTPUT_FP16, static_cast<Metric>(m), rows[r], queries[q]);
+                    }
+                    check_ranking(parse_result(p), scores, static_cast<Metric>(m), K);
+                }
+                CHECK(*p == ']');
+            }
+            gembed_topk_multi_deinit(&init);
+        }
+    }
+}
+
+/*
+ * The cosine bound never passes the true distance, at any block boundary,
+ * for random rows and for rows that make it tight: the query itself, and
+ * rows that match the query only before or only after the boundary.
+ */
+static void test_cosine_bound(std::mt19937 &rng) {
+    for (size_t dim : {100, 384, 1031}) {
+        std::vector<float> q = random_vector(rng, dim, 1.0f);
+        std::string query = pack(OUTPUT_FLOAT32, q);
+
+        Topk_call call(1, "cosine", "float32", query);
+        Topk_state state;
+        CHECK(!topk_prepare(&state, &call.udf_args));
+
+        for (size_t to = TOPK_BLOCK; to < dim; to += TOPK_BLOCK) {
+            std::vector<std::vector<float>> rows;
+            rows.push_back(random_vector(rng, dim, 1.0f));
+            rows.push_back(q);
+            std::vector<float> before = q, after = q, opposite = q;
+            std::fill(before.begin() + to, before.end(), 0.0f);
+            std::fill(after.begin(), after.begin() + to, 0.0f);
+            for (float &x : opposite) x = -x;
+            rows.push_back(before);
+            rows.push_back(after);
+            rows.push_back(opposite);
+            // Matches the query after the boundary, scaled, with noise before
+            std::vector<float> mixed = random_vector(rng, dim, 0.1f);
+            for (size_t i = to; i < dim; i++) mixed[i] = 3 * q[i];
+            rows.push_back(mixed);
+
+            for (const std::vector<float> &x : rows) {
+                std::string row = pack(OUTPUT_FLOAT32, x);
+                const char *elements = row.data() + sizeof(uint32_t);
+                Sums prefix = Scalar_isa::run<F32, METRIC_COSINE, 0>(
+                    elements, state.query.data(), to);
+                double distance = brute_score(OUTPUT_FLOAT32, METRIC_COSINE, row, query);
+                CHECK(cosine_lower_bound(state, prefix, to) <= distance);
+            }
+        }
+    }
+}
+
+/* The JSON result is closest first, in each metric's units, ids escaped */
+static void test_topk_json(std::mt19937 &rng) {
+    std::uniform_real_distribution<float> dist(0.0f, 10.0f);
+
+    for (int m = 0; m < N_METRICS; m++) {
+        std::vector<Topk_entry> heap;
+        std::vector<float> keys;
+        const size_t k = 5;
+        for (int i = 0; i < 40; i++) {
+            float key = dist(rng);
+            keys.push_back(key);
+            if (topk_wants(heap, k, key)) {
+                topk_push(&heap, k, key, std::to_string(i));
+            }
+        }
+        CHECK(heap.size() == k);
+
+        std::vector<float> sorted = keys;
+        std::sort(sorted.begin(), sorted.end());
+
+        std::string json;
+        append_topk_json(&json, &heap, static_cast<Metric>(m), true);
+        std::string want = "[";
+        for (size_t i = 0; i < k; i++) {
+            size_t id = std::find(keys.begin(), keys.end(), sorted[i]) - keys.begin();
+            double score = m == METRIC_DOT  ? -sorted[i]
+                           : m == METRIC_L2 ? std::sqrt(sorted[i])
+                                            : sorted[i];
+            char entry[64];
+            snprintf(entry, sizeof(entry), "%s[%zu,%.7g]", i ? "," : "", id, score);
+            want += entry;
+        }
+        want += "]";
+        CHECK(json == want);
+    }
+
+    // NaN keys, from zero vectors under cosine, are never kept
+    std::vector<Topk_entry> heap;
+    CHECK(!topk_wants(heap, 1, std::numeric_limits<float>::quiet_NaN()));
+
+    topk_push(&heap, 2, 0.5f, "a\"b\\c\nd");
+    topk_push(&heap, 2, 0.25f, "plain");
+    std::string json;
+    append_topk_json(&json, &heap, METRIC_COSINE, false);
+    CHECK(json == "[[\"plain\",0.25],[\"a\\\"b\\\\c\\u000ad\",0.5]]");
+}
+
+int main() {
+    std::mt19937 rng(49);
+
+    test_simd_against_scalar(rng);
+    test_cosine_bound(rng);
+    test_topk_json(rng);
+    test_topk_against_brute_force(rng);
+    test_topk_multi_against_brute_force(rng);
+
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("gembed_distance_test: all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,243 @@
+/* Copyright (c) 2025, Joel Díaz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+
+#include "gembed_embed.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include "gembed_cache.h"
+#include "gembed_disk_cache.h"
+#include "gembed_pool.h"
+
+/*
+ * embed_with_cache(), where pinned, if given, takes a lone persistent
+ * cache hit: out is then left empty and the vector is read from the
+ * mapped segment that pinned holds.
+ */
+static int embed_cached(Model_entry *model,
+                        const StringSlice *texts, size_t n,
+                        const Embed_options &opts,
+                        std::vector<float> &out, size_t *out_dim,
+                        Disk_cache_hit *pinned) {
+    std::vector<std::pair<size_t, std::vector<float>>> hits;
+    std::vector<std::pair<size_t, Disk_cache_hit>> disk_hits;
+    std::vector<size_t> misses;
+
+    // Only the memory cache is used while the model cannot be fingerprinted
+    uint64_t fingerprint = disk_cache_enabled() ? model_fingerprint(model) : 0;
+
+    for (size_t i = 0; i < n; i++) {
+        std::vector<float> vec;
+        Disk_cache_hit disk_hit;
+        if (embedding_cache_get(model->method_id, model->model_id,
+                                texts[i].ptr, texts[i].len, vec)) {
+            hits.emplace_back(i, std::move(vec));
+        } else if (fingerprint &&
+                   disk_cache_get(fingerprint, texts[i].ptr, texts[i].len, &disk_hit)) {
+            embedding_cache_put(model->method_id, model->model_id,
+                                texts[i].ptr, texts[i].len, disk_hit.vec, disk_hit.dim);
+            disk_hits.emplace_back(i, std::move(disk_hit));
+        } else {
+            misses.push_back(i);
+        }
+    }
+
+    if (pinned && n == 1 && disk_hits.size() == 1) {
+        *pinned = std::move(disk_hits[0].second);
+        *out_dim = pinned->dim;
+        return 0;
+    }
+
+    size_t dim = !hits.empty() ? hits[0].second.size()
+                 : !disk_hits.empty() ? disk_hits[0].second.dim : 0;
+    if (dim > 0) {
+        out.resize(n * dim);
+    }
+
+    // Misses become sub-batches that the pool runs in parallel
+    std::vector<StringSlice> pending(misses.size());
+    for (size_t k = 0; k < misses.size(); k++) {
+        pending[k] = texts[misses[k]];
+    }
+
+    size_t max_batch = model_batch_size(model);
+    std::vector<Inference_job> jobs((misses.size() + max_batch - 1) / max_batch);
+
+    for (size_t j = 0; j < jobs.size(); j++) {
+        size_t start = j * max_batch;
+        jobs[j].model = model;
+        jobs[j].texts = pending.data() + start;
+        jobs[j].n_texts = std::min(max_batch, misses.size() - start);
+    }
+
+    inference_pool_run(jobs.data(), jobs.size(), opts.priority);
+
+    for (size_t j = 0; j < jobs.size(); j++) {
+        const Inference_job &job = jobs[j];
+        if (job.err != 0 || (dim > 0 && job.dim != dim)) {
+            return -1;
+        }
+
+        if (dim == 0) {
+            dim = job.dim;
+            out.resize(n * dim);
+        }
+
+        for (size_t k = 0; k < job.n_texts; k++) {
+            const float *vec = job.vectors.data() + k * dim;
+            size_t index = misses[j * max_batch + k];
+            memcpy(out.data() + index * dim, vec, dim * sizeof(float));
+            embedding_cache_put(model->method_id, model->model_id,
+                                job.texts[k].ptr, job.texts[k].len, vec, dim);
+            if (fingerprint) {
+                disk_cache_put(fingerprint, job.texts[k].ptr, job.texts[k].len, vec, dim);
+            }
+        }
+    }
+
+    for (const auto &hit : hits) {
+        if (hit.second.size() != dim) {
+            return -1;
+        }
+        memcpy(out.data() + hit.first * dim, hit.second.data(), dim * sizeof(float));
+    }
+
+    // Straight from the mapped segment into the result
+    for (const auto &hit : disk_hits) {
+        if (hit.second.dim != dim) {
+            return -1;
+        }
+        memcpy(out.data() + hit.first * dim, hit.second.vec, dim * sizeof(float));
+    }
+
+    *out_dim = dim;
+    return 0;
+}
+
+int embed_with_cache(Model_entry *model,
+                     const StringSlice *texts, size_t n,
+                     const Embed_options &opts,
+                     std::vector<float> &out, size_t *out_dim) {
+    return embed_cached(model, texts, n, opts, out, out_dim, nullptr);
+}
+
+int embed_one(Model_entry *model, const StringSlice &text, const Embed_options &opts,
+              std::vector<float> &scratch, Disk_cache_hit *pinned,
+              const float **vec, size_t *dim) {
+    if (embed_cached(model, &text, 1, opts, scratch, dim, pinned) != 0) {
+        return -1;
+    }
+    *vec = pinned->vec ? pinned->vec : scratch.data();
+    return 0;
+}
+
+int embed_with_memo(Statement_memo *memo, Model_entry *model,
+                    const StringSlice *texts, size_t n,
+                    const Embed_options &opts,
+                    std::vector<float> &out, size_t *out_dim) {
+    std::vector<std::pair<size_t, const float *>> hits;
+    std::vector<StringSlice> misses;
+    std::vector<size_t> miss_index;
+    size_t dim = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        size_t hit_dim;
+        const float *vec = memo->find(model, texts[i].ptr, texts[i].len, &hit_dim);
+        if (vec && (dim == 0 || hit_dim == dim)) {
+            dim = hit_dim;
+            hits.emplace_back(i, vec);
+        } else {
+            misses.push_back(texts[i]);
+            miss_index.push_back(i);
+        }
+    }
+
+    if (misses.size() == n) {
+        if (embed_with_cache(model, texts, n, opts, out, out_dim) != 0) {
+            return -1;
+        }
+        for (size_t i = 0; i < n; i++) {
+            memo->add(model, texts[i].ptr, texts[i].len, out.data() + i * *out_dim,
+                      *out_dim);
+        }
+        return 0;
+    }
+
+    std::vector<float> embedded;
+    if (!misses.empty()) {
+        size_t miss_dim = 0;
+        if (embed_with_cache(model, misses.data(), misses.size(), opts, embedded,
+                             &miss_dim) != 0 ||
+            miss_dim != dim) {
+            return -1;
+        }
+    }
+
+    out.resize(n * dim);
+    for (const auto &hit : hits) {
+        memcpy(out.data() + hit.first * dim, hit.second, dim * sizeof(float));
+    }
+    for (size_t k = 0; k < misses.size(); k++) {
+        const float *vec = embedded.data() + k * dim;
+        memcpy(out.data() + miss_index[k] * dim, vec, dim * sizeof(float));
+        memo->add(model, misses[k].ptr, misses[k].len, vec, dim);
+    }
+
+    *out_dim = dim;
+    return 0;
+}
+
+char *store_vector(char **buffer, unsigned long max_length,
+                   const float *vec, size_t dim, unsigned long *length) {
+    size_t vector_size = sizeof(uint32_t) + (dim * sizeof(float));
+    if (vector_size > max_length) {
+        return nullptr;
+    }
+
+    char *vector_data = new char[vector_size];
+
+    *reinterpret_cast<uint32_t*>(vector_data) = static_cast<uint32_t>(dim);
+    memcpy(vector_data + sizeof(uint32_t), vec, dim * sizeof(float));
+
+    delete[] *buffer;
+    *buffer = vector_data;
+    *length = vector_size;
+
+    return vector_data;
+}
+
+char *store_output(char **buffer, unsigned long max_length,
+                   const Embed_options &opts, const Int8_ranges *ranges,
+                   const float *vec, size_t dim, unsigned long *length) {
+    if (opts.output == OUTPUT_FLOAT32) {
+        return store_vector(buffer, max_length, vec, dim, length);
+    }
+
+    size_t size = quantized_size(opts.output, dim);
+    if (size > max_length) {
+        return nullptr;
+    }
+
+    char *data = new char[size];
+    quantize_vector(opts.output, ranges, vec, dim, data);
+
+    delete[] *buffer;
+    *buffer = data;
+    *length = size;
+
+    return data;
+}
@@ -0,0 +1,88 @@
+/* Copyright (c) 2025, Joel Díaz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+#ifndef GEMBED_EMBED_H
+#define GEMBED_EMBED_H
+
+#include <mysql/udf_registration_types.h>
+#include <cstddef>
+#include <vector>
+#include "mysql_gembed.h"
+#include "gembed_disk_cache.h"
+#include "gembed_memo.h"
+#include "gembed_models.h"
+#include "gembed_options.h"
+#include "gembed_quantize.h"
+
+/*
+ * Embeds n texts into out (n * dim floats, in input order).
+ * Cached vectors are reused; the rest goes to the inference pool in
+ * sub-batches of the model's batch size. Returns 0 on success.
+ */
+int embed_with_cache(Model_entry *model,
+                     const StringSlice *texts, size_t n,
+                     const Embed_options &opts,
+                     std::vector<float> &out, size_t *out_dim);
+
+/*
+ * embed_with_cache() for one text, pointing *vec at its vector. A hit in
+ * the persistent cache is not copied: *vec points into the mapped segment,
+ * which pinned keeps alive. Otherwise the vector is held in scratch.
+ */
+int embed_one(Model_entry *model, const StringSlice &text, const Embed_options &opts,
+              std::vector<float> &scratch, Disk_cache_hit *pinned,
+              const float **vec, size_t *dim);
+
+/*
+ * embed_with_cache() behind a statement memo: texts found in memo skip
+ * every other path, and newly embedded ones are added to it.
+ */
+int embed_with_memo(Statement_memo *memo, Model_entry *model,
+                    const StringSlice *texts, size_t n,
+                    const Embed_options &opts,
+                    std::vector<float> &out, size_t *out_dim);
+
+/* State of an EMBED_TEXT or EMBED_TEXTS call site, kept in initid->ptr */
+struct Embed_udf_state {
+    char *result = nullptr;  /* returned to the server, replaced every row */
+    Statement_memo memo;
+
+    /*
+     * Set at init when method, model and options are constant. The first
+     * row then resolves them into model and opts, and later rows reuse them.
+     */
+    bool constant_args = false;
+    Model_entry *model = nullptr;
+    Embed_options opts;
+
+    ~Embed_udf_state() { delete[] result; }
+};
+
+/*
+ * Stores a vector in MySQL VECTOR format (u32 dimension count followed by
+ * the floats) in *buffer, replacing what it held, and returns it. Returns
+ * NULL when the result would exceed max_length.
+ */
+char *store_vector(char **buffer, unsigned long max_length,
+                   const float *vec, size_t dim, unsigned long *length);
+
+/*
+ * store_vector() in the output format of opts. ranges are the model's
+ * calibrated int8 ranges, with dim dimensions, when opts asks for them.
+ */
+char *store_output(char **buffer, unsigned long max_length,
+                   const Embed_options &opts, const Int8_ranges *ranges,
+                   const float *vec, size_t dim, unsigned long *length);
+
+#endif /* GEMBED_EMBED_H */
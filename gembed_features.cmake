@@ -0,0 +1,47 @@
+# Writes OUTPUT, defining GEMBED_HAVE_<NAME> to 1 for each optional entry
+# point of mysql_gembed.h that LIBRARY exports and to 0 otherwise.
+#
+#   cmake -DNM=<nm> -DLIBRARY=<libgembed.a> -DOUTPUT=<header> -P gembed_features.cmake
+#
+# Callers reference an entry point only under its macro, so the reference is
+# a normal one: it pulls the archive member that defines it, and a library
+# without it still links.
+
+SET(ENTRY_POINTS
+  gembed_bind_replica
+)
+
+SET(SYMBOLS "")
+IF(EXISTS "${LIBRARY}")
+  EXECUTE_PROCESS(COMMAND ${NM} -g "${LIBRARY}"
+    OUTPUT_VARIABLE SYMBOLS
+    ERROR_QUIET
+  )
+ELSE()
+  MESSAGE(WARNING "${LIBRARY} not found, building without optional entry points")
+ENDIF()
+# Every symbol line ends in a newline, the last one included
+STRING(APPEND SYMBOLS "\n")
+
+SET(HEADER "/* Generated by gembed_features.cmake from libgembed.a, do not edit */\n")
+STRING(APPEND HEADER "#ifndef GEMBED_FEATURES_H\n#define GEMBED_FEATURES_H\n\n")
+FOREACH(NAME ${ENTRY_POINTS})
+  STRING(TOUPPER ${NAME} MACRO)
+  STRING(REGEX REPLACE "^GEMBED_" "GEMBED_HAVE_" MACRO ${MACRO})
+  # Mach-O prefixes C symbols with an underscore
+  IF(SYMBOLS MATCHES "[ \t][T] _?${NAME}\n")
+    STRING(APPEND HEADER "#define ${MACRO} 1\n")
+  ELSE()
+    STRING(APPEND HEADER "#define ${MACRO} 0\n")
+  ENDIF()
+ENDFOREACH()
+STRING(APPEND HEADER "\n#endif /* GEMBED_FEATURES_H */\n")
+
+# Rewriting an unchanged header would rebuild everything that includes it
+SET(CURRENT "")
+IF(EXISTS "${OUTPUT}")
+  FILE(READ "${OUTPUT}" CURRENT)
+ENDIF()
+IF(NOT CURRENT STREQUAL HEADER)
+  FILE(WRITE "${OUTPUT}" "${HEADER}")
+ENDIF()
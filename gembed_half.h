@@ -0,0 +1,97 @@
+/* Copyright (c) 2025, Joel Díaz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+#ifndef GEMBED_HALF_H
+#define GEMBED_HALF_H
+
+#include <cstdint>
+#include <cstring>
+
+/*
+ * Scalar conversions between float and the 16-bit formats, rounding to
+ * nearest even like the F16C and AVX512_BF16 instructions. The SIMD paths
+ * use these for their tails and on CPUs without those instructions.
+ */
+
+inline uint16_t float_to_fp16(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint32_t sign = (bits >> 16) & 0x8000;
+    uint32_t abs = bits & 0x7FFFFFFF;
+
+    if (abs >= 0x7F800000) {
+        // Infinity, or a NaN kept quiet
+        return static_cast<uint16_t>(sign | 0x7C00 | (abs > 0x7F800000 ? 0x200 : 0));
+    }
+    if (abs >= 0x477FF000) {
+        // 65520 and up round past the largest half
+        return static_cast<uint16_t>(sign | 0x7C00);
+    }
+    if (abs < 0x38800000) {
+        // Below 2^-14 the result is subnormal: adding 0.5 leaves the value in
+        // units of 2^-24 in the low mantissa bits, rounded by the FPU
+        float scaled;
+        memcpy(&scaled, &abs, sizeof(scaled));
+        scaled += 0.5f;
+        uint32_t scaled_bits;
+        memcpy(&scaled_bits, &scaled, sizeof(scaled_bits));
+        return static_cast<uint16_t>(sign | (scaled_bits - 0x3F000000));
+    }
+
+    // Rebias the exponent from 127 to 15 and round the 13 dropped bits
+    abs += 0xC8000FFF + ((abs >> 13) & 1);
+    return static_cast<uint16_t>(sign | (abs >> 13));
+}
+
+inline float fp16_to_float(uint16_t half) {
+    uint32_t sign = static_cast<uint32_t>(half & 0x8000) << 16;
+    uint32_t bits = static_cast<uint32_t>(half & 0x7FFF) << 13;
+    uint32_t exponent = bits & 0x0F800000;
+    float value;
+
+    if (exponent == 0x0F800000) {
+        bits += 0x70000000;  // infinity or NaN
+    } else if (exponent == 0) {
+        // Zero or subnormal: m * 2^-24, as (1 + m / 1024) * 2^-14 - 2^-14
+        bits += 0x38800000;
+        memcpy(&value, &bits, sizeof(value));
+        value -= 6.103515625e-05f;
+        memcpy(&bits, &value, sizeof(bits));
+    } else {
+        bits += 0x38000000;
+    }
+
+    bits |= sign;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+inline uint16_t float_to_bf16(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    if ((bits & 0x7FFFFFFF) > 0x7F800000) {
+        return static_cast<uint16_t>((bits >> 16) | 0x40);
+    }
+    bits += 0x7FFF + ((bits >> 16) & 1);
+    return static_cast<uint16_t>(bits >> 16);
+}
+
+inline float bf16_to_float(uint16_t half) {
+    uint32_t bits = static_cast<uint32_t>(half) << 16;
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+#endif /* GEMBED_HALF_H */
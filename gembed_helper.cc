@@ -0,0 +1,615 @@
+/* Copyright (c) 2025, Joel Díaz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+
+#include "gembed_helper.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include "gembed_services.h"
+#include "gembed_shm.h"
+#include "gembed_vars.h"
+
+#if defined(__linux__)
+#include <signal.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+#endif
+
+#define MYSQL_ERRMSG_SIZE 512
+
+struct Helper_settings {
+    std::string path;
+    std::string cgroup;
+    std::string cpus;
+    int nice = 0;
+    unsigned int memory_limit_mb = 0;
+};
+
+static std::mutex settings_lock;
+static Helper_settings settings;
+
+static std::atomic<bool> active{false};
+
+bool helper_active() {
+    return active.load(std::memory_order_acquire);
+}
+
+void helper_configure(const char *path, const char *cgroup, const char *cpus,
+                      int nice, unsigned int memory_limit_mb) {
+    bool changed;
+    {
+        std::lock_guard<std::mutex> guard(settings_lock);
+        std::string new_cgroup = cgroup ? cgroup : "";
+        std::string new_cpus = cpus ? cpus : "";
+
+        // The path only matters for the next start, the others for the running process
+        changed = settings.cgroup != new_cgroup || settings.cpus != new_cpus ||
+                  settings.nice != nice ||
+                  settings.memory_limit_mb != memory_limit_mb;
+
+        settings.path = path ? path : "";
+        settings.cgroup = new_cgroup;
+        settings.cpus = new_cpus;
+        settings.nice = nice;
+        settings.memory_limit_mb = memory_limit_mb;
+    }
+
+    if (changed) {
+        helper_restart();
+    }
+}
+
+#if defined(__linux__)
+
+static int shm_fd = -1;
+static Shm_header *shm = nullptr;
+
+/* <plugin_dir>/gembed_helper, resolved at start */
+static std::string default_path;
+
+static std::mutex monitor_lock;
+static std::condition_variable monitor_cv;
+static std::thread monitor;
+static bool stopping = false;
+static bool restart_requested = false;
+static bool monitor_done = false;
+static bool first_spawned = false;
+static pid_t helper_pid = -1;
+
+/* Pid of the live helper, 0 while there is none; read without the lock */
+static std::atomic<pid_t> running_pid{0};
+
+/*
+ * Generation the live helper serves, and the one of the last helper
+ * reaped. Every helper gets a generation of its own, so a request still
+ * SLOT_RUNNING under a reaped generation is lost, whatever its pid now is.
+ */
+static uint32_t helper_generation = 0;
+static std::atomic<uint32_t> dead_generation{0};
+
+/* Workers sleeping in claim_slot() */
+static std::atomic<unsigned int> slot_waiters{0};
+
+static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+/* Called with monitor_lock held. Makes the current helper finish and exit */
+static void end_generation() {
+    shm->generation.fetch_add(1);
+    shm_futex_wake(&shm->generation);
+    for (uint32_t i = 0; i < shm->n_slots; i++) {
+        shm_futex_wake(&shm->slots[i].state);
+    }
+}
+
+/* Called with monitor_lock held. Returns the new process id, or -1 */
+static pid_t spawn_helper() {
+    Helper_settings current;
+    {
+        std::lock_guard<std::mutex> guard(settings_lock);
+        current = settings;
+    }
+    std::string path = current.path.empty() ? default_path : current.path;
+
+    // The segment lands on a fixed descriptor; dup2 clears its close-on-exec flag
+    int child_fd = shm_fd == 3 ? 4 : 3;
+    helper_generation = shm->generation.load();
+
+    std::vector<std::string> args = {
+        path,
+        "--fd", std::to_string(child_fd),
+        "--generation", std::to_string(helper_generation),
+        "--parent", std::to_string(getpid()),
+        "--nice", std::to_string(current.nice)};
+    if (!current.cpus.empty()) {
+        args.insert(args.end(), {"--cpus", current.cpus});
+    }
+    if (!current.cgroup.empty()) {
+        args.insert(args.end(), {"--cgroup", current.cgroup});
+    }
+    if (current.memory_limit_mb > 0) {
+        args.insert(args.end(), {"--memory-limit-mb",
+                                 std::to_string(current.memory_limit_mb)});
+    }
+
+    std::vector<char *> argv;
+    for (std::string &arg : args) {
+        argv.push_back(&arg[0]);
+    }
+    argv.push_back(nullptr);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, shm_fd, child_fd);
+
+    pid_t pid = -1;
+    int err = posix_spawn(&pid, path.c_str(), &actions, nullptr, argv.data(),
+                          environ);
+    posix_spawn_file_actions_destroy(&actions);
+
+    if (err != 0) {
+        char msg[512];
+        snprintf(msg, sizeof(msg), "cannot start inference helper %s: %s",
+                 path.c_str(), strerror(err));
+        log_message(ERROR_LEVEL, msg);
+        return -1;
+    }
+
+    running_pid.store(pid);
+    gembed_status.helper_pid.store(pid, std::memory_order_relaxed);
+    return pid;
+}
+
+/*
+ * Starts the helper, then reaps it and starts a new one until
+ * helper_stop(). Every helper is spawned from this thread: the helper's
+ * PR_SET_PDEATHSIG fires when the thread that spawned it exits, and the
+ * thread that installs the component may be a client connection's.
+ */
+static void monitor_helper() {
+    std::unique_lock<std::mutex> guard(monitor_lock);
+
+    helper_pid = spawn_helper();
+    first_spawned = true;
+    monitor_cv.notify_all();
+
+    while (!stopping && helper_pid > 0) {
+        pid_t pid = helper_pid;
+        auto started = std::chrono::steady_clock::now();
+        guard.unlock();
+
+        int status = 0;
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+        }
+
+        guard.lock();
+        helper_pid = -1;
+        running_pid.store(0);
+        gembed_status.helper_pid.store(0, std::memory_order_relaxed);
+        dead_generation.store(helper_generation);
+        if (stopping) {
+            break;
+        }
+
+        // A crashed helper left its generation current; its successor needs a new one
+        if (shm->generation.load() == helper_generation) {
+            end_generation();
+        }
+
+        if (!restart_requested) {
+            char msg[128];
+            if (WIFSIGNALED(status)) {
+                snprintf(msg, sizeof(msg),
+                         "inference helper %d killed by signal %d, restarting",
+                         static_cast<int>(pid), WTERMSIG(status));
+            } else {
+                snprintf(msg, sizeof(msg),
+                         "inference helper %d exited with status %d, restarting",
+                         static_cast<int>(pid), WEXITSTATUS(status));
+            }
+            log_message(ERROR_LEVEL, msg);
+
+            // Do not spin on a helper that dies at startup
+            if (std::chrono::steady_clock::now() - started < std::chrono::seconds(1)) {
+                monitor_cv.wait_for(guard, std::chrono::seconds(1),
+                                    [] { return stopping; });
+            }
+        }
+        restart_requested = false;
+
+        while (!stopping && (helper_pid = spawn_helper()) < 0) {
+            monitor_cv.wait_for(guard, std::chrono::seconds(1),
+                                [] { return stopping; });
+        }
+        if (helper_pid > 0) {
+            gembed_status.helper_restarts.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    monitor_done = true;
+    monitor_cv.notify_all();
+}
+
+static void close_segment() {
+    if (shm) {
+        munmap(shm, sizeof(Shm_header));
+        shm = nullptr;
+    }
+    if (shm_fd >= 0) {
+        close(shm_fd);
+        shm_fd = -1;
+    }
+}
+
+static void resolve_default_path() {
+    char buf[4096];
+    char *value = buf;
+    size_t len = sizeof(buf) - 1;
+
+    default_path = "gembed_helper";
+    if (!mysql_service_component_sys_variable_register->get_variable(
+            "mysql_server", "plugin_dir", reinterpret_cast<void **>(&value),
+            &len)) {
+        std::string dir(value, len);
+        if (!dir.empty() && dir.back() != '/') {
+            dir.push_back('/');
+        }
+        default_path = dir + "gembed_helper";
+    }
+}
+
+bool helper_start() {
+    if (!gembed_out_of_process) {
+        return false;
+    }
+
+    resolve_default_path();
+
+    shm_fd = memfd_create("gembed_helper", MFD_CLOEXEC);
+    if (shm_fd < 0 || ftruncate(shm_fd, sizeof(Shm_header)) != 0) {
+        log_message(ERROR_LEVEL, "cannot create shared memory for the inference helper");
+        close_segment();
+        return true;
+    }
+
+    void *mapping = mmap(nullptr, sizeof(Shm_header), PROT_READ | PROT_WRITE,
+                         MAP_SHARED, shm_fd, 0);
+    if (mapping == MAP_FAILED) {
+        log_message(ERROR_LEVEL, "cannot map shared memory for the inference helper");
+        close_segment();
+        return true;
+    }
+
+    // A fresh memfd is zero filled: every slot starts SLOT_FREE
+    shm = static_cast<Shm_header *>(mapping);
+    shm->magic = GEMBED_SHM_MAGIC;
+    shm->version = GEMBED_SHM_VERSION;
+    shm->n_slots = HELPER_SLOTS;
+    shm->generation.store(1);
+
+    std::unique_lock<std::mutex> guard(monitor_lock);
+    stopping = false;
+    restart_requested = false;
+    monitor_done = false;
+    first_spawned = false;
+    helper_pid = -1;
+
+    try {
+        monitor = std::thread(monitor_helper);
+    } catch (const std::system_error &) {
+        log_message(ERROR_LEVEL, "failed to start the inference helper monitor");
+        guard.unlock();
+        close_segment();
+        return true;
+    }
+
+    // The monitor spawns the first helper; a failure ends it at once
+    monitor_cv.wait(guard, [] { return first_spawned; });
+    if (helper_pid < 0) {
+        guard.unlock();
+        monitor.join();
+        close_segment();
+        return true;
+    }
+
+    char msg[128];
+    snprintf(msg, sizeof(msg), "inference runs in helper process %d",
+             static_cast<int>(helper_pid));
+    log_message(INFORMATION_LEVEL, msg);
+
+    active.store(true, std::memory_order_release);
+    return false;
+}
+
+void helper_stop() {
+    if (!active.exchange(false)) {
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> guard(monitor_lock);
+        stopping = true;
+        end_generation();
+        monitor_cv.notify_all();
+
+        if (!monitor_cv.wait_for(guard, std::chrono::seconds(5),
+                                 [] { return monitor_done; }) &&
+            helper_pid > 0) {
+            log_message(WARNING_LEVEL, "inference helper did not exit, killing it");
+            kill(helper_pid, SIGKILL);
+        }
+    }
+
+    monitor.join();
+    close_segment();
+}
+
+bool helper_restart() {
+    if (!helper_active()) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> guard(monitor_lock);
+    if (stopping || helper_pid < 0) {
+        return false;
+    }
+    restart_requested = true;
+    end_generation();
+    return true;
+}
+
+static Shm_slot *claim_slot() {
+    static std::atomic<uint32_t> next_slot{0};
+    uint32_t start = next_slot.fetch_add(1, std::memory_order_relaxed);
+
+    for (;;) {
+        uint32_t seq = shm->free_seq.load();
+        for (uint32_t i = 0; i < shm->n_slots; i++) {
+            Shm_slot *slot = &shm->slots[(start + i) % shm->n_slots];
+            uint32_t expected = SLOT_FREE;
+            if (slot->state.load(std::memory_order_relaxed) == SLOT_FREE &&
+                slot->state.compare_exchange_strong(expected, SLOT_CLAIMED)) {
+                return slot;
+            }
+        }
+
+        slot_waiters.fetch_add(1);
+        shm_futex_wait(&shm->free_seq, seq, 10000);
+        slot_waiters.fetch_sub(1);
+    }
+}
+
+static void release_slot(Shm_slot *slot) {
+    slot->state.store(SLOT_FREE, std::memory_order_release);
+    shm->free_seq.fetch_add(1);
+    if (slot_waiters.load() > 0) {
+        shm_futex_wake(&shm->free_seq);
+    }
+}
+
+/*
+ * Waits for the helper to answer the request in slot. Returns its error
+ * code, or -1 if the helper died with the request or none came to take it.
+ */
+static int wait_response(Shm_slot *slot) {
+    // Short requests come back before a futex sleep would pay off
+    for (int spin = 0; spin < 2000; spin++) {
+        if (slot->state.load(std::memory_order_acquire) == SLOT_RESPONSE) {
+            return slot->err;
+        }
+        cpu_relax();
+    }
+
+    std::chrono::steady_clock::time_point orphaned;
+    bool is_orphaned = false;
+
+    for (;;) {
+        uint32_t state = slot->state.load(std::memory_order_acquire);
+        if (state == SLOT_RESPONSE) {
+            return slot->err;
+        }
+
+        if (state == SLOT_RUNNING && slot->runner <= dead_generation.load()) {
+            log_message(ERROR_LEVEL, "inference helper died while running a request");
+            return -1;
+        }
+
+        // Give up on a request no helper is left to take
+        if (state == SLOT_REQUEST && running_pid.load() == 0) {
+            auto now = std::chrono::steady_clock::now();
+            if (!is_orphaned) {
+                orphaned = now;
+                is_orphaned = true;
+            } else if (now - orphaned > std::chrono::seconds(10)) {
+                uint32_t expected = SLOT_REQUEST;
+                if (slot->state.compare_exchange_strong(expected, SLOT_CLAIMED)) {
+                    log_message(ERROR_LEVEL, "no inference helper is running");
+                    return -1;
+                }
+                continue;
+            }
+        } else {
+            is_orphaned = false;
+        }
+
+        shm_futex_wait(&slot->state, state, 50000);
+    }
+}
+
+/* Runs texts in two halves, for inputs or results too large for a slot */
+static int generate_split(int method_id, int model_id, const StringSlice *texts,
+                          size_t n_texts, EmbeddingBatch *out_batch) {
+    if (n_texts < 2) {
+        log_message(ERROR_LEVEL, "text too large for the inference helper");
+        return -1;
+    }
+
+    std::vector<float> vectors;
+    size_t dim = 0;
+    size_t half = n_texts / 2;
+    size_t starts[2] = {0, half};
+    size_t counts[2] = {half, n_texts - half};
+
+    for (int part = 0; part < 2; part++) {
+        InputData input_data{INPUT_TYPE_TEXT, nullptr, 0, texts + starts[part],
+                             counts[part]};
+        EmbeddingBatch batch{};
+        int err = helper_generate(method_id, model_id, &input_data, &batch);
+        if (err != 0) {
+            return err;
+        }
+        if (batch.n_vectors != counts[part] || (dim != 0 && batch.dim != dim)) {
+            helper_release(&batch);
+            return -1;
+        }
+        dim = batch.dim;
+        vectors.insert(vectors.end(), batch.data,
+                       batch.data + batch.n_vectors * batch.dim);
+        helper_release(&batch);
+    }
+
+    out_batch->data = new float[vectors.size()];
+    std::copy(vectors.begin(), vectors.end(), out_batch->data);
+    out_batch->n_vectors = n_texts;
+    out_batch->dim = dim;
+    return 0;
+}
+
+int helper_generate(int method_id, int model_id, const InputData *input,
+                    EmbeddingBatch *out_batch) {
+    *out_batch = EmbeddingBatch{};
+
+    const StringSlice *texts = input->text_data;
+    size_t n_texts = input->n_text;
+
+    size_t needed = n_texts * sizeof(uint64_t);
+    for (size_t i = 0; i < n_texts && needed <= HELPER_SLOT_DATA; i++) {
+        needed += texts[i].len;
+    }
+    if (needed > HELPER_SLOT_DATA) {
+        return generate_split(method_id, model_id, texts, n_texts, out_batch);
+    }
+
+    Shm_slot *slot = claim_slot();
+    slot->method_id = method_id;
+    slot->model_id = model_id;
+    slot->n_texts = n_texts;
+
+    uint64_t *lengths = reinterpret_cast<uint64_t *>(slot->data);
+    unsigned char *bytes = slot->data + n_texts * sizeof(uint64_t);
+    for (size_t i = 0; i < n_texts; i++) {
+        lengths[i] = texts[i].len;
+        if (texts[i].len) {
+            memcpy(bytes, texts[i].ptr, texts[i].len);
+        }
+        bytes += texts[i].len;
+    }
+
+    slot->state.store(SLOT_REQUEST, std::memory_order_release);
+    shm_futex_wake(&slot->state);
+
+    int err = wait_response(slot);
+    if (err == 0) {
+        // The batch points into the slot until helper_release()
+        out_batch->data = reinterpret_cast<float *>(slot->data);
+        out_batch->n_vectors = slot->n_vectors;
+        out_batch->dim = slot->dim;
+        return 0;
+    }
+
+    release_slot(slot);
+    if (err == HELPER_ERR_TOO_BIG) {
+        return generate_split(method_id, model_id, texts, n_texts, out_batch);
+    }
+    return err;
+}
+
+void helper_release(EmbeddingBatch *batch) {
+    unsigned char *data = reinterpret_cast<unsigned char *>(batch->data);
+    unsigned char *slots = reinterpret_cast<unsigned char *>(shm ? shm->slots : nullptr);
+
+    if (!data) {
+        return;
+    }
+
+    if (slots && data >= slots && data < slots + sizeof(shm->slots)) {
+        release_slot(&shm->slots[(data - slots) / sizeof(Shm_slot)]);
+    } else {
+        delete[] batch->data;
+    }
+    *batch = EmbeddingBatch{};
+}
+
+#else
+
+bool helper_start() {
+    if (gembed_out_of_process) {
+        log_message(ERROR_LEVEL, "gembed.out_of_process needs Linux");
+        return true;
+    }
+    return false;
+}
+
+void helper_stop() {
+}
+
+bool helper_restart() {
+    return false;
+}
+
+int helper_generate(int method_id, int model_id, const InputData *input,
+                    EmbeddingBatch *out_batch) {
+    return generate_embeddings(method_id, model_id, input, out_batch);
+}
+
+void helper_release(EmbeddingBatch *batch) {
+    free_embedding_batch(batch);
+}
+
+#endif
+
+bool gembed_restart_helper_init(UDF_INIT *initid, UDF_ARGS *args, char *message) {
+    if (args->arg_count != 0) {
+        snprintf(message, MYSQL_ERRMSG_SIZE, "GEMBED_RESTART_HELPER takes no arguments");
+        return true;
+    }
+
+    initid->maybe_null = false;
+    return false;
+}
+
+long long gembed_restart_helper(UDF_INIT *, UDF_ARGS *, unsigned char *,
+                                unsigned char *) {
+    return helper_restart() ? 1 : 0;
+}
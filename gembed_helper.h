@@ -0,0 +1,70 @@
+/* Copyright (c) 2025, Joel Díaz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+#ifndef GEMBED_HELPER_H
+#define GEMBED_HELPER_H
+
+#include <mysql/udf_registration_types.h>
+#include "mysql_gembed.h"
+
+/*
+ * Out-of-process inference (gembed.out_of_process, Linux only).
+ *
+ * The embedding library runs in a separate gembed_helper process, so a
+ * crash or runaway allocation in it cannot take mysqld down, and the
+ * process can be put in a cgroup or under a memory limit of its own.
+ * Pool workers hand texts over through shared memory slots (gembed_shm.h)
+ * and wait on a futex. The vectors are written into the slot and copied
+ * once from there into the job's results, with nothing serialized between.
+ *
+ * A monitor thread restarts the helper when it dies. Requests it was
+ * running fail, later ones go to the new process. A graceful restart
+ * lets the old process finish its running requests first.
+ */
+
+/* Starts the helper if gembed.out_of_process is set. Returns true on failure */
+bool helper_start();
+
+/* Stops the helper, killing it if it does not exit within a few seconds */
+void helper_stop();
+
+/* True while inference goes to the helper */
+bool helper_active();
+
+/*
+ * Same contract as generate_embeddings(), run in the helper. A successful
+ * batch must be given back with helper_release().
+ */
+int helper_generate(int method_id, int model_id, const InputData *input,
+                    EmbeddingBatch *out_batch);
+
+void helper_release(EmbeddingBatch *batch);
+
+/* Replaces the helper after its running requests. Returns false if none runs */
+bool helper_restart();
+
+/*
+ * Settings for the next helper process. path is empty for
+ * <plugin_dir>/gembed_helper. A change other than the path restarts a
+ * running helper.
+ */
+void helper_configure(const char *path, const char *cgroup, const char *cpus,
+                      int nice, unsigned int memory_limit_mb);
+
+/* UDF: GEMBED_RESTART_HELPER() -> 1 if a restart was started, else 0 */
+bool gembed_restart_helper_init(UDF_INIT *initid, UDF_ARGS *args, char *message);
+long long gembed_restart_helper(UDF_INIT *initid, UDF_ARGS *args,
+                                unsigned char *is_null, unsigned char *error);
+
+#endif /* GEMBED_HELPER_H */
@@ -0,0 +1,239 @@
+/* Copyright (c) 2025, Joel Díaz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+
+/*
+ * gembed_helper: runs the embedding library outside mysqld.
+ *
+ * Started by the component with gembed.out_of_process. It maps the shared
+ * memory segment passed as an inherited descriptor and serves every slot
+ * from its own thread until the component bumps the generation or mysqld
+ * goes away. See gembed_shm.h for the protocol.
+ *
+ *   gembed_helper --fd N --generation G --parent PID
+ *                 [--cpus LIST] [--nice N] [--cgroup DIR] [--memory-limit-mb N]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include "mysql_gembed.h"
+#include "gembed_shm.h"
+
+#if defined(__linux__)
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+
+static std::atomic<bool> parent_gone{false};
+
+static void run_request(Shm_slot *slot) {
+    uint64_t n = slot->n_texts;
+    const uint64_t *lengths = reinterpret_cast<const uint64_t *>(slot->data);
+    const char *bytes = reinterpret_cast<const char *>(slot->data + n * sizeof(uint64_t));
+    const char *end = reinterpret_cast<const char *>(slot->data + HELPER_SLOT_DATA);
+
+    if (n > HELPER_SLOT_DATA / sizeof(uint64_t)) {
+        slot->err = -1;
+        return;
+    }
+
+    // The library reads the texts where the component wrote them
+    std::vector<StringSlice> texts(n);
+    for (uint64_t i = 0; i < n; i++) {
+        if (lengths[i] > static_cast<uint64_t>(end - bytes)) {
+            slot->err = -1;
+            return;
+        }
+        texts[i].ptr = bytes;
+        texts[i].len = lengths[i];
+        bytes += lengths[i];
+    }
+
+    InputData input_data{INPUT_TYPE_TEXT, nullptr, 0, texts.data(), texts.size()};
+    EmbeddingBatch batch{};
+    int err = generate_embeddings(slot->method_id, slot->model_id, &input_data, &batch);
+
+    if (err == 0) {
+        size_t bytes_out = batch.n_vectors * batch.dim * sizeof(float);
+        if (bytes_out > HELPER_SLOT_DATA) {
+            err = HELPER_ERR_TOO_BIG;
+        } else {
+            // Inputs are no longer needed, the vectors go over them
+            memcpy(slot->data, batch.data, bytes_out);
+            slot->n_vectors = batch.n_vectors;
+            slot->dim = static_cast<uint32_t>(batch.dim);
+        }
+    }
+
+    free_embedding_batch(&batch);
+    slot->err = err;
+}
+
+static void serve_slot(Shm_header *shm, Shm_slot *slot, uint32_t generation) {
+    while (shm->generation.load() == generation && !parent_gone.load()) {
+        uint32_t state = slot->state.load(std::memory_order_acquire);
+        if (state != SLOT_REQUEST) {
+            shm_futex_wait(&slot->state, state, 100000);
+            continue;
+        }
+
+        slot->runner = generation;
+        if (!slot->state.compare_exchange_strong(state, SLOT_RUNNING)) {
+            continue;
+        }
+
+        run_request(slot);
+
+        slot->state.store(SLOT_RESPONSE, std::memory_order_release);
+        shm_futex_wake(&slot->state);
+    }
+}
+
+static bool apply_cpus(const char *list) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+
+    const char *p = list;
+    while (*p) {
+        char *next;
+        long first = strtol(p, &next, 10);
+        if (next == p) return false;
+        long last = first;
+        if (*next == '-') {
+            p = next + 1;
+            last = strtol(p, &next, 10);
+            if (next == p) return false;
+        }
+        for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+            if (cpu >= 0) CPU_SET(cpu, &cpus);
+        }
+        p = *next == ',' ? next + 1 : next;
+        if (*next && *next != ',') return false;
+    }
+
+    return sched_setaffinity(0, sizeof(cpus), &cpus) == 0;
+}
+
+static bool join_cgroup(const char *dir) {
+    std::string path = std::string(dir) + "/cgroup.procs";
+    FILE *f = fopen(path.c_str(), "w");
+    if (!f) return false;
+    bool ok = fprintf(f, "%d\n", static_cast<int>(getpid())) > 0;
+    return fclose(f) == 0 && ok;
+}
+
+int main(int argc, char **argv) {
+    int fd = -1;
+    long generation = -1;
+    long parent = -1;
+    const char *cpus = nullptr;
+    const char *cgroup = nullptr;
+    long nice_value = 0;
+    bool has_nice = false;
+    long memory_limit_mb = 0;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        const char *opt = argv[i];
+        const char *val = argv[i + 1];
+        if (!strcmp(opt, "--fd")) fd = atoi(val);
+        else if (!strcmp(opt, "--generation")) generation = atol(val);
+        else if (!strcmp(opt, "--parent")) parent = atol(val);
+        else if (!strcmp(opt, "--cpus")) cpus = val;
+        else if (!strcmp(opt, "--cgroup")) cgroup = val;
+        else if (!strcmp(opt, "--nice")) { nice_value = atol(val); has_nice = true; }
+        else if (!strcmp(opt, "--memory-limit-mb")) memory_limit_mb = atol(val);
+    }
+
+    if (fd < 0 || generation < 0 || parent <= 0) {
+        fprintf(stderr, "gembed_helper: started without --fd, --generation and --parent\n");
+        return 2;
+    }
+
+    // Never outlive the server. The signal follows the spawning thread, which
+    // is the server's long-lived helper monitor; the polling below covers the rest
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    if (getppid() != parent) {
+        return 1;
+    }
+
+    // Confinement happens before any library thread exists, so they inherit it
+    if (cgroup && *cgroup && !join_cgroup(cgroup)) {
+        fprintf(stderr, "gembed_helper: cannot join cgroup %s\n", cgroup);
+    }
+    if (cpus && *cpus && !apply_cpus(cpus)) {
+        fprintf(stderr, "gembed_helper: cannot apply CPU list %s\n", cpus);
+    }
+    if (has_nice && setpriority(PRIO_PROCESS, 0, static_cast<int>(nice_value)) != 0) {
+        fprintf(stderr, "gembed_helper: cannot set nice value %ld\n", nice_value);
+    }
+    if (memory_limit_mb > 0) {
+        struct rlimit limit;
+        limit.rlim_cur = limit.rlim_max = static_cast<rlim_t>(memory_limit_mb) * 1024 * 1024;
+        setrlimit(RLIMIT_AS, &limit);
+    }
+
+    void *mapping = mmap(nullptr, sizeof(Shm_header), PROT_READ | PROT_WRITE,
+                         MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "gembed_helper: cannot map shared memory\n");
+        return 1;
+    }
+    close(fd);
+
+    Shm_header *shm = static_cast<Shm_header *>(mapping);
+    if (shm->magic != GEMBED_SHM_MAGIC || shm->version != GEMBED_SHM_VERSION ||
+        shm->n_slots > HELPER_SLOTS) {
+        fprintf(stderr, "gembed_helper: shared memory version mismatch\n");
+        return 1;
+    }
+
+    uint32_t my_generation = static_cast<uint32_t>(generation);
+    std::vector<std::thread> threads;
+    for (uint32_t i = 0; i < shm->n_slots; i++) {
+        threads.emplace_back(serve_slot, shm, &shm->slots[i], my_generation);
+    }
+
+    while (shm->generation.load() == my_generation) {
+        if (getppid() != parent) {
+            parent_gone.store(true);
+            break;
+        }
+        shm_futex_wait(&shm->generation, my_generation, 100000);
+    }
+
+    // Slot threads finish the request they hold, then see the new generation
+    for (uint32_t i = 0; i < shm->n_slots; i++) {
+        shm_futex_wake(&shm->slots[i].state);
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+
+    return 0;
+}
+
+#else
+
+int main() {
+    fprintf(stderr, "gembed_helper: out-of-process inference needs Linux\n");
+    return 1;
+}
+
+#endif
@@ -0,0 +1,91 @@
+/* Copyright (c) 2025, Joel Díaz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+#ifndef GEMBED_JSON_H
+#define GEMBED_JSON_H
+
+#include <cstdlib>
+#include <string>
+
+/*
+ * Minimal reader for the small JSON objects given as options and settings.
+ * Values are scalars; callers walk nested objects with consume().
+ */
+
+/* A scalar JSON value: strings keep their text, numbers their value */
+struct Option_value {
+    bool is_string = false;
+    std::string text;
+    double number = 0;
+};
+
+struct Option_parser {
+    const char *p;
+    const char *end;
+
+    void skip_ws() {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
+    }
+
+    bool consume(char c) {
+        skip_ws();
+        if (p < end && *p == c) {
+            p++;
+            return true;
+        }
+        return false;
+    }
+
+    bool parse_string(std::string &out) {
+        skip_ws();
+        if (p >= end || *p != '"') return false;
+        p++;
+
+        while (p < end && *p != '"') {
+            if (*p == '\\' && p + 1 < end) p++;
+            out.push_back(*p++);
+        }
+        if (p >= end) return false;
+        p++;
+        return true;
+    }
+
+    bool parse_value(Option_value &out) {
+        skip_ws();
+        if (p >= end) return false;
+
+        if (*p == '"') {
+            out.is_string = true;
+            return parse_string(out.text);
+        }
+
+        const char *start = p;
+        while (p < end && *p != ',' && *p != '}' && *p != ' ' &&
+               *p != '\t' && *p != '\n' && *p != '\r') {
+            p++;
+        }
+        out.text.assign(start, p - start);
+
+        if (out.text == "true" || out.text == "false") {
+            out.number = out.text == "true";
+            return true;
+        }
+
+        char *num_end;
+        out.number = strtod(out.text.c_str(), &num_end);
+        return !out.text.empty() && *num_end == '\0';
+    }
+};
+
+#endif /* GEMBED_JSON_H */
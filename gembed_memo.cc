@@ -0,0 +1,58 @@
+/* Copyright (c) 2025, Joel Díaz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+
+#include "gembed_memo.h"
+
+#include <cstring>
+#include "gembed_hash.h"
+#include "gembed_vars.h"
+
+static uint64_t memo_key(const Model_entry *model, const char *text, size_t len) {
+    return xxh64(text, len, reinterpret_cast<uintptr_t>(model));
+}
+
+Statement_memo::~Statement_memo() {
+    gembed_status.memo_hits.fetch_add(hits, std::memory_order_relaxed);
+}
+
+const float *Statement_memo::find(const Model_entry *model, const char *text,
+                                  size_t len, size_t *dim) {
+    if (entries.empty()) {
+        return nullptr;
+    }
+
+    auto it = entries.find(memo_key(model, text, len));
+    if (it == entries.end() || it->second.model != model ||
+        it->second.text.size() != len ||
+        memcmp(it->second.text.data(), text, len) != 0) {
+        return nullptr;
+    }
+
+    hits++;
+    *dim = it->second.vec.size();
+    return it->second.vec.data();
+}
+
+void Statement_memo::add(const Model_entry *model, const char *text, size_t len,
+                         const float *vec, size_t dim) {
+    if (entries.size() >= gembed_statement_memo_entries) {
+        return;
+    }
+
+    // A colliding text keeps the slot it found first
+    entries.emplace(memo_key(model, text, len),
+                    Entry{model, std::string(text, len),
+                          std::vector<float>(vec, vec + dim)});
+}
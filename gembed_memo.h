@@ -0,0 +1,58 @@
+/* Copyright (c) 2025, Joel Díaz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+#ifndef GEMBED_MEMO_H
+#define GEMBED_MEMO_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "gembed_models.h"
+
+/*
+ * Memo of the vectors produced by one EMBED_TEXT or EMBED_TEXTS call site,
+ * owned by its UDF_INIT and dropped at the end of the statement.
+ *
+ * Columns like a category or a status repeat a few distinct values over
+ * millions of rows; with the memo each value reaches the shared caches and
+ * the model once per statement. A UDF_INIT is only ever used by the thread
+ * running its statement, so there is no locking. At most
+ * gembed.statement_memo_entries values are kept, first come first served.
+ */
+class Statement_memo {
+  public:
+    ~Statement_memo();
+
+    /* Returns the vector of text under model and sets *dim, or NULL on a miss */
+    const float *find(const Model_entry *model, const char *text, size_t len,
+                      size_t *dim);
+
+    /* Remembers a vector, unless the memo is full */
+    void add(const Model_entry *model, const char *text, size_t len,
+             const float *vec, size_t dim);
+
+  private:
+    struct Entry {
+        const Model_entry *model;
+        std::string text;
+        std::vector<float> vec;
+    };
+
+    std::unordered_map<uint64_t, Entry> entries;
+    long long hits = 0;  /* added to gembed.memo_hits once, at the end */
+};
+
+#endif /* GEMBED_MEMO_H */
@@ -0,0 +1,178 @@
+/* Copyright (c) 2025, Joel Díaz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+
+#include "gembed_models.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+#include "mysql_gembed.h"
+#include "gembed_hash.h"
+#include "gembed_pool.h"
+#include "gembed_remote.h"
+#include "gembed_vars.h"
+
+/* Keyed by method and model name, separated by a NUL */
+static std::shared_mutex registry_lock;
+static std::unordered_map<std::string, std::unique_ptr<Model_entry>> registry;
+
+/* Remote models have no library id, they are numbered as they are seen */
+static int next_remote_model_id = 0;
+
+static std::string registry_key(const char *method, const char *model) {
+    std::string key(method);
+    key.push_back('\0');
+    key.append(model);
+    return key;
+}
+
+Model_entry *model_registry_get(const char *method, const char *model,
+                                char *err, size_t err_size) {
+    std::string key = registry_key(method, model);
+
+    {
+        std::shared_lock<std::shared_mutex> guard(registry_lock);
+        auto it = registry.find(key);
+        if (it != registry.end()) {
+            return it->second.get();
+        }
+    }
+
+    bool remote = strcmp(method, REMOTE_METHOD) == 0;
+    int method_id = REMOTE_METHOD_ID;
+    int model_id = 0;
+
+    if (remote) {
+        if (remote_check_model(model, err, err_size)) {
+            return nullptr;
+        }
+    } else {
+        method_id = validate_embedding_method(method);
+        if (method_id < 0) {
+            snprintf(err, err_size, "Invalid embedding method");
+            return nullptr;
+        }
+
+        model_id = validate_embedding_model(method_id, model, INPUT_TYPE_TEXT);
+        if (model_id < 0) {
+            snprintf(err, err_size, "Invalid or unsupported model");
+            return nullptr;
+        }
+    }
+
+    std::unique_lock<std::shared_mutex> guard(registry_lock);
+    std::unique_ptr<Model_entry> &slot = registry[key];
+    if (!slot) {
+        slot = std::make_unique<Model_entry>();
+        slot->method_id = method_id;
+        slot->model_id = remote ? next_remote_model_id++ : model_id;
+        slot->method = method;
+        slot->model = model;
+    }
+    return slot.get();
+}
+
+unsigned int model_batch_size(const Model_entry *model) {
+    unsigned int ceiling = std::max(1U, gembed_max_batch_size);
+    return gembed_adaptive_batching ? model->tuner.batch_size(ceiling) : ceiling;
+}
+
+unsigned int model_wait_us(const Model_entry *model) {
+    return gembed_adaptive_batching ? model->tuner.wait_us(gembed_max_wait_us)
+                                    : gembed_max_wait_us;
+}
+
+uint64_t model_fingerprint(Model_entry *model) {
+    uint64_t known = model->fingerprint.load(std::memory_order_acquire);
+    if (known) {
+        return known;
+    }
+
+    std::lock_guard<std::mutex> guard(model->fingerprint_lock);
+    known = model->fingerprint.load(std::memory_order_relaxed);
+    if (known) {
+        return known;
+    }
+
+    static const char probe[] = "The quick brown fox jumps over the lazy dog.";
+    StringSlice text{probe, sizeof(probe) - 1};
+
+    Inference_job job;
+    job.model = model;
+    job.texts = &text;
+    job.n_texts = 1;
+    inference_pool_run(&job, 1, PRIORITY_INTERACTIVE);
+    if (job.err != 0 || job.dim == 0) {
+        return 0;
+    }
+
+    // Rounded to absorb run-to-run noise on one host. Across hosts it is no
+    // help: any component near a rounding step flips on the last-bit
+    // differences of another CPU's kernels or another library build
+    std::vector<int32_t> rounded(job.dim);
+    for (size_t i = 0; i < job.dim; i++) {
+        rounded[i] = static_cast<int32_t>(lrintf(job.vectors[i] * 4096.0f));
+    }
+
+    uint64_t seed = xxh64(model->method.data(), model->method.size(), 0);
+    seed = xxh64(model->model.data(), model->model.size(), seed);
+    uint64_t fingerprint = xxh64(rounded.data(), rounded.size() * sizeof(int32_t), seed);
+    if (fingerprint == 0) {
+        fingerprint = 1;
+    }
+
+    model->fingerprint.store(fingerprint, std::memory_order_release);
+    return fingerprint;
+}
+
+int model_adaptive_state(MYSQL_THD, SHOW_VAR *var, char *buf) {
+    size_t len = 0;
+    buf[0] = '\0';
+
+    {
+        std::shared_lock<std::shared_mutex> guard(registry_lock);
+        for (const auto &item : registry) {
+            const Model_entry *entry = item.second.get();
+            int written = snprintf(
+                buf + len, SHOW_VAR_FUNC_BUFF_SIZE - len,
+                "%s%s/%s:batch=%u,wait_us=%u,p99_us=%llu", len ? ";" : "",
+                entry->method.c_str(), entry->model.c_str(),
+                model_batch_size(entry), model_wait_us(entry),
+                static_cast<unsigned long long>(entry->tuner.p99_us()));
+
+            // Models that do not fit are left out rather than cut in half
+            if (written < 0 || len + written >= SHOW_VAR_FUNC_BUFF_SIZE) {
+                buf[len] = '\0';
+                break;
+            }
+            len += written;
+        }
+    }
+
+    var->type = SHOW_CHAR;
+    var->value = buf;
+    return 0;
+}
+
+void model_registry_clear() {
+    std::unique_lock<std::shared_mutex> guard(registry_lock);
+    registry.clear();
+}
@@ -0,0 +1,76 @@
+/* Copyright (c) 2025, Joel Díaz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+#ifndef GEMBED_MODELS_H
+#define GEMBED_MODELS_H
+
+#include <mysql/components/services/status_variable_registration.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include "gembed_tuner.h"
+
+/*
+ * Registry of the (method, model) pairs seen since the component started.
+ * Entries hold per-model state and are only freed at shutdown, so pointers
+ * to them stay valid while the component is loaded.
+ */
+struct Model_entry {
+    int method_id = 0;
+    int model_id = 0;
+    std::string method;
+    std::string model;
+
+    Batch_controller tuner;
+
+    /* See model_fingerprint(); 0 until computed */
+    std::atomic<uint64_t> fingerprint{0};
+    std::mutex fingerprint_lock;
+};
+
+/*
+ * Returns the entry for method and model, validating them with the library
+ * (or the inference server, for the remote method) the first time they are
+ * seen. Returns NULL and fills err on failure.
+ */
+Model_entry *model_registry_get(const char *method, const char *model,
+                                char *err, size_t err_size);
+
+/* Sub-batch size for the model: tuned with gembed.adaptive_batching */
+unsigned int model_batch_size(const Model_entry *model);
+
+/* Batch fill wait for the model: tuned with gembed.adaptive_batching */
+unsigned int model_wait_us(const Model_entry *model);
+
+/*
+ * Identifies the weights behind a model name, so that vectors stored on disk
+ * are not served after the model changes under the same name. Computed once
+ * per entry by embedding a fixed probe text. The value depends on the CPU
+ * kernels and library build as well as the weights, so it is only stable on
+ * one host. Returns 0 if that fails.
+ */
+uint64_t model_fingerprint(Model_entry *model);
+
+/*
+ * SHOW_FUNC for gembed.adaptive_state: the tuned batch size, wait and p99
+ * of every model, as "method/model:batch=N,wait_us=N,p99_us=N;..."
+ */
+int model_adaptive_state(MYSQL_THD thd, SHOW_VAR *var, char *buf);
+
+/* Frees every entry */
+void model_registry_clear();
+
+#endif /* GEMBED_MODELS_H */
@@ -0,0 +1,148 @@
+/* Copyright (c) 2025, Joel Díaz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+
+#include "gembed_options.h"
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <utility>
+#include "gembed_json.h"
+#include "gembed_quantize.h"
+
+/* Decodes hex digits, as HEX() writes them, into out. Returns false if text is not hex */
+static bool decode_hex(const std::string &text, std::string *out) {
+    if (text.size() % 2 != 0) {
+        return false;
+    }
+    out->resize(text.size() / 2);
+    for (size_t i = 0; i < text.size(); i++) {
+        char c = text[i];
+        int digit = c >= '0' && c <= '9'   ? c - '0'
+                    : c >= 'A' && c <= 'F' ? c - 'A' + 10
+                    : c >= 'a' && c <= 'f' ? c - 'a' + 10
+                                           : -1;
+        if (digit < 0) {
+            return false;
+        }
+        if (i % 2 == 0) {
+            (*out)[i / 2] = static_cast<char>(digit << 4);
+        } else {
+            (*out)[i / 2] = static_cast<char>((*out)[i / 2] | digit);
+        }
+    }
+    return true;
+}
+
+static bool apply_option(const std::string &key, const Option_value &value,
+                         Embed_options *opts, char *err, size_t err_size) {
+    if (key == "priority") {
+        if (value.is_string && value.text == "interactive") {
+            opts->priority = PRIORITY_INTERACTIVE;
+        } else if (value.is_string && value.text == "bulk") {
+            opts->priority = PRIORITY_BULK;
+        } else {
+            snprintf(err, err_size, "priority must be \"interactive\" or \"bulk\"");
+            return true;
+        }
+        return false;
+    }
+
+    if (key == "output") {
+        if (value.is_string && value.text == "float32") {
+            opts->output = OUTPUT_FLOAT32;
+        } else if (value.is_string && value.text == "int8") {
+            opts->output = OUTPUT_INT8;
+        } else if (value.is_string && value.text == "binary") {
+            opts->output = OUTPUT_BINARY;
+        } else if (value.is_string && value.text == "fp16") {
+            opts->output = OUTPUT_FP16;
+        } else if (value.is_string && value.text == "bf16") {
+            opts->output = OUTPUT_BF16;
+        } else {
+            snprintf(err, err_size,
+                     "output must be \"float32\", \"fp16\", \"bf16\", \"int8\" or \"binary\"");
+            return true;
+        }
+        return false;
+    }
+
+    if (key == "dims") {
+        if (value.is_string || value.number < 1 || value.number > 65535 ||
+            value.number != static_cast<unsigned int>(value.number)) {
+            snprintf(err, err_size, "dims must be a positive number of dimensions");
+            return true;
+        }
+        opts->dims = static_cast<unsigned int>(value.number);
+        return false;
+    }
+
+    if (key == "calibration") {
+        std::string bytes;
+        auto ranges = std::make_shared<Int8_ranges>();
+        if (!value.is_string || !decode_hex(value.text, &bytes) ||
+            !int8_calibration_read(bytes.data(), bytes.size(), ranges.get())) {
+            snprintf(err, err_size,
+                     "calibration must be the HEX() of a GEMBED_CALIBRATE result");
+            return true;
+        }
+        opts->ranges = std::move(ranges);
+        return false;
+    }
+
+    snprintf(err, err_size, "Unknown option '%s'", key.c_str());
+    return true;
+}
+
+bool parse_embed_options(const char *json, size_t len, Embed_options *opts,
+                         char *err, size_t err_size) {
+    Option_parser parser{json, json + len};
+
+    if (!parser.consume('{')) {
+        snprintf(err, err_size, "Options must be a JSON object");
+        return true;
+    }
+
+    if (parser.consume('}')) {
+        return false;
+    }
+
+    do {
+        std::string key;
+        Option_value value;
+
+        if (!parser.parse_string(key) || !parser.consume(':') ||
+            !parser.parse_value(value)) {
+            snprintf(err, err_size, "Malformed options object");
+            return true;
+        }
+
+        if (apply_option(key, value, opts, err, err_size)) {
+            return true;
+        }
+    } while (parser.consume(','));
+
+    if (!parser.consume('}')) {
+        snprintf(err, err_size, "Malformed options object");
+        return true;
+    }
+
+    if (opts->ranges && opts->output != OUTPUT_INT8) {
+        snprintf(err, err_size, "calibration requires \"output\": \"int8\"");
+        return true;
+    }
+
+    return false;
+}
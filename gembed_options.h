@@ -0,0 +1,46 @@
+/* Copyright (c) 2025, Joel Díaz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+#ifndef GEMBED_OPTIONS_H
+#define GEMBED_OPTIONS_H
+
+#include <cstddef>
+#include <memory>
+#include "gembed_pool.h"
+
+struct Int8_ranges;
+
+/* Format of the vectors returned, see gembed_quantize.h */
+enum Output_format { OUTPUT_FLOAT32, OUTPUT_INT8, OUTPUT_BINARY, OUTPUT_FP16, OUTPUT_BF16 };
+
+/*
+ * Per-call options, given to EMBED_TEXT and EMBED_TEXTS as an optional
+ * trailing JSON object, e.g. '{"priority": "bulk"}'.
+ */
+struct Embed_options {
+    Inference_priority priority = PRIORITY_INTERACTIVE;
+    Output_format output = OUTPUT_FLOAT32;
+    unsigned int dims = 0;    /* leading dimensions kept, renormalized; 0 = all */
+    /* int8 over per-dimension ranges, from the calibration option; NULL if none */
+    std::shared_ptr<const Int8_ranges> ranges;
+};
+
+/*
+ * Parses a JSON object of options into opts. Keys that are absent keep the
+ * value already in opts. On failure writes a message to err and returns true.
+ */
+bool parse_embed_options(const char *json, size_t len, Embed_options *opts,
+                         char *err, size_t err_size);
+
+#endif /* GEMBED_OPTIONS_H */
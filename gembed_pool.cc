@@ -0,0 +1,923 @@
+/* Copyright (c) 2025, Joel Díaz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+
+#include "gembed_pool.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include "gembed_helper.h"
+#include "gembed_models.h"
+#include "gembed_remote.h"
+#include "gembed_services.h"
+#include "gembed_vars.h"
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(__APPLE__)
+#include <sys/sysctl.h>
+#endif
+
+/*
+ * CPU affinity and nice value of a thread. MySQL applies resource groups to
+ * the OS thread this way, so copying them carries the group over.
+ */
+struct Thread_placement {
+    bool valid = false;
+#if defined(__linux__)
+    cpu_set_t cpus;
+#endif
+    int nice = 0;
+};
+
+/* Completion shared by the jobs of one inference_pool_run() call */
+struct Inference_group {
+    std::mutex lock;
+    std::condition_variable done;
+    size_t pending = 0;
+
+    /* The caller's placement, valid with gembed.inherit_resource_group */
+    Thread_placement placement;
+
+    Inference_priority priority = PRIORITY_BULK;
+    std::chrono::steady_clock::time_point queued_at;
+};
+
+/*
+ * A group of workers with its own queues, one per priority class. Without
+ * NUMA awareness there is a single node; with it there is one per NUMA
+ * node, its workers pinned to that node's CPUs.
+ */
+struct Pool_node {
+    int os_node = -1;       /* NUMA node number, -1 when not NUMA aware */
+    std::vector<int> cpus;  /* CPUs the workers are pinned to, empty = any */
+
+    std::deque<Inference_job *> queues[PRIORITY_CLASSES];
+    int bulk_credit = 0;  /* percent points earned towards the next bulk turn */
+    std::condition_variable wakeup;           /* idle workers */
+    std::condition_variable coalesce_wakeup;  /* workers waiting to fill a batch */
+    unsigned int coalescing_workers = 0;
+
+    std::vector<std::thread> threads;
+    unsigned int target = 0;  /* workers with a higher index exit */
+
+    /* Utilization, exported as gembed.numa_node<N>_* */
+    status_counter jobs{0};
+    status_counter texts{0};
+    status_counter busy_us{0};
+    status_counter n_threads{0};
+};
+
+/* Protects the queues, targets and flags of every node */
+static std::mutex pool_lock;
+static std::vector<std::unique_ptr<Pool_node>> pool_nodes;
+static std::vector<int> cpu_to_node;  /* CPU number -> index in pool_nodes */
+static bool pool_running = false;
+static bool pool_stopping = false;
+
+/* Serializes start, stop and resize */
+static std::mutex resize_lock;
+
+/* Copy of gembed.inference_cpus, bumped generation tells workers to re-pin */
+static std::mutex placement_lock;
+static std::string inference_cpus;
+static std::atomic<unsigned int> placement_generation{0};
+
+/* Per-node status variables, registered only in NUMA mode */
+static std::vector<std::string> numa_status_names;
+static std::vector<SHOW_VAR> numa_status_vars;
+
+unsigned int physical_core_count() {
+    unsigned int logical = std::max(1U, std::thread::hardware_concurrency());
+
+#if defined(__linux__)
+    // Count distinct (package, core) pairs among the CPUs we may run on
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return logical;
+    }
+
+    std::set<std::pair<int, int>> cores;
+    long n_cpus = sysconf(_SC_NPROCESSORS_CONF);
+
+    for (long cpu = 0; cpu < n_cpus && cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed)) {
+            continue;
+        }
+
+        char path[128];
+        int package = -1;
+        int core = -1;
+
+        snprintf(path, sizeof(path),
+                 "/sys/devices/system/cpu/cpu%ld/topology/physical_package_id", cpu);
+        if (FILE *f = fopen(path, "r")) {
+            if (fscanf(f, "%d", &package) != 1) package = -1;
+            fclose(f);
+        }
+
+        snprintf(path, sizeof(path),
+                 "/sys/devices/system/cpu/cpu%ld/topology/core_id", cpu);
+        if (FILE *f = fopen(path, "r")) {
+            if (fscanf(f, "%d", &core) != 1) core = -1;
+            fclose(f);
+        }
+
+        if (core < 0) {
+            return std::min(logical, static_cast<unsigned int>(CPU_COUNT(&allowed)));
+        }
+        cores.emplace(package, core);
+    }
+
+    return cores.empty() ? logical : static_cast<unsigned int>(cores.size());
+#elif defined(__APPLE__)
+    int physical = 0;
+    size_t size = sizeof(physical);
+    if (sysctlbyname("hw.physicalcpu", &physical, &size, nullptr, 0) == 0 &&
+        physical > 0) {
+        return static_cast<unsigned int>(physical);
+    }
+    return logical;
+#else
+    return logical;
+#endif
+}
+
+static void complete_job(Inference_job *job) {
+    Inference_group *group = job->group;
+
+    // Notify under the lock: the waiter owns the group and may free it
+    // as soon as it sees pending reach zero
+    std::lock_guard<std::mutex> guard(group->lock);
+    if (--group->pending == 0) {
+        group->done.notify_all();
+    }
+}
+
+/* Runs a group of jobs for the same model as one library call */
+static void run_group(Pool_node *node, const std::vector<Inference_job *> &group) {
+    const Inference_job *first = group.front();
+    const StringSlice *texts = first->texts;
+    size_t n_texts = first->n_texts;
+    std::vector<StringSlice> merged;
+
+    if (group.size() > 1) {
+        for (const Inference_job *job : group) {
+            merged.insert(merged.end(), job->texts, job->texts + job->n_texts);
+        }
+        texts = merged.data();
+        n_texts = merged.size();
+        gembed_status.pool_coalesced_jobs.fetch_add(group.size() - 1,
+                                                    std::memory_order_relaxed);
+    }
+
+    InputData input_data{
+        INPUT_TYPE_TEXT,
+        nullptr,
+        0,
+        texts,
+        n_texts
+    };
+
+    auto started = std::chrono::steady_clock::now();
+
+    // Checked once: the batch goes back to whoever produced it
+    Model_entry *model = first->model;
+    bool remote = model->method_id == REMOTE_METHOD_ID;
+    bool on_helper = !remote && helper_active();
+
+    EmbeddingBatch batch{};
+    int err = remote ? remote_generate(model->model, &input_data, &batch)
+              : on_helper ? helper_generate(model->method_id, model->model_id,
+                                            &input_data, &batch)
+                          : generate_embeddings(model->method_id, model->model_id,
+                                                &input_data, &batch);
+    auto busy = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - started);
+    gembed_status.inference_calls.fetch_add(1, std::memory_order_relaxed);
+    gembed_status.inference_texts.fetch_add(n_texts, std::memory_order_relaxed);
+
+    if (err == 0) {
+        model->tuner.record(n_texts, busy.count());
+    }
+
+    if (node) {
+        node->jobs.fetch_add(group.size(), std::memory_order_relaxed);
+        node->texts.fetch_add(n_texts, std::memory_order_relaxed);
+        node->busy_us.fetch_add(busy.count(), std::memory_order_relaxed);
+    }
+
+    if (err == 0 && (batch.n_vectors != n_texts || batch.dim == 0)) {
+        err = -1;
+    }
+
+    size_t offset = 0;
+    for (Inference_job *job : group) {
+        job->err = err;
+        if (err == 0) {
+            const float *begin = batch.data + offset * batch.dim;
+            job->dim = batch.dim;
+            job->vectors.assign(begin, begin + job->n_texts * batch.dim);
+        }
+        offset += job->n_texts;
+        complete_job(job);
+    }
+
+    if (remote) {
+        remote_free_batch(&batch);
+    } else if (on_helper) {
+        helper_release(&batch);
+    } else {
+        free_embedding_batch(&batch);
+    }
+}
+
+bool parse_cpu_list(const char *list, std::vector<int> &cpus) {
+    const char *p = list;
+
+    while (*p) {
+        while (*p == ' ' || *p == ',' || *p == '\n') p++;
+        if (!*p) break;
+
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p || first < 0) {
+            return false;
+        }
+
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            last = strtol(p + 1, &end, 10);
+            if (end == p + 1 || last < first) {
+                return false;
+            }
+            p = end;
+        }
+
+        for (long cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(static_cast<int>(cpu));
+        }
+
+        if (*p && *p != ',' && *p != '\n' && *p != ' ') {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Fills pool_nodes with one node per NUMA node that has usable CPUs */
+static void discover_numa_nodes() {
+#if defined(__linux__)
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return;
+    }
+
+    char buf[4096];
+    std::vector<int> online;
+    if (FILE *f = fopen("/sys/devices/system/node/online", "r")) {
+        if (!fgets(buf, sizeof(buf), f) || !parse_cpu_list(buf, online)) {
+            online.clear();
+        }
+        fclose(f);
+    }
+
+    for (int os_node : online) {
+        char path[128];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", os_node);
+
+        std::vector<int> node_cpus;
+        if (FILE *f = fopen(path, "r")) {
+            if (!fgets(buf, sizeof(buf), f) || !parse_cpu_list(buf, node_cpus)) {
+                node_cpus.clear();
+            }
+            fclose(f);
+        }
+
+        auto node = std::make_unique<Pool_node>();
+        node->os_node = os_node;
+        for (int cpu : node_cpus) {
+            if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) {
+                node->cpus.push_back(cpu);
+            }
+        }
+
+        // Memory-only nodes, or nodes mysqld may not run on, get no workers
+        if (!node->cpus.empty()) {
+            pool_nodes.push_back(std::move(node));
+        }
+    }
+#endif
+}
+
+static void build_topology() {
+    pool_nodes.clear();
+    cpu_to_node.clear();
+
+    if (gembed_numa_aware) {
+        discover_numa_nodes();
+        if (pool_nodes.size() < 2) {
+            log_message(INFORMATION_LEVEL,
+                        "gembed.numa_aware is set but only one NUMA node is usable");
+            pool_nodes.clear();
+        }
+    }
+
+    if (pool_nodes.empty()) {
+        pool_nodes.push_back(std::make_unique<Pool_node>());
+        return;
+    }
+
+    for (size_t i = 0; i < pool_nodes.size(); i++) {
+        for (int cpu : pool_nodes[i]->cpus) {
+            if (static_cast<size_t>(cpu) >= cpu_to_node.size()) {
+                cpu_to_node.resize(cpu + 1, 0);
+            }
+            cpu_to_node[cpu] = static_cast<int>(i);
+        }
+    }
+}
+
+/* Index of the node the calling thread is running on */
+static size_t caller_node() {
+#if defined(__linux__)
+    if (!cpu_to_node.empty()) {
+        int cpu = sched_getcpu();
+        if (cpu >= 0 && static_cast<size_t>(cpu) < cpu_to_node.size()) {
+            return cpu_to_node[cpu];
+        }
+    }
+#endif
+    return 0;
+}
+
+/* Splits n_threads across the nodes in proportion to their CPUs, at least one each */
+static std::vector<unsigned int> split_threads(unsigned int n_threads) {
+    std::vector<unsigned int> shares(pool_nodes.size(), 1);
+    if (pool_nodes.size() == 1) {
+        shares[0] = n_threads;
+        return shares;
+    }
+
+    size_t total_cpus = 0;
+    for (const auto &node : pool_nodes) {
+        total_cpus += node->cpus.size();
+    }
+
+    unsigned int assigned = 0;
+    for (size_t i = 0; i < pool_nodes.size(); i++) {
+        shares[i] = std::max<unsigned int>(
+            1, n_threads * pool_nodes[i]->cpus.size() / total_cpus);
+        assigned += shares[i];
+    }
+
+    for (size_t i = 0; assigned < n_threads; i = (i + 1) % shares.size()) {
+        shares[i]++;
+        assigned++;
+    }
+
+    return shares;
+}
+
+#if defined(__linux__)
+static pid_t current_tid() {
+    return static_cast<pid_t>(syscall(SYS_gettid));
+}
+#endif
+
+static void capture_placement(Thread_placement &placement) {
+#if defined(__linux__)
+    CPU_ZERO(&placement.cpus);
+    if (sched_getaffinity(0, sizeof(placement.cpus), &placement.cpus) != 0) {
+        return;
+    }
+
+    errno = 0;
+    int nice = getpriority(PRIO_PROCESS, current_tid());
+    if (errno != 0) {
+        return;
+    }
+
+    placement.nice = nice;
+    placement.valid = true;
+#else
+    (void)placement;
+#endif
+}
+
+static bool same_placement(const Thread_placement &a, const Thread_placement &b) {
+    if (a.valid != b.valid) {
+        return false;
+    }
+    if (!a.valid) {
+        return true;
+    }
+#if defined(__linux__)
+    return a.nice == b.nice && CPU_EQUAL(&a.cpus, &b.cpus);
+#else
+    return a.nice == b.nice;
+#endif
+}
+
+static void apply_placement(const Thread_placement &placement) {
+#if defined(__linux__)
+    static std::atomic<bool> warned{false};
+
+    if (pthread_setaffinity_np(pthread_self(), sizeof(placement.cpus), &placement.cpus) != 0 ||
+        setpriority(PRIO_PROCESS, current_tid(), placement.nice) != 0) {
+        // Lowering the nice value needs CAP_SYS_NICE, as resource groups do
+        if (!warned.exchange(true)) {
+            log_message(WARNING_LEVEL, "could not apply CPU affinity or priority "
+                                       "to an inference thread");
+        }
+    }
+#else
+    (void)placement;
+#endif
+}
+
+/*
+ * Placement of a worker when it is not running a caller's job: the node's
+ * CPUs narrowed to gembed.inference_cpus, at gembed.inference_priority.
+ */
+static void base_placement(const Pool_node *node, Thread_placement &placement) {
+#if defined(__linux__)
+    std::vector<int> configured;
+    {
+        std::lock_guard<std::mutex> guard(placement_lock);
+        if (!inference_cpus.empty() && !parse_cpu_list(inference_cpus.c_str(), configured)) {
+            configured.clear();
+        }
+    }
+
+    cpu_set_t wanted;
+    CPU_ZERO(&wanted);
+    for (int cpu : node->cpus) {
+        CPU_SET(cpu, &wanted);
+    }
+
+    if (!configured.empty()) {
+        cpu_set_t limit;
+        CPU_ZERO(&limit);
+        for (int cpu : configured) {
+            if (cpu < CPU_SETSIZE) CPU_SET(cpu, &limit);
+        }
+
+        if (node->cpus.empty()) {
+            wanted = limit;
+        } else {
+            CPU_AND(&wanted, &wanted, &limit);
+            // A node left without CPUs still honours the configured set
+            if (CPU_COUNT(&wanted) == 0) wanted = limit;
+        }
+    }
+
+    if (CPU_COUNT(&wanted) == 0 &&
+        sched_getaffinity(getpid(), sizeof(wanted), &wanted) != 0) {
+        return;
+    }
+
+    placement.cpus = wanted;
+    placement.nice = gembed_inference_priority;
+    placement.valid = true;
+#else
+    (void)node;
+    (void)placement;
+#endif
+}
+
+/*
+ * Placement of a worker running a caller's job: the caller's CPUs within
+ * the node's, or the node's alone when the two do not overlap, so a job
+ * never leaves the node holding its memory.
+ */
+static void caller_placement(const Pool_node *node, const Thread_placement &caller,
+                             Thread_placement &placement) {
+    placement = caller;
+#if defined(__linux__)
+    if (node->cpus.empty()) {
+        return;
+    }
+
+    cpu_set_t local;
+    CPU_ZERO(&local);
+    for (int cpu : node->cpus) {
+        CPU_SET(cpu, &local);
+    }
+    CPU_AND(&placement.cpus, &caller.cpus, &local);
+    if (CPU_COUNT(&placement.cpus) == 0) {
+        placement.cpus = local;
+    }
+#else
+    (void)node;
+#endif
+}
+
+static bool has_queued_jobs(const Pool_node *node) {
+    for (const auto &queue : node->queues) {
+        if (!queue.empty()) return true;
+    }
+    return false;
+}
+
+/*
+ * Picks the queue to serve next. Interactive jobs go first, but every
+ * dispatch earns bulk work gembed.bulk_min_share percent points, and bulk
+ * gets a turn once it has collected a full 100.
+ */
+static std::deque<Inference_job *> &next_queue(Pool_node *node) {
+    auto &interactive = node->queues[PRIORITY_INTERACTIVE];
+    auto &bulk = node->queues[PRIORITY_BULK];
+
+    if (bulk.empty()) {
+        node->bulk_credit = 0;
+        return interactive;
+    }
+    if (interactive.empty()) {
+        return bulk;
+    }
+
+    node->bulk_credit += gembed_bulk_min_share;
+    if (node->bulk_credit >= 100) {
+        node->bulk_credit -= 100;
+        return bulk;
+    }
+    return interactive;
+}
+
+/*
+ * Pops the next job plus any queued jobs of the same class for the same
+ * model, up to the model's batch size, waiting at most its wait window
+ * for more. A bulk batch stops waiting as soon as
+ * interactive work shows up. Called with pool_lock held.
+ */
+static void take_group(Pool_node *node, std::unique_lock<std::mutex> &guard,
+                       std::vector<Inference_job *> &group) {
+    std::deque<Inference_job *> &queue = next_queue(node);
+    Inference_job *first = queue.front();
+    queue.pop_front();
+    group.push_back(first);
+
+    Inference_priority priority = first->group->priority;
+    size_t n_texts = first->n_texts;
+    size_t max_texts = model_batch_size(first->model);
+    unsigned int wait_us = model_wait_us(first->model);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(wait_us);
+
+    for (;;) {
+        for (auto it = queue.begin(); it != queue.end() && n_texts < max_texts;) {
+            Inference_job *job = *it;
+            if (job->model == first->model &&
+                n_texts + job->n_texts <= max_texts &&
+                (job->group == first->group ||
+                 same_placement(job->group->placement, first->group->placement))) {
+                group.push_back(job);
+                n_texts += job->n_texts;
+                it = queue.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        if (n_texts >= max_texts || wait_us == 0 || pool_stopping ||
+            std::chrono::steady_clock::now() >= deadline ||
+            (priority == PRIORITY_BULK &&
+             !node->queues[PRIORITY_INTERACTIVE].empty())) {
+            break;
+        }
+
+        node->coalescing_workers++;
+        node->coalesce_wakeup.wait_until(guard, deadline);
+        node->coalescing_workers--;
+    }
+
+    gembed_status.pool_queue_length.fetch_sub(group.size(), std::memory_order_relaxed);
+
+    auto now = std::chrono::steady_clock::now();
+    status_counter &jobs = priority == PRIORITY_INTERACTIVE
+                               ? gembed_status.interactive_jobs
+                               : gembed_status.bulk_jobs;
+    status_counter &wait = priority == PRIORITY_INTERACTIVE
+                               ? gembed_status.interactive_wait_us
+                               : gembed_status.bulk_wait_us;
+    for (const Inference_job *job : group) {
+        auto waited = std::chrono::duration_cast<std::chrono::microseconds>(
+            now - job->group->queued_at);
+        jobs.fetch_add(1, std::memory_order_relaxed);
+        wait.fetch_add(waited.count(), std::memory_order_relaxed);
+    }
+}
+
+static void worker_main(size_t node_index, unsigned int index) {
+    Pool_node *node = pool_nodes[node_index].get();
+
+    // With a replica per node, first touch puts the weights in local memory
+#if GEMBED_HAVE_BIND_REPLICA
+    if (node->os_node >= 0) {
+        gembed_bind_replica(static_cast<int>(node_index));
+    }
+#endif
+
+    // Forces the base placement to be applied before the first group
+    unsigned int applied_generation = placement_generation.load() - 1;
+
+    std::vector<Inference_job *> group;
+    std::unique_lock<std::mutex> guard(pool_lock);
+
+    for (;;) {
+        node->wakeup.wait(guard, [node, index] {
+            return has_queued_jobs(node) || pool_stopping || index >= node->target;
+        });
+
+        if (index >= node->target || !has_queued_jobs(node)) {
+            // A retiring worker may have consumed a wakeup meant for a job
+            if (has_queued_jobs(node)) {
+                node->wakeup.notify_one();
+            }
+            break;
+        }
+
+        take_group(node, guard, group);
+        guard.unlock();
+
+        const Thread_placement &caller = group.front()->group->placement;
+        unsigned int generation = placement_generation.load();
+        if (caller.valid) {
+            Thread_placement placement;
+            caller_placement(node, caller, placement);
+            apply_placement(placement);
+            applied_generation = generation - 1;
+        } else if (applied_generation != generation) {
+            Thread_placement base;
+            base_placement(node, base);
+            if (base.valid) {
+                apply_placement(base);
+            }
+            applied_generation = generation;
+        }
+
+        run_group(node->os_node >= 0 ? node : nullptr, group);
+        group.clear();
+
+        guard.lock();
+    }
+}
+
+/* Called with resize_lock held */
+static void set_pool_size(unsigned int n_threads) {
+    std::vector<unsigned int> shares = split_threads(n_threads);
+
+    {
+        std::lock_guard<std::mutex> guard(pool_lock);
+        for (size_t i = 0; i < pool_nodes.size(); i++) {
+            pool_nodes[i]->target = shares[i];
+        }
+    }
+
+    long long total = 0;
+    for (size_t i = 0; i < pool_nodes.size(); i++) {
+        Pool_node *node = pool_nodes[i].get();
+        unsigned int current = static_cast<unsigned int>(node->threads.size());
+
+        if (shares[i] < current) {
+            node->wakeup.notify_all();
+            // Retiring workers finish their current group first
+            for (unsigned int k = shares[i]; k < current; k++) {
+                node->threads[k].join();
+            }
+            node->threads.resize(shares[i]);
+        }
+
+        for (unsigned int k = current; k < shares[i]; k++) {
+            node->threads.emplace_back(worker_main, i, k);
+        }
+
+        node->n_threads.store(node->threads.size(), std::memory_order_relaxed);
+        total += node->threads.size();
+    }
+
+    gembed_status.pool_threads.store(total, std::memory_order_relaxed);
+}
+
+static void register_numa_status() {
+    if (pool_nodes.size() < 2) {
+        return;
+    }
+
+    static const struct {
+        const char *suffix;
+        status_counter Pool_node::*counter;
+    } columns[] = {{"threads", &Pool_node::n_threads},
+                   {"jobs", &Pool_node::jobs},
+                   {"texts", &Pool_node::texts},
+                   {"busy_us", &Pool_node::busy_us}};
+
+    // Names must stay put while the server holds pointers to them
+    numa_status_names.reserve(pool_nodes.size() * 4);
+    for (const auto &node : pool_nodes) {
+        for (const auto &column : columns) {
+            numa_status_names.push_back("gembed.numa_node" +
+                                        std::to_string(node->os_node) + "_" +
+                                        column.suffix);
+            numa_status_vars.push_back(
+                {numa_status_names.back().c_str(),
+                 reinterpret_cast<char *>(&((*node).*column.counter)),
+                 SHOW_LONGLONG, SHOW_SCOPE_GLOBAL});
+        }
+    }
+    numa_status_vars.push_back({nullptr, nullptr, SHOW_UNDEF, SHOW_SCOPE_UNDEF});
+
+    if (mysql_service_status_variable_registration->register_variable(
+            numa_status_vars.data())) {
+        log_message(WARNING_LEVEL, "failed to register NUMA status variables");
+        numa_status_vars.clear();
+        numa_status_names.clear();
+    }
+}
+
+static void unregister_numa_status() {
+    if (!numa_status_vars.empty()) {
+        mysql_service_status_variable_registration->unregister_variable(
+            numa_status_vars.data());
+        numa_status_vars.clear();
+        numa_status_names.clear();
+    }
+}
+
+void inference_pool_set_cpus(const char *cpu_list) {
+    {
+        std::lock_guard<std::mutex> guard(placement_lock);
+        inference_cpus = cpu_list ? cpu_list : "";
+    }
+    placement_generation.fetch_add(1);
+}
+
+void inference_pool_placement_changed() {
+    placement_generation.fetch_add(1);
+}
+
+bool inference_pool_start(unsigned int n_threads) {
+    std::lock_guard<std::mutex> guard(resize_lock);
+
+    build_topology();
+    pool_stopping = false;
+    pool_running = true;
+
+    try {
+        set_pool_size(std::max(1U, n_threads));
+    } catch (const std::system_error &) {
+        log_message(ERROR_LEVEL, "failed to start inference threads");
+        if (gembed_status.pool_threads.load() == 0) {
+            pool_running = false;
+            pool_nodes.clear();
+            return true;
+        }
+    }
+
+    if (pool_nodes.size() > 1) {
+        char msg[128];
+        snprintf(msg, sizeof(msg), "inference pool spread over %zu NUMA nodes",
+                 pool_nodes.size());
+        log_message(INFORMATION_LEVEL, msg);
+#if !GEMBED_HAVE_BIND_REPLICA
+        log_message(INFORMATION_LEVEL, "the Gembed library has no gembed_bind_replica(), "
+                                       "so NUMA nodes share one copy of each model");
+#endif
+    }
+    register_numa_status();
+
+    return false;
+}
+
+void inference_pool_stop() {
+    std::lock_guard<std::mutex> guard(resize_lock);
+
+    if (!pool_running) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> pool_guard(pool_lock);
+        pool_stopping = true;
+    }
+
+    // Workers drain their queues before exiting
+    for (const auto &node : pool_nodes) {
+        node->wakeup.notify_all();
+        node->coalesce_wakeup.notify_all();
+    }
+    for (const auto &node : pool_nodes) {
+        for (std::thread &thread : node->threads) {
+            thread.join();
+        }
+        node->threads.clear();
+    }
+
+    unregister_numa_status();
+
+    {
+        std::lock_guard<std::mutex> pool_guard(pool_lock);
+        pool_running = false;
+    }
+    pool_nodes.clear();
+    cpu_to_node.clear();
+    gembed_status.pool_threads.store(0, std::memory_order_relaxed);
+}
+
+void inference_pool_resize(unsigned int n_threads) {
+    std::lock_guard<std::mutex> guard(resize_lock);
+
+    if (!pool_running || pool_stopping) {
+        return;
+    }
+
+    try {
+        set_pool_size(std::max(1U, n_threads));
+    } catch (const std::system_error &) {
+        log_message(WARNING_LEVEL, "could not start all requested inference threads");
+    }
+}
+
+void inference_pool_run(Inference_job *jobs, size_t n_jobs,
+                        Inference_priority priority) {
+    if (n_jobs == 0) {
+        return;
+    }
+
+    Inference_group group;
+    group.pending = n_jobs;
+    group.priority = priority;
+    group.queued_at = std::chrono::steady_clock::now();
+    if (gembed_inherit_resource_group) {
+        capture_placement(group.placement);
+    }
+
+    Pool_node *node = nullptr;
+    bool wake_coalescers = false;
+    {
+        std::lock_guard<std::mutex> guard(pool_lock);
+        if (pool_running && !pool_stopping) {
+            node = pool_nodes[caller_node()].get();
+            for (size_t i = 0; i < n_jobs; i++) {
+                jobs[i].group = &group;
+                node->queues[priority].push_back(&jobs[i]);
+            }
+            gembed_status.pool_queue_length.fetch_add(n_jobs, std::memory_order_relaxed);
+            // Coalescing workers either take these or, for interactive
+            // work, cut a bulk batch short to let it through
+            wake_coalescers = node->coalescing_workers > 0;
+        }
+    }
+
+    if (!node) {
+        // No pool (shutting down or failed to start): run on the caller
+        for (size_t i = 0; i < n_jobs; i++) {
+            jobs[i].group = &group;
+            run_group(nullptr, {&jobs[i]});
+        }
+        return;
+    }
+
+    if (n_jobs == 1) {
+        node->wakeup.notify_one();
+    } else {
+        node->wakeup.notify_all();
+    }
+    if (wake_coalescers) {
+        node->coalesce_wakeup.notify_all();
+    }
+
+    std::unique_lock<std::mutex> guard(group.lock);
+    group.done.wait(guard, [&group] { return group.pending == 0; });
+}
@@ -0,0 +1,98 @@
+/* Copyright (c) 2025, Joel Díaz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+#ifndef GEMBED_POOL_H
+#define GEMBED_POOL_H
+
+#include <cstddef>
+#include <vector>
+#include "mysql_gembed.h"
+
+/*
+ * Component-wide inference thread pool.
+ *
+ * Every generate_embeddings() call runs on one of gembed.inference_threads
+ * workers, so the number of threads doing inference does not grow with the
+ * number of connections. Connection threads queue jobs and block until
+ * they complete. Queued jobs for the same model are merged into one library
+ * call, waiting up to gembed.max_wait_us for more to arrive. With
+ * gembed.adaptive_batching the batch size and wait come from the model's
+ * controller instead, fed with the latency of every call.
+ *
+ * With gembed.numa_aware the workers are split into one group per NUMA
+ * node, pinned to that node's CPUs, and jobs go to the caller's node.
+ *
+ * Workers stay on gembed.inference_cpus at gembed.inference_priority. With
+ * gembed.inherit_resource_group they instead take on the CPU affinity and
+ * priority of the connection thread, and so its resource group, for the
+ * duration of its jobs.
+ */
+
+/*
+ * Scheduling class. Interactive jobs are served before queued bulk
+ * sub-batches; bulk keeps at least gembed.bulk_min_share of dispatches.
+ */
+enum Inference_priority {
+    PRIORITY_INTERACTIVE = 0,
+    PRIORITY_BULK = 1
+};
+
+#define PRIORITY_CLASSES 2
+
+struct Inference_group;
+struct Model_entry;
+
+/* A sub-batch of texts for a single model */
+struct Inference_job {
+    Model_entry *model = nullptr;
+    const StringSlice *texts = nullptr;
+    size_t n_texts = 0;
+
+    /* Results, filled in by the worker */
+    int err = 0;
+    size_t dim = 0;
+    std::vector<float> vectors;  /* n_texts * dim floats */
+
+    Inference_group *group = nullptr;
+};
+
+/*
+ * Parses a Linux CPU list such as "0-3,8,10-11" into cpus.
+ * Returns false on malformed input.
+ */
+bool parse_cpu_list(const char *list, std::vector<int> &cpus);
+
+/* Number of physical cores, falling back to logical CPUs */
+unsigned int physical_core_count();
+
+/* Starts n_threads workers. Returns true on failure */
+bool inference_pool_start(unsigned int n_threads);
+
+/* Finishes queued jobs and joins every worker */
+void inference_pool_stop();
+
+/* Grows or shrinks the pool to n_threads workers */
+void inference_pool_resize(unsigned int n_threads);
+
+/* Sets the CPUs workers are confined to, NULL or "" for no limit */
+void inference_pool_set_cpus(const char *cpu_list);
+
+/* Makes workers re-apply their CPU affinity and priority */
+void inference_pool_placement_changed();
+
+/* Runs the jobs on the pool and blocks until all of them are done */
+void inference_pool_run(Inference_job *jobs, size_t n_jobs,
+                        Inference_priority priority);
+
+#endif /* GEMBED_POOL_H */
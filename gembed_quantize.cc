@@ -0,0 +1,542 @@
+/* Copyright (c) 2025, Joel Díaz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+
+#include "gembed_quantize.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include "gembed_cpu.h"
+#include "gembed_half.h"
+
+#if defined(__x86_64__)
+// GCC 12's AVX-512 intrinsics start from _mm512_undefined_ps() and warn once inlined
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#include <immintrin.h>
+#pragma GCC diagnostic pop
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+static int8_t clamp_int8(float q) {
+    return static_cast<int8_t>(std::min(127L, std::max(-128L, lrintf(q))));
+}
+
+/* Largest |vec[i]|: the per-vector scale is this / 127 */
+static float max_abs_scalar(const float *vec, size_t dim) {
+    float max = 0;
+    for (size_t i = 0; i < dim; i++) {
+        max = std::max(max, std::fabs(vec[i]));
+    }
+    return max;
+}
+
+static float sum_squares_scalar(const float *vec, size_t dim) {
+    float sum = 0;
+    for (size_t i = 0; i < dim; i++) {
+        sum += vec[i] * vec[i];
+    }
+    return sum;
+}
+
+static void scale_scalar(const float *vec, size_t dim, float factor, float *out) {
+    for (size_t i = 0; i < dim; i++) {
+        out[i] = vec[i] * factor;
+    }
+}
+
+/* out[i] = clamp(round(vec[i] * mul[i] + add[i])), mul and add broadcast when step is 0 */
+static void to_int8_scalar(const float *vec, size_t dim, const float *mul,
+                           const float *add, size_t step, int8_t *out) {
+    for (size_t i = 0; i < dim; i++) {
+        out[i] = clamp_int8(vec[i] * mul[i * step] + add[i * step]);
+    }
+}
+
+static void to_bits_scalar(const float *vec, size_t dim, uint8_t *out) {
+    memset(out, 0, (dim + 7) / 8);
+    for (size_t i = 0; i < dim; i++) {
+        if (vec[i] > 0) {
+            out[i / 8] |= static_cast<uint8_t>(1 << (i % 8));
+        }
+    }
+}
+
+static void to_fp16_scalar(const float *vec, size_t dim, uint16_t *out) {
+    for (size_t i = 0; i < dim; i++) {
+        out[i] = float_to_fp16(vec[i]);
+    }
+}
+
+static void to_bf16_scalar(const float *vec, size_t dim, uint16_t *out) {
+    for (size_t i = 0; i < dim; i++) {
+        out[i] = float_to_bf16(vec[i]);
+    }
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("avx2")))
+static float max_abs_avx2(const float *vec, size_t dim) {
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    __m256 max = _mm256_setzero_ps();
+    size_t i = 0;
+
+    for (; i + 8 <= dim; i += 8) {
+        max = _mm256_max_ps(max, _mm256_andnot_ps(sign, _mm256_loadu_ps(vec + i)));
+    }
+
+    float lanes[8];
+    _mm256_storeu_ps(lanes, max);
+    return std::max(max_abs_scalar(lanes, 8), max_abs_scalar(vec + i, dim - i));
+}
+
+__attribute__((target("avx2,fma")))
+static float sum_squares_avx2(const float *vec, size_t dim) {
+    __m256 sum = _mm256_setzero_ps();
+    size_t i = 0;
+
+    for (; i + 8 <= dim; i += 8) {
+        __m256 x = _mm256_loadu_ps(vec + i);
+        sum = _mm256_fmadd_ps(x, x, sum);
+    }
+
+    float lanes[8];
+    _mm256_storeu_ps(lanes, sum);
+    float total = sum_squares_scalar(vec + i, dim - i);
+    for (float lane : lanes) {
+        total += lane;
+    }
+    return total;
+}
+
+__attribute__((target("avx2")))
+static void scale_avx2(const float *vec, size_t dim, float factor, float *out) {
+    const __m256 f = _mm256_set1_ps(factor);
+    size_t i = 0;
+
+    for (; i + 8 <= dim; i += 8) {
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_loadu_ps(vec + i), f));
+    }
+
+    scale_scalar(vec + i, dim - i, factor, out + i);
+}
+
+__attribute__((target("avx2")))
+static void to_int8_avx2(const float *vec, size_t dim, const float *mul,
+                         const float *add, size_t step, int8_t *out) {
+    // packs works within 128-bit lanes, this puts the 32 bytes back in order
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    size_t i = 0;
+
+    for (; i + 32 <= dim; i += 32) {
+        __m256i q[4];
+        for (int k = 0; k < 4; k++) {
+            size_t at = i + k * 8;
+            __m256 m = step ? _mm256_loadu_ps(mul + at) : _mm256_set1_ps(mul[0]);
+            __m256 a = step ? _mm256_loadu_ps(add + at) : _mm256_set1_ps(add[0]);
+            __m256 x = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(vec + at), m), a);
+            q[k] = _mm256_cvtps_epi32(x);
+        }
+        __m256i words = _mm256_packs_epi32(q[0], q[1]);
+        __m256i words_hi = _mm256_packs_epi32(q[2], q[3]);
+        __m256i bytes = _mm256_packs_epi16(words, words_hi);
+        bytes = _mm256_permutevar8x32_epi32(bytes, order);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), bytes);
+    }
+
+    to_int8_scalar(vec + i, dim - i, mul + i * step, add + i * step, step, out + i);
+}
+
+__attribute__((target("avx2")))
+static void to_bits_avx2(const float *vec, size_t dim, uint8_t *out) {
+    const __m256 zero = _mm256_setzero_ps();
+    size_t i = 0;
+
+    for (; i + 8 <= dim; i += 8) {
+        __m256 positive = _mm256_cmp_ps(_mm256_loadu_ps(vec + i), zero, _CMP_GT_OQ);
+        out[i / 8] = static_cast<uint8_t>(_mm256_movemask_ps(positive));
+    }
+
+    if (i < dim) {
+        to_bits_scalar(vec + i, dim - i, out + i / 8);
+    }
+}
+
+__attribute__((target("avx512f")))
+static void to_fp16_avx512(const float *vec, size_t dim, uint16_t *out) {
+    size_t i = 0;
+
+    for (; i + 16 <= dim; i += 16) {
+        __m256i half = _mm512_cvtps_ph(_mm512_loadu_ps(vec + i),
+                                       _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), half);
+    }
+
+    to_fp16_scalar(vec + i, dim - i, out + i);
+}
+
+__attribute__((target("avx2,f16c")))
+static void to_fp16_f16c(const float *vec, size_t dim, uint16_t *out) {
+    size_t i = 0;
+
+    for (; i + 8 <= dim; i += 8) {
+        __m128i half = _mm256_cvtps_ph(_mm256_loadu_ps(vec + i),
+                                       _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), half);
+    }
+
+    to_fp16_scalar(vec + i, dim - i, out + i);
+}
+
+__attribute__((target("avx512f,avx512bf16")))
+static void to_bf16_avx512(const float *vec, size_t dim, uint16_t *out) {
+    size_t i = 0;
+
+    for (; i + 16 <= dim; i += 16) {
+        __m256bh half = _mm512_cvtneps_pbh(_mm512_loadu_ps(vec + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i),
+                            reinterpret_cast<__m256i &>(half));
+    }
+
+    to_bf16_scalar(vec + i, dim - i, out + i);
+}
+
+/* float_to_bf16() on 8 lanes, leaving each result in the low half of its lane */
+__attribute__((target("avx2")))
+static __m256i bf16_lanes_avx2(__m256 x) {
+    __m256i bits = _mm256_castps_si256(x);
+    __m256i odd = _mm256_and_si256(_mm256_srli_epi32(bits, 16), _mm256_set1_epi32(1));
+    __m256i rounded = _mm256_add_epi32(bits, _mm256_add_epi32(odd, _mm256_set1_epi32(0x7FFF)));
+    __m256i quiet = _mm256_or_si256(_mm256_srli_epi32(bits, 16), _mm256_set1_epi32(0x40));
+    __m256 nan = _mm256_cmp_ps(x, x, _CMP_UNORD_Q);
+    return _mm256_blendv_epi8(_mm256_srli_epi32(rounded, 16), quiet, _mm256_castps_si256(nan));
+}
+
+__attribute__((target("avx2")))
+static void to_bf16_avx2(const float *vec, size_t dim, uint16_t *out) {
+    size_t i = 0;
+
+    for (; i + 16 <= dim; i += 16) {
+        __m256i lo = bf16_lanes_avx2(_mm256_loadu_ps(vec + i));
+        __m256i hi = bf16_lanes_avx2(_mm256_loadu_ps(vec + i + 8));
+        // packus works within 128-bit lanes, the permute restores the order
+        __m256i half = _mm256_permute4x64_epi64(_mm256_packus_epi32(lo, hi), 0xD8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), half);
+    }
+
+    to_bf16_scalar(vec + i, dim - i, out + i);
+}
+
+#elif defined(__aarch64__)
+
+static void to_fp16_neon(const float *vec, size_t dim, uint16_t *out) {
+    size_t i = 0;
+
+    for (; i + 4 <= dim; i += 4) {
+        vst1_u16(out + i, vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(vec + i))));
+    }
+
+    to_fp16_scalar(vec + i, dim - i, out + i);
+}
+
+static float max_abs_neon(const float *vec, size_t dim) {
+    float32x4_t max = vdupq_n_f32(0);
+    size_t i = 0;
+
+    for (; i + 4 <= dim; i += 4) {
+        max = vmaxq_f32(max, vabsq_f32(vld1q_f32(vec + i)));
+    }
+
+    return std::max(vmaxvq_f32(max), max_abs_scalar(vec + i, dim - i));
+}
+
+static float sum_squares_neon(const float *vec, size_t dim) {
+    float32x4_t sum = vdupq_n_f32(0);
+    size_t i = 0;
+
+    for (; i + 4 <= dim; i += 4) {
+        float32x4_t x = vld1q_f32(vec + i);
+        sum = vfmaq_f32(sum, x, x);
+    }
+
+    return vaddvq_f32(sum) + sum_squares_scalar(vec + i, dim - i);
+}
+
+static void scale_neon(const float *vec, size_t dim, float factor, float *out) {
+    size_t i = 0;
+
+    for (; i + 4 <= dim; i += 4) {
+        vst1q_f32(out + i, vmulq_n_f32(vld1q_f32(vec + i), factor));
+    }
+
+    scale_scalar(vec + i, dim - i, factor, out + i);
+}
+
+static void to_int8_neon(const float *vec, size_t dim, const float *mul,
+                         const float *add, size_t step, int8_t *out) {
+    size_t i = 0;
+
+    for (; i + 8 <= dim; i += 8) {
+        int32x4_t q[2];
+        for (int k = 0; k < 2; k++) {
+            size_t at = i + k * 4;
+            float32x4_t m = step ? vld1q_f32(mul + at) : vdupq_n_f32(mul[0]);
+            float32x4_t a = step ? vld1q_f32(add + at) : vdupq_n_f32(add[0]);
+            q[k] = vcvtnq_s32_f32(vfmaq_f32(a, vld1q_f32(vec + at), m));
+        }
+        int16x8_t words = vcombine_s16(vqmovn_s32(q[0]), vqmovn_s32(q[1]));
+        vst1_s8(out + i, vqmovn_s16(words));
+    }
+
+    to_int8_scalar(vec + i, dim - i, mul + i * step, add + i * step, step, out + i);
+}
+
+static void to_bits_neon(const float *vec, size_t dim, uint8_t *out) {
+    static const uint32_t low_bits[4] = {1, 2, 4, 8};
+    const uint32x4_t weights = vld1q_u32(low_bits);
+    const float32x4_t zero = vdupq_n_f32(0);
+    size_t i = 0;
+
+    for (; i + 8 <= dim; i += 8) {
+        uint32x4_t lo = vandq_u32(vcgtq_f32(vld1q_f32(vec + i), zero), weights);
+        uint32x4_t hi = vandq_u32(vcgtq_f32(vld1q_f32(vec + i + 4), zero), weights);
+        out[i / 8] = static_cast<uint8_t>(vaddvq_u32(lo) | (vaddvq_u32(hi) << 4));
+    }
+
+    if (i < dim) {
+        to_bits_scalar(vec + i, dim - i, out + i / 8);
+    }
+}
+
+#endif
+
+static float max_abs(const float *vec, size_t dim) {
+#if defined(__x86_64__)
+    if (cpu_features().avx2) return max_abs_avx2(vec, dim);
+#elif defined(__aarch64__)
+    return max_abs_neon(vec, dim);
+#endif
+    return max_abs_scalar(vec, dim);
+}
+
+static float sum_squares(const float *vec, size_t dim) {
+#if defined(__x86_64__)
+    if (cpu_features().avx2 && cpu_features().fma) return sum_squares_avx2(vec, dim);
+#elif defined(__aarch64__)
+    return sum_squares_neon(vec, dim);
+#endif
+    return sum_squares_scalar(vec, dim);
+}
+
+static void scale(const float *vec, size_t dim, float factor, float *out) {
+#if defined(__x86_64__)
+    if (cpu_features().avx2) return scale_avx2(vec, dim, factor, out);
+#elif defined(__aarch64__)
+    return scale_neon(vec, dim, factor, out);
+#endif
+    scale_scalar(vec, dim, factor, out);
+}
+
+static void to_int8(const float *vec, size_t dim, const float *mul,
+                    const float *add, size_t step, int8_t *out) {
+#if defined(__x86_64__)
+    if (cpu_features().avx2) return to_int8_avx2(vec, dim, mul, add, step, out);
+#elif defined(__aarch64__)
+    return to_int8_neon(vec, dim, mul, add, step, out);
+#endif
+    to_int8_scalar(vec, dim, mul, add, step, out);
+}
+
+static void to_bits(const float *vec, size_t dim, uint8_t *out) {
+#if defined(__x86_64__)
+    if (cpu_features().avx2) return to_bits_avx2(vec, dim, out);
+#elif defined(__aarch64__)
+    return to_bits_neon(vec, dim, out);
+#endif
+    to_bits_scalar(vec, dim, out);
+}
+
+static void to_fp16(const float *vec, size_t dim, uint16_t *out) {
+#if defined(__x86_64__)
+    if (cpu_features().avx512f) return to_fp16_avx512(vec, dim, out);
+    if (cpu_features().avx2 && cpu_features().f16c) return to_fp16_f16c(vec, dim, out);
+#elif defined(__aarch64__)
+    return to_fp16_neon(vec, dim, out);
+#endif
+    to_fp16_scalar(vec, dim, out);
+}
+
+static void to_bf16(const float *vec, size_t dim, uint16_t *out) {
+#if defined(__x86_64__)
+    if (cpu_features().avx512bf16) return to_bf16_avx512(vec, dim, out);
+    if (cpu_features().avx2) return to_bf16_avx2(vec, dim, out);
+#endif
+    to_bf16_scalar(vec, dim, out);
+}
+
+void truncate_vectors(const float *vectors, size_t n, size_t dim, size_t dims,
+                      float *out) {
+    for (size_t i = 0; i < n; i++) {
+        const float *vec = vectors + i * dim;
+        float norm = std::sqrt(sum_squares(vec, dims));
+        // A zero prefix stays zero rather than turning into NaNs
+        scale(vec, dims, norm > 0 ? 1 / norm : 0, out + i * dims);
+    }
+}
+
+size_t quantized_size(Output_format format, size_t dim) {
+    switch (format) {
+        case OUTPUT_INT8:
+            return sizeof(uint32_t) + sizeof(float) + dim;
+        case OUTPUT_BINARY:
+            return sizeof(uint32_t) + (dim + 7) / 8;
+        case OUTPUT_FP16:
+        case OUTPUT_BF16:
+            return sizeof(uint32_t) + dim * sizeof(uint16_t);
+        default:
+            return sizeof(uint32_t) + dim * sizeof(float);
+    }
+}
+
+void quantize_vector(Output_format format, const Int8_ranges *ranges,
+                     const float *vec, size_t dim, char *out) {
+    uint32_t dim32 = static_cast<uint32_t>(dim);
+    memcpy(out, &dim32, sizeof(dim32));
+    out += sizeof(dim32);
+
+    if (format == OUTPUT_BINARY) {
+        to_bits(vec, dim, reinterpret_cast<uint8_t *>(out));
+        return;
+    }
+
+    if (format == OUTPUT_FP16 || format == OUTPUT_BF16) {
+        // Halves are written in place, the header leaves out 2-byte aligned
+        uint16_t *halves = reinterpret_cast<uint16_t *>(out);
+        if (format == OUTPUT_FP16) {
+            to_fp16(vec, dim, halves);
+        } else {
+            to_bf16(vec, dim, halves);
+        }
+        return;
+    }
+
+    if (format != OUTPUT_INT8) {
+        memcpy(out, vec, dim * sizeof(float));
+        return;
+    }
+
+    int8_t *values = reinterpret_cast<int8_t *>(out + sizeof(float));
+    float scale = 0;
+
+    if (ranges) {
+        to_int8(vec, dim, ranges->mul.data(), ranges->add.data(), 1, values);
+    } else {
+        // An all-zero vector keeps scale 0 and zero values
+        scale = max_abs(vec, dim) / 127;
+        float mul = scale > 0 ? 1 / scale : 0;
+        float add = 0;
+        to_int8(vec, dim, &mul, &add, 0, values);
+    }
+    memcpy(out, &scale, sizeof(scale));
+}
+
+/* Fills mul and add of ranges from low and high */
+static void int8_scales(Int8_ranges *ranges) {
+    size_t dim = ranges->low.size();
+    ranges->mul.resize(dim);
+    ranges->add.resize(dim);
+    for (size_t d = 0; d < dim; d++) {
+        ranges->mul[d] = 255 / (ranges->high[d] - ranges->low[d]);
+        ranges->add[d] = -ranges->low[d] * ranges->mul[d] - 128;
+    }
+}
+
+bool int8_calibrate(const float *vectors, size_t n, size_t dim, Int8_ranges *ranges) {
+    if (n < INT8_CALIBRATION_MIN_SAMPLES || dim == 0) {
+        return false;
+    }
+
+    ranges->low.resize(dim);
+    ranges->high.resize(dim);
+
+    // Outliers would stretch the range and waste most of the 256 steps
+    size_t trim = n / 200;
+    std::vector<float> column(n);
+
+    for (size_t d = 0; d < dim; d++) {
+        for (size_t i = 0; i < n; i++) {
+            column[i] = vectors[i * dim + d];
+        }
+        std::nth_element(column.begin(), column.begin() + trim, column.end());
+        float low = column[trim];
+        std::nth_element(column.begin(), column.end() - 1 - trim, column.end());
+        float high = column[n - 1 - trim];
+
+        if (!std::isfinite(low) || !std::isfinite(high)) {
+            return false;
+        }
+        if (high <= low) {
+            high = low + 1e-6f;
+        }
+
+        ranges->low[d] = low;
+        ranges->high[d] = high;
+    }
+
+    int8_scales(ranges);
+    return true;
+}
+
+size_t int8_calibration_size(size_t dim) {
+    return sizeof(uint32_t) + 2 * dim * sizeof(float);
+}
+
+void int8_calibration_write(const Int8_ranges &ranges, char *out) {
+    uint32_t dim = static_cast<uint32_t>(ranges.low.size());
+    memcpy(out, &dim, sizeof(dim));
+    out += sizeof(dim);
+    memcpy(out, ranges.low.data(), dim * sizeof(float));
+    memcpy(out + dim * sizeof(float), ranges.high.data(), dim * sizeof(float));
+}
+
+bool int8_calibration_read(const char *data, size_t len, Int8_ranges *ranges) {
+    uint32_t dim = 0;
+    if (len < sizeof(dim)) {
+        return false;
+    }
+    memcpy(&dim, data, sizeof(dim));
+    if (dim == 0 || len != int8_calibration_size(dim)) {
+        return false;
+    }
+    data += sizeof(dim);
+
+    ranges->low.resize(dim);
+    ranges->high.resize(dim);
+    memcpy(ranges->low.data(), data, dim * sizeof(float));
+    memcpy(ranges->high.data(), data + dim * sizeof(float), dim * sizeof(float));
+    for (size_t d = 0; d < dim; d++) {
+        if (!std::isfinite(ranges->low[d]) || !std::isfinite(ranges->high[d]) ||
+            ranges->high[d] <= ranges->low[d]) {
+            return false;
+        }
+    }
+
+    int8_scales(ranges);
+    return true;
+}
@@ -0,0 +1,92 @@
+/* Copyright (c) 2025, Joel Díaz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+#ifndef GEMBED_QUANTIZE_H
+#define GEMBED_QUANTIZE_H
+
+#include <cstddef>
+#include <vector>
+#include "gembed_options.h"
+
+/*
+ * Compact output formats of EMBED_TEXT and EMBED_TEXTS, made from the float
+ * vectors once they are embedded. Like a VECTOR, each starts with the u32
+ * dimension count:
+ *
+ *   int8    u32 dim, float scale, int8[dim]: x[i] ~ scale * q[i], with
+ *           scale = max |x[i]| / 127. A calibrated vector has scale 0 and
+ *           maps every dimension over its range in a calibration instead:
+ *           x[i] ~ low[i] + (q[i] + 128) * (high[i] - low[i]) / 255.
+ *   binary  u32 dim, (dim + 7) / 8 bytes of sign bits: bit i % 8 of byte
+ *           i / 8 is set when x[i] > 0, so BIT_COUNT(a ^ b) is the Hamming
+ *           distance of two vectors.
+ *   fp16    u32 dim, IEEE half[dim]
+ *   bf16    u32 dim, bfloat16[dim]: the top 16 bits of each float
+ *
+ * Half-precision values are rounded to nearest even; fp16 keeps more
+ * mantissa, bf16 the full float range.
+ */
+
+/*
+ * Per-dimension int8 ranges, from GEMBED_CALIBRATE. Dimension i quantizes
+ * as q = x * mul[i] + add[i], mapping its [low, high] range over
+ * [-128, 127]. Callers keep them as a calibration, u32 dim, float
+ * low[dim], float high[dim], and pass it back to every call that writes
+ * calibrated vectors.
+ */
+struct Int8_ranges {
+    std::vector<float> low;
+    std::vector<float> high;
+    std::vector<float> mul;
+    std::vector<float> add;
+};
+
+/*
+ * Keeps the first dims of each of n vectors of dim dimensions, rescaled to
+ * unit length, in out (n * dims floats). Models trained with Matryoshka
+ * representation learning keep most of their meaning in such a prefix.
+ */
+void truncate_vectors(const float *vectors, size_t n, size_t dim, size_t dims,
+                      float *out);
+
+/* Bytes of a vector of dim dimensions in format, header included */
+size_t quantized_size(Output_format format, size_t dim);
+
+/*
+ * Writes vec in format to out, which has quantized_size() bytes. ranges,
+ * with dim dimensions, is required for calibrated int8 and NULL otherwise.
+ */
+void quantize_vector(Output_format format, const Int8_ranges *ranges,
+                     const float *vec, size_t dim, char *out);
+
+/* Fewest samples a calibration takes, enough for its percentiles to trim */
+#define INT8_CALIBRATION_MIN_SAMPLES 200
+
+/*
+ * Sets ranges from n sample vectors: the 0.5th to 99.5th percentile of
+ * each dimension. Returns false if there are fewer than
+ * INT8_CALIBRATION_MIN_SAMPLES or they cannot give a usable range.
+ */
+bool int8_calibrate(const float *vectors, size_t n, size_t dim, Int8_ranges *ranges);
+
+/* Bytes of the calibration of ranges of dim dimensions */
+size_t int8_calibration_size(size_t dim);
+
+/* Writes ranges as a calibration to out, which has int8_calibration_size() bytes */
+void int8_calibration_write(const Int8_ranges &ranges, char *out);
+
+/* Reads a calibration into ranges. Returns false if it is not one */
+bool int8_calibration_read(const char *data, size_t len, Int8_ranges *ranges);
+
+#endif /* GEMBED_QUANTIZE_H */
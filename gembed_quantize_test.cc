@@ -0,0 +1,332 @@
+/* Copyright (c) 2025, Joel Díaz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+
+/*
+ * Standalone test of the compact output formats: int8 packing and
+ * calibrations, binary packing, fp16 and bf16 rounding, and the SIMD paths
+ * of this CPU against the scalar ones. The unit is included whole to reach
+ * its kernels.
+ */
+
+#include "gembed_quantize.cc"
+
+#include <cstdio>
+#include <random>
+
+static int failures = 0;
+
+#define CHECK(cond)                                                          \
+    do {                                                                     \
+        if (!(cond)) {                                                       \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, \
+                    #cond);                                                  \
+            failures++;                                                      \
+        }                                                                    \
+    } while (0)
+
+static float bits_to_float(uint32_t bits) {
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static std::vector<float> random_vector(std::mt19937 &rng, size_t dim, float range) {
+    std::uniform_real_distribution<float> dist(-range, range);
+    std::vector<float> vec(dim);
+    for (float &x : vec) {
+        x = dist(rng);
+    }
+    return vec;
+}
+
+static void test_int8_packing(std::mt19937 &rng) {
+    for (size_t dim : {1, 7, 8, 31, 32, 33, 384}) {
+        std::vector<float> vec = random_vector(rng, dim, 3.0f);
+        vec[dim / 2] = -4.0f;  // the largest magnitude maps to -127
+
+        std::vector<char> out(quantized_size(OUTPUT_INT8, dim));
+        CHECK(out.size() == sizeof(uint32_t) + sizeof(float) + dim);
+        quantize_vector(OUTPUT_INT8, nullptr, vec.data(), dim, out.data());
+
+        uint32_t header;
+        float scale;
+        memcpy(&header, out.data(), sizeof(header));
+        memcpy(&scale, out.data() + sizeof(header), sizeof(scale));
+        const int8_t *q = reinterpret_cast<const int8_t *>(out.data() + 8);
+
+        CHECK(header == dim);
+        CHECK(scale == 4.0f / 127);
+        CHECK(q[dim / 2] == -127);
+        for (size_t i = 0; i < dim; i++) {
+            CHECK(std::fabs(scale * q[i] - vec[i]) <= scale * 0.5f + 1e-6f);
+        }
+    }
+
+    // A zero vector keeps scale 0 rather than dividing by it
+    std::vector<float> zero(16, 0.0f);
+    std::vector<char> out(quantized_size(OUTPUT_INT8, zero.size()));
+    quantize_vector(OUTPUT_INT8, nullptr, zero.data(), zero.size(), out.data());
+    float scale;
+    memcpy(&scale, out.data() + 4, sizeof(scale));
+    CHECK(scale == 0);
+    for (size_t i = 0; i < zero.size(); i++) {
+        CHECK(out[8 + i] == 0);
+    }
+
+    // Calibrated ranges clamp to [-128, 127] and write scale 0
+    Int8_ranges ranges;
+    ranges.mul = {1.0f, 1.0f, 10.0f};
+    ranges.add = {0.0f, -0.5f, 0.0f};
+    float calibrated[] = {200.0f, 2.0f, -13.0f};
+    std::vector<char> packed(quantized_size(OUTPUT_INT8, 3));
+    quantize_vector(OUTPUT_INT8, &ranges, calibrated, 3, packed.data());
+    memcpy(&scale, packed.data() + 4, sizeof(scale));
+    CHECK(scale == 0);
+    CHECK(packed[8] == 127);
+    CHECK(packed[9] == 2);  // 1.5 rounds to even
+    CHECK(packed[10] == -128);
+}
+
+/* Calibrations trim outliers, survive a round trip and decode what they wrote */
+static void test_int8_calibration(std::mt19937 &rng) {
+    const size_t dim = 5;
+    Int8_ranges ranges;
+    std::vector<float> samples = random_vector(rng, INT8_CALIBRATION_MIN_SAMPLES * dim, 1.0f);
+    CHECK(!int8_calibrate(samples.data(), INT8_CALIBRATION_MIN_SAMPLES - 1, dim, &ranges));
+
+    // One outlier per end of dimension 0 is trimmed away
+    size_t n = 1000;
+    samples = random_vector(rng, n * dim, 1.0f);
+    samples[0] = 50.0f;
+    samples[dim] = -50.0f;
+    CHECK(int8_calibrate(samples.data(), n, dim, &ranges));
+    CHECK(ranges.low.size() == dim && ranges.mul.size() == dim);
+    for (size_t d = 0; d < dim; d++) {
+        CHECK(ranges.low[d] > -1.0f && ranges.low[d] < -0.9f);
+        CHECK(ranges.high[d] < 1.0f && ranges.high[d] > 0.9f);
+    }
+
+    std::vector<char> blob(int8_calibration_size(dim));
+    CHECK(blob.size() == sizeof(uint32_t) + 2 * dim * sizeof(float));
+    int8_calibration_write(ranges, blob.data());
+    Int8_ranges read;
+    CHECK(int8_calibration_read(blob.data(), blob.size(), &read));
+    CHECK(read.low == ranges.low && read.high == ranges.high);
+    CHECK(read.mul == ranges.mul && read.add == ranges.add);
+    CHECK(!int8_calibration_read(blob.data(), blob.size() - 1, &read));
+    CHECK(!int8_calibration_read(blob.data(), 2, &read));
+
+    // Each byte decodes to within half a step of its dimension's range
+    std::vector<float> vec = random_vector(rng, dim, 0.9f);
+    std::vector<char> out(quantized_size(OUTPUT_INT8, dim));
+    quantize_vector(OUTPUT_INT8, &read, vec.data(), dim, out.data());
+    for (size_t d = 0; d < dim; d++) {
+        float step = (read.high[d] - read.low[d]) / 255;
+        float decoded = read.low[d] + (static_cast<int8_t>(out[8 + d]) + 128) * step;
+        CHECK(std::fabs(decoded - vec[d]) <= step * 0.5f + 1e-6f);
+    }
+
+    // An empty range is not a calibration
+    memcpy(&blob[sizeof(uint32_t) + dim * sizeof(float)], &read.low[0], sizeof(float));
+    CHECK(!int8_calibration_read(blob.data(), blob.size(), &read));
+}
+
+static void test_binary_packing(std::mt19937 &rng) {
+    float vec[] = {1, -1, 0, 2, -0.0f, 3, -3, 0.5f, 1, -1};
+    std::vector<char> out(quantized_size(OUTPUT_BINARY, 10));
+    CHECK(out.size() == sizeof(uint32_t) + 2);
+    quantize_vector(OUTPUT_BINARY, nullptr, vec, 10, out.data());
+
+    uint32_t header;
+    memcpy(&header, out.data(), sizeof(header));
+    CHECK(header == 10);
+    // Dimension i is bit i % 8 of byte i / 8, set when positive
+    CHECK(static_cast<uint8_t>(out[4]) == 0xA9);
+    CHECK(static_cast<uint8_t>(out[5]) == 0x01);
+
+    for (size_t dim : {1, 63, 64, 65, 384, 1000}) {
+        std::vector<float> random = random_vector(rng, dim, 1.0f);
+        std::vector<uint8_t> fast((dim + 7) / 8), scalar((dim + 7) / 8);
+        to_bits(random.data(), dim, fast.data());
+        to_bits_scalar(random.data(), dim, scalar.data());
+        CHECK(fast == scalar);
+    }
+}
+
+static void test_fp16_rounding() {
+    CHECK(float_to_fp16(0.0f) == 0x0000);
+    CHECK(float_to_fp16(-0.0f) == 0x8000);
+    CHECK(float_to_fp16(1.0f) == 0x3C00);
+    CHECK(float_to_fp16(-2.0f) == 0xC000);
+    CHECK(float_to_fp16(65504.0f) == 0x7BFF);
+    CHECK(float_to_fp16(65519.0f) == 0x7BFF);
+    CHECK(float_to_fp16(65520.0f) == 0x7C00);
+    CHECK(float_to_fp16(1e10f) == 0x7C00);
+    CHECK(float_to_fp16(std::numeric_limits<float>::infinity()) == 0x7C00);
+    CHECK((float_to_fp16(std::numeric_limits<float>::quiet_NaN()) & 0x7FFF) > 0x7C00);
+    CHECK(float_to_fp16(bits_to_float(0x33800000)) == 0x0001);  // 2^-24
+    CHECK(float_to_fp16(bits_to_float(0x33000000)) == 0x0000);  // 2^-25 ties to even
+    CHECK(float_to_fp16(bits_to_float(0x33C00000)) == 0x0002);  // 1.5 * 2^-24 ties up
+
+    // Every half survives a round trip, and the midpoint between two
+    // neighbours rounds to the even one
+    for (uint32_t h = 0; h < 0x10000; h++) {
+        uint16_t half = static_cast<uint16_t>(h);
+        if ((half & 0x7FFF) > 0x7C00) {
+            continue;  // NaN
+        }
+        float value = fp16_to_float(half);
+        CHECK(float_to_fp16(value) == half);
+
+        if ((half & 0x7FFF) < 0x7BFF) {
+            uint16_t next = static_cast<uint16_t>(half + 1);
+            float mid = (value + fp16_to_float(next)) / 2;
+            CHECK(float_to_fp16(mid) == ((half & 1) ? next : half));
+        }
+    }
+}
+
+static void test_bf16_rounding() {
+    CHECK(float_to_bf16(1.0f) == 0x3F80);
+    CHECK(float_to_bf16(-0.0f) == 0x8000);
+    CHECK(float_to_bf16(bits_to_float(0x3F808000)) == 0x3F80);  // tie to even
+    CHECK(float_to_bf16(bits_to_float(0x3F818000)) == 0x3F82);  // tie up to even
+    CHECK(float_to_bf16(bits_to_float(0x3F808001)) == 0x3F81);
+    CHECK(float_to_bf16(bits_to_float(0x7F7FFFFF)) == 0x7F80);  // overflows to infinity
+    CHECK((float_to_bf16(std::numeric_limits<float>::quiet_NaN()) & 0x7FFF) > 0x7F80);
+    CHECK((float_to_bf16(bits_to_float(0x7F800001)) & 0x7FFF) > 0x7F80);  // NaN stays NaN
+
+    for (uint32_t h = 0; h < 0x10000; h++) {
+        uint16_t half = static_cast<uint16_t>(h);
+        if ((half & 0x7FFF) > 0x7F80) {
+            continue;
+        }
+        CHECK(float_to_bf16(bf16_to_float(half)) == half);
+    }
+}
+
+typedef void (*Half_kernel)(const float *, size_t, uint16_t *);
+typedef void (*Int8_kernel)(const float *, size_t, const float *, const float *, size_t,
+                            int8_t *);
+typedef void (*Bits_kernel)(const float *, size_t, uint8_t *);
+
+/* A SIMD variant of a kernel, tested when this CPU can run it */
+template <class Kernel>
+struct Variant {
+    bool usable;
+    Kernel kernel;
+};
+
+/* Every SIMD kernel this CPU runs against its scalar one, on random and edge values */
+static void test_simd_against_scalar(std::mt19937 &rng) {
+    std::vector<Variant<Half_kernel>> fp16 = {{true, to_fp16}};
+    std::vector<Variant<Half_kernel>> bf16 = {{true, to_bf16}};
+    std::vector<Variant<Int8_kernel>> int8 = {{true, to_int8}};
+    std::vector<Variant<Bits_kernel>> bits = {{true, to_bits}};
+#if defined(__x86_64__)
+    const Cpu_features &cpu = cpu_features();
+    fp16.push_back({cpu.avx2 && cpu.f16c, to_fp16_f16c});
+    fp16.push_back({cpu.avx512f, to_fp16_avx512});
+    bf16.push_back({cpu.avx2, to_bf16_avx2});
+    bf16.push_back({cpu.avx512bf16, to_bf16_avx512});
+    int8.push_back({cpu.avx2, to_int8_avx2});
+    bits.push_back({cpu.avx2, to_bits_avx2});
+#elif defined(__aarch64__)
+    fp16.push_back({true, to_fp16_neon});
+    int8.push_back({true, to_int8_neon});
+    bits.push_back({true, to_bits_neon});
+#endif
+
+    for (size_t dim : {1, 5, 8, 15, 16, 17, 100, 384, 768, 1031}) {
+        std::vector<float> vec = random_vector(rng, dim, 70000.0f);
+        // Values a cast would truncate, ties, tiny values and specials
+        float edges[] = {1.0f + 1.0f / 2048, 1.0f + 3.0f / 2048, 65520.0f, -65519.0f,
+                         bits_to_float(0x33000000), bits_to_float(0x3F808000),
+                         bits_to_float(0x3F818000), 1e-30f, -0.0f,
+                         std::numeric_limits<float>::infinity()};
+        for (size_t i = 0; i < dim && i < sizeof(edges) / sizeof(edges[0]); i++) {
+            vec[(i * 7) % dim] = edges[i];
+        }
+
+        std::vector<uint16_t> fast(dim), scalar(dim);
+        to_fp16_scalar(vec.data(), dim, scalar.data());
+        for (const auto &v : fp16) {
+            if (!v.usable) continue;
+            v.kernel(vec.data(), dim, fast.data());
+            CHECK(fast == scalar);
+        }
+
+        to_bf16_scalar(vec.data(), dim, scalar.data());
+        for (const auto &v : bf16) {
+            if (!v.usable) continue;
+            v.kernel(vec.data(), dim, fast.data());
+            CHECK(fast == scalar);
+        }
+
+        std::vector<float> finite = random_vector(rng, dim, 2.0f);
+        std::vector<uint8_t> packed((dim + 7) / 8), packed_scalar((dim + 7) / 8);
+        to_bits_scalar(finite.data(), dim, packed_scalar.data());
+        for (const auto &v : bits) {
+            if (!v.usable) continue;
+            v.kernel(finite.data(), dim, packed.data());
+            CHECK(packed == packed_scalar);
+        }
+
+        // Per-vector and per-dimension int8
+        std::vector<float> mul(dim), add(dim);
+        for (size_t i = 0; i < dim; i++) {
+            mul[i] = 40.0f + static_cast<float>(i % 5);
+            add[i] = (i % 3) * 0.5f;
+        }
+        float one_mul = 63.5f, zero_add = 0;
+        std::vector<int8_t> q(dim), q_scalar(dim), qd(dim), qd_scalar(dim);
+        to_int8_scalar(finite.data(), dim, &one_mul, &zero_add, 0, q_scalar.data());
+        to_int8_scalar(finite.data(), dim, mul.data(), add.data(), 1, qd_scalar.data());
+        for (const auto &v : int8) {
+            if (!v.usable) continue;
+            v.kernel(finite.data(), dim, &one_mul, &zero_add, 0, q.data());
+            CHECK(q == q_scalar);
+            v.kernel(finite.data(), dim, mul.data(), add.data(), 1, qd.data());
+            CHECK(qd == qd_scalar);
+        }
+
+        CHECK(max_abs(finite.data(), dim) == max_abs_scalar(finite.data(), dim));
+        float sum = sum_squares_scalar(finite.data(), dim);
+        CHECK(std::fabs(sum_squares(finite.data(), dim) - sum) <= sum * 1e-5f);
+
+        std::vector<float> scaled(dim), scaled_scalar(dim);
+        scale(finite.data(), dim, 0.25f, scaled.data());
+        scale_scalar(finite.data(), dim, 0.25f, scaled_scalar.data());
+        CHECK(scaled == scaled_scalar);
+    }
+}
+
+int main() {
+    std::mt19937 rng(45);
+
+    test_int8_packing(rng);
+    test_int8_calibration(rng);
+    test_binary_packing(rng);
+    test_fp16_rounding();
+    test_bf16_rounding();
+    test_simd_against_scalar(rng);
+
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("gembed_quantize_test: all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,485 @@
+/* Copyright (c) 2025, Joel Díaz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+
+#include "gembed_remote.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "gembed_remote_proto.h"
+#include "gembed_services.h"
+#include "gembed_vars.h"
+
+#if !defined(MSG_NOSIGNAL)
+#define MSG_NOSIGNAL 0  /* SO_NOSIGPIPE is set on the socket instead */
+#endif
+
+#define REMOTE_MAX_CONNECTIONS 64
+
+/* A request waiting for its reply */
+struct Remote_call {
+    std::mutex lock;
+    std::condition_variable done_cv;
+    bool done = false;
+
+    int status = 0;
+    std::string message;
+    uint32_t n_vectors = 0;
+    uint32_t dim = 0;
+    std::unique_ptr<float[]> vectors;
+};
+
+struct Remote_connection {
+    std::mutex write_lock;  /* one frame at a time; also held to (re)connect */
+    int fd = -1;
+    uint32_t generation = 0;
+    std::thread reader;
+
+    std::mutex lock;        /* guards broken and pending */
+    bool broken = false;
+    std::unordered_map<uint32_t, std::shared_ptr<Remote_call>> pending;
+};
+
+static Remote_connection connections[REMOTE_MAX_CONNECTIONS];
+static std::atomic<uint32_t> next_connection{0};
+static std::atomic<uint32_t> next_id{1};
+
+static std::mutex socket_lock;
+static std::string socket_path;
+static std::atomic<uint32_t> socket_generation{0};
+
+void remote_set_socket(const char *path) {
+    std::lock_guard<std::mutex> guard(socket_lock);
+    socket_path = path ? path : "";
+    socket_generation.fetch_add(1);
+}
+
+static bool send_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool recv_all(int fd, unsigned char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = recv(fd, data, len, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+/* Reads one frame without its length field: id, type, body */
+static bool read_frame(int fd, std::vector<unsigned char> &frame) {
+    unsigned char length_bytes[4];
+    if (!recv_all(fd, length_bytes, sizeof(length_bytes))) {
+        return false;
+    }
+
+    uint32_t length = remote_get_u32(length_bytes);
+    if (length < REMOTE_HEADER_SIZE - 4 || length > REMOTE_MAX_FRAME) {
+        return false;
+    }
+
+    frame.resize(length);
+    return recv_all(fd, frame.data(), length);
+}
+
+/* Fills call from a reply frame. Returns false if the frame is malformed */
+static bool parse_reply(const std::vector<unsigned char> &frame, Remote_call *call) {
+    const unsigned char *body = frame.data() + 5;
+    size_t body_len = frame.size() - 5;
+    uint8_t type = frame[4];
+
+    if (body_len < 4) {
+        return false;
+    }
+    call->status = static_cast<int32_t>(remote_get_u32(body));
+    body += 4;
+    body_len -= 4;
+
+    if (call->status != 0) {
+        size_t len = body_len >= 2 ? std::min<size_t>(remote_get_u16(body), body_len - 2) : 0;
+        call->message.assign(reinterpret_cast<const char *>(body) + 2, len);
+        return true;
+    }
+
+    if (type == (REMOTE_EMBED | REMOTE_REPLY)) {
+        if (body_len < 8) {
+            return false;
+        }
+        call->n_vectors = remote_get_u32(body);
+        call->dim = remote_get_u32(body + 4);
+
+        uint64_t n_floats = static_cast<uint64_t>(call->n_vectors) * call->dim;
+        if (n_floats * sizeof(float) != body_len - 8) {
+            return false;
+        }
+        call->vectors.reset(new float[n_floats]);
+        remote_get_floats(body + 8, n_floats, call->vectors.get());
+    } else if (type == (REMOTE_MODEL | REMOTE_REPLY)) {
+        call->dim = body_len >= 4 ? remote_get_u32(body) : 0;
+    }
+    return true;
+}
+
+static void finish_call(Remote_call *call) {
+    std::lock_guard<std::mutex> guard(call->lock);
+    call->done = true;
+    call->done_cv.notify_all();
+}
+
+/* Hands replies to their callers until the connection ends */
+static void read_replies(Remote_connection *conn, int fd) {
+    std::vector<unsigned char> frame;
+
+    while (read_frame(fd, frame)) {
+        uint32_t id = remote_get_u32(frame.data());
+        std::shared_ptr<Remote_call> call;
+        {
+            std::lock_guard<std::mutex> guard(conn->lock);
+            auto it = conn->pending.find(id);
+            if (it == conn->pending.end()) {
+                continue;  // its caller timed out
+            }
+            call = std::move(it->second);
+            conn->pending.erase(it);
+        }
+
+        bool valid;
+        {
+            std::lock_guard<std::mutex> guard(call->lock);
+            valid = parse_reply(frame, call.get());
+            if (!valid) {
+                call->status = -1;
+                call->message = "malformed reply";
+            }
+        }
+        finish_call(call.get());
+
+        if (!valid) {
+            break;
+        }
+    }
+
+    std::unordered_map<uint32_t, std::shared_ptr<Remote_call>> orphans;
+    {
+        std::lock_guard<std::mutex> guard(conn->lock);
+        conn->broken = true;
+        orphans.swap(conn->pending);
+    }
+
+    for (auto &item : orphans) {
+        {
+            std::lock_guard<std::mutex> guard(item.second->lock);
+            item.second->status = -1;
+            item.second->message = "connection to the inference server lost";
+        }
+        finish_call(item.second.get());
+    }
+}
+
+static void set_timeout(int fd, int option, unsigned int timeout_ms) {
+    struct timeval tv;
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, option, &tv, sizeof(tv));
+}
+
+/* Called with conn->write_lock held */
+static void close_connection(Remote_connection *conn) {
+    if (conn->fd < 0) {
+        return;
+    }
+    shutdown(conn->fd, SHUT_RDWR);
+    conn->reader.join();
+    close(conn->fd);
+    conn->fd = -1;
+    gembed_status.remote_connections.fetch_sub(1, std::memory_order_relaxed);
+}
+
+/* Opens the socket and shakes hands. Returns the descriptor, or -1 */
+static int open_socket(char *err, size_t err_size) {
+    std::string path;
+    {
+        std::lock_guard<std::mutex> guard(socket_lock);
+        path = socket_path;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if (path.empty()) {
+        snprintf(err, err_size, "gembed.remote_socket is not set");
+        return -1;
+    }
+    if (path.size() >= sizeof(addr.sun_path)) {
+        snprintf(err, err_size, "gembed.remote_socket is too long");
+        return -1;
+    }
+    memcpy(addr.sun_path, path.c_str(), path.size());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        snprintf(err, err_size, "cannot create socket: %s", strerror(errno));
+        return -1;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+#if defined(SO_NOSIGPIPE)
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+
+    // Writes never block longer than a request may take; reads do so only here
+    set_timeout(fd, SO_SNDTIMEO, gembed_remote_timeout_ms);
+    set_timeout(fd, SO_RCVTIMEO, gembed_remote_timeout_ms);
+
+    if (connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0) {
+        snprintf(err, err_size, "cannot connect to %s: %s", path.c_str(),
+                 strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    std::string frame;
+    remote_begin_frame(frame, 0, REMOTE_HELLO);
+    remote_put_u32(frame, REMOTE_MAGIC);
+    remote_put_u16(frame, REMOTE_VERSION);
+    remote_end_frame(frame);
+
+    std::vector<unsigned char> reply;
+    Remote_call hello;
+    if (!send_all(fd, frame.data(), frame.size()) || !read_frame(fd, reply) ||
+        reply.size() < 5 || reply[4] != (REMOTE_HELLO | REMOTE_REPLY) ||
+        !parse_reply(reply, &hello)) {
+        snprintf(err, err_size, "no handshake from the inference server at %s",
+                 path.c_str());
+        close(fd);
+        return -1;
+    }
+    if (hello.status != 0) {
+        snprintf(err, err_size, "inference server refused the connection: %s",
+                 hello.message.c_str());
+        close(fd);
+        return -1;
+    }
+
+    set_timeout(fd, SO_RCVTIMEO, 0);
+    return fd;
+}
+
+/* Called with conn->write_lock held. Returns false and fills err on failure */
+static bool ensure_connected(Remote_connection *conn, char *err, size_t err_size) {
+    uint32_t generation = socket_generation.load();
+
+    if (conn->fd >= 0) {
+        bool broken;
+        bool busy;
+        {
+            std::lock_guard<std::mutex> guard(conn->lock);
+            broken = conn->broken;
+            busy = !conn->pending.empty();
+        }
+        // A new socket path takes over once the connection is idle
+        if (!broken && (conn->generation == generation || busy)) {
+            return true;
+        }
+        close_connection(conn);
+    }
+
+    int fd = open_socket(err, err_size);
+    if (fd < 0) {
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(conn->lock);
+        conn->broken = false;
+    }
+
+    try {
+        conn->reader = std::thread(read_replies, conn, fd);
+    } catch (const std::system_error &) {
+        snprintf(err, err_size, "cannot start a reader thread");
+        close(fd);
+        return false;
+    }
+
+    conn->fd = fd;
+    conn->generation = generation;
+    gembed_status.remote_connections.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+/*
+ * Sends a finished frame and waits for its reply. Returns NULL and fills
+ * err on failure, including an error status from the server.
+ */
+static std::shared_ptr<Remote_call> call_server(const std::string &frame, uint32_t id,
+                                                char *err, size_t err_size) {
+    unsigned int n_connections = std::min<unsigned int>(
+        std::max(1U, gembed_remote_connections), REMOTE_MAX_CONNECTIONS);
+    Remote_connection *conn =
+        &connections[next_connection.fetch_add(1, std::memory_order_relaxed) %
+                     n_connections];
+    auto call = std::make_shared<Remote_call>();
+
+    gembed_status.remote_requests.fetch_add(1, std::memory_order_relaxed);
+
+    {
+        std::lock_guard<std::mutex> writing(conn->write_lock);
+        if (!ensure_connected(conn, err, err_size)) {
+            return nullptr;
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(conn->lock);
+            conn->pending[id] = call;
+        }
+
+        if (!send_all(conn->fd, frame.data(), frame.size())) {
+            snprintf(err, err_size, "cannot send to the inference server: %s",
+                     strerror(errno));
+            {
+                std::lock_guard<std::mutex> guard(conn->lock);
+                conn->pending.erase(id);
+            }
+            // A partial frame leaves the stream unusable; the reader fails the rest
+            shutdown(conn->fd, SHUT_RDWR);
+            return nullptr;
+        }
+    }
+
+    std::unique_lock<std::mutex> guard(call->lock);
+    if (!call->done_cv.wait_for(guard,
+                                std::chrono::milliseconds(gembed_remote_timeout_ms),
+                                [&call] { return call->done; })) {
+        guard.unlock();
+        {
+            std::lock_guard<std::mutex> pending_guard(conn->lock);
+            conn->pending.erase(id);
+        }
+        snprintf(err, err_size, "inference server did not answer within "
+                 "gembed.remote_timeout_ms");
+        return nullptr;
+    }
+
+    if (call->status != 0) {
+        snprintf(err, err_size, "inference server: %s", call->message.c_str());
+        return nullptr;
+    }
+    return call;
+}
+
+bool remote_check_model(const char *model, char *err, size_t err_size) {
+    size_t model_len = strlen(model);
+    if (model_len > UINT16_MAX) {
+        snprintf(err, err_size, "Invalid or unsupported model");
+        return true;
+    }
+
+    uint32_t id = next_id.fetch_add(1);
+    std::string frame;
+    remote_begin_frame(frame, id, REMOTE_MODEL);
+    remote_put_u16(frame, static_cast<uint16_t>(model_len));
+    frame.append(model, model_len);
+    remote_end_frame(frame);
+
+    if (!call_server(frame, id, err, err_size)) {
+        gembed_status.remote_failures.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
+int remote_generate(const std::string &model, const InputData *input,
+                    EmbeddingBatch *out_batch) {
+    *out_batch = EmbeddingBatch{};
+    char err[512];
+
+    uint32_t id = next_id.fetch_add(1);
+    std::string frame;
+    remote_begin_frame(frame, id, REMOTE_EMBED);
+    remote_put_u16(frame, static_cast<uint16_t>(model.size()));
+    frame.append(model);
+    remote_put_u32(frame, static_cast<uint32_t>(input->n_text));
+
+    for (size_t i = 0; i < input->n_text; i++) {
+        const StringSlice &text = input->text_data[i];
+        if (text.len > REMOTE_MAX_FRAME || frame.size() + text.len > REMOTE_MAX_FRAME) {
+            log_message(ERROR_LEVEL, "texts too large for one remote request");
+            return -1;
+        }
+        remote_put_u32(frame, static_cast<uint32_t>(text.len));
+        frame.append(text.ptr, text.len);
+    }
+    remote_end_frame(frame);
+
+    std::shared_ptr<Remote_call> call = call_server(frame, id, err, sizeof(err));
+    if (!call || call->n_vectors != input->n_text) {
+        gembed_status.remote_failures.fetch_add(1, std::memory_order_relaxed);
+        log_message(ERROR_LEVEL, call ? "inference server returned the wrong "
+                                        "number of vectors" : err);
+        return -1;
+    }
+
+    // The reply buffer becomes the batch
+    out_batch->data = call->vectors.release();
+    out_batch->n_vectors = call->n_vectors;
+    out_batch->dim = call->dim;
+    return 0;
+}
+
+void remote_free_batch(EmbeddingBatch *batch) {
+    delete[] batch->data;
+    *batch = EmbeddingBatch{};
+}
+
+void remote_stop() {
+    for (Remote_connection &conn : connections) {
+        std::lock_guard<std::mutex> writing(conn.write_lock);
+        close_connection(&conn);
+    }
+}
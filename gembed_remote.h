@@ -0,0 +1,54 @@
+/* Copyright (c) 2025, Joel Díaz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+#ifndef GEMBED_REMOTE_H
+#define GEMBED_REMOTE_H
+
+#include <cstddef>
+#include <string>
+#include "mysql_gembed.h"
+
+/*
+ * The `remote` embedding method: inference on a local server shared by
+ * every mysqld on the host, reached over the Unix socket in
+ * gembed.remote_socket (protocol in gembed_remote_proto.h).
+ *
+ * Requests are spread over up to gembed.remote_connections connections.
+ * Each connection is pipelined: any number of pool workers can have a
+ * request in flight on it, and a reader thread hands replies back by id.
+ * A broken connection fails its in-flight requests and is reopened by the
+ * next one.
+ */
+
+#define REMOTE_METHOD "remote"
+
+/* method_id of remote models in the registry; library ids are never negative */
+#define REMOTE_METHOD_ID -2
+
+/* Asks the server whether it serves model. Returns true and fills err if not */
+bool remote_check_model(const char *model, char *err, size_t err_size);
+
+/* generate_embeddings() on the server. Free the batch with remote_free_batch() */
+int remote_generate(const std::string &model, const InputData *input,
+                    EmbeddingBatch *out_batch);
+
+void remote_free_batch(EmbeddingBatch *batch);
+
+/* Socket for new connections. Idle connections to the old one are reopened */
+void remote_set_socket(const char *path);
+
+/* Closes every connection */
+void remote_stop();
+
+#endif /* GEMBED_REMOTE_H */
@@ -0,0 +1,122 @@
+/* Copyright (c) 2025, Joel Díaz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+#ifndef GEMBED_REMOTE_PROTO_H
+#define GEMBED_REMOTE_PROTO_H
+
+/*
+ * Wire protocol between the component's `remote` method and a local
+ * inference server (gembed_remote_server is the reference one).
+ *
+ * Frames go over a Unix stream socket. All integers are little endian:
+ *
+ *   frame := u32 length | u32 id | u8 type | body     (length counts id onward)
+ *
+ * Requests:
+ *   HELLO  body := u32 magic | u16 version            (first frame, id 0)
+ *   MODEL  body := u16 model_len | model
+ *   EMBED  body := u16 model_len | model | u32 n | n * (u32 len | bytes)
+ *
+ * A reply carries the request's id and type | REMOTE_REPLY:
+ *   body := i32 status | payload
+ *   status 0, HELLO: nothing
+ *   status 0, MODEL: u32 dim (0 if not known yet)
+ *   status 0, EMBED: u32 n_vectors | u32 dim | n_vectors * dim f32
+ *   status != 0:     u16 message_len | message
+ *
+ * Clients may send any number of requests before reading replies, and
+ * servers may answer them in any order. The model string is the server's
+ * business; the reference server reads "method:model" and falls back to
+ * its default method without a colon.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#define REMOTE_MAGIC 0x524D4547U  /* "GEMR" */
+#define REMOTE_VERSION 1
+
+#define REMOTE_HELLO 1
+#define REMOTE_MODEL 2
+#define REMOTE_EMBED 3
+#define REMOTE_REPLY 0x80
+
+/* Frames larger than this are a protocol error */
+#define REMOTE_MAX_FRAME (256U * 1024 * 1024)
+
+/* Size of length, id and type */
+#define REMOTE_HEADER_SIZE 9
+
+static inline void remote_put_u16(std::string &buf, uint16_t v) {
+    char bytes[2] = {static_cast<char>(v), static_cast<char>(v >> 8)};
+    buf.append(bytes, 2);
+}
+
+static inline void remote_put_u32(std::string &buf, uint32_t v) {
+    char bytes[4] = {static_cast<char>(v), static_cast<char>(v >> 8),
+                     static_cast<char>(v >> 16), static_cast<char>(v >> 24)};
+    buf.append(bytes, 4);
+}
+
+static inline uint16_t remote_get_u16(const unsigned char *p) {
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t remote_get_u32(const unsigned char *p) {
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+           (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+/* Starts a frame in buf; remote_end_frame() fills in its length */
+static inline void remote_begin_frame(std::string &buf, uint32_t id, uint8_t type) {
+    buf.clear();
+    remote_put_u32(buf, 0);
+    remote_put_u32(buf, id);
+    buf.push_back(static_cast<char>(type));
+}
+
+static inline void remote_end_frame(std::string &buf) {
+    uint32_t length = static_cast<uint32_t>(buf.size() - 4);
+    for (int i = 0; i < 4; i++) {
+        buf[i] = static_cast<char>(length >> (8 * i));
+    }
+}
+
+/* Appends floats in wire order */
+static inline void remote_put_floats(std::string &buf, const float *v, size_t n) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    buf.append(reinterpret_cast<const char *>(v), n * sizeof(float));
+#else
+    for (size_t i = 0; i < n; i++) {
+        uint32_t bits;
+        memcpy(&bits, &v[i], sizeof(bits));
+        remote_put_u32(buf, bits);
+    }
+#endif
+}
+
+static inline void remote_get_floats(const unsigned char *p, size_t n, float *out) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy(out, p, n * sizeof(float));
+#else
+    for (size_t i = 0; i < n; i++) {
+        uint32_t bits = remote_get_u32(p + 4 * i);
+        memcpy(&out[i], &bits, sizeof(bits));
+    }
+#endif
+}
+
+#endif /* GEMBED_REMOTE_PROTO_H */
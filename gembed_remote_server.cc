@@ -0,0 +1,381 @@
+/* Copyright (c) 2025, Joel Díaz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+
+/*
+ * gembed_remote_server: reference inference server for the `remote` method.
+ *
+ * Serves any number of mysqld instances on one Unix socket, so the host
+ * keeps a single copy of each model. Requests from all connections are
+ * queued together and merged per model into library calls of up to
+ * --max-batch texts, waiting up to --wait-us for more to arrive. Replies
+ * go back as each batch finishes, in any order. See gembed_remote_proto.h.
+ *
+ *   gembed_remote_server --socket PATH [--threads N] [--max-batch N]
+ *                        [--wait-us N] [--method NAME]
+ *
+ * Model strings are "method:model", or just the model for --method
+ * (fastembed by default).
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "mysql_gembed.h"
+#include "gembed_remote_proto.h"
+
+#if !defined(MSG_NOSIGNAL)
+#define MSG_NOSIGNAL 0
+#endif
+
+struct Client {
+    int fd = -1;
+    std::mutex write_lock;
+
+    ~Client() {
+        if (fd >= 0) close(fd);
+    }
+
+    /* Replies from several batches interleave, whole frames at a time */
+    void send_frame(const std::string &frame) {
+        std::lock_guard<std::mutex> guard(write_lock);
+        const char *data = frame.data();
+        size_t len = frame.size();
+        while (len > 0) {
+            ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+            if (n <= 0) {
+                return;  // the reader notices the dead connection
+            }
+            data += n;
+            len -= n;
+        }
+    }
+};
+
+struct Request {
+    std::shared_ptr<Client> client;
+    uint32_t id = 0;
+    int method_id = 0;
+    int model_id = 0;
+
+    /* Texts point into the frame they arrived in */
+    std::vector<unsigned char> frame;
+    std::vector<StringSlice> texts;
+};
+
+static std::string default_method = "fastembed";
+static size_t max_batch = 256;
+static unsigned int wait_us = 2000;
+
+static std::mutex queue_lock;
+static std::condition_variable queue_cv;
+static std::deque<std::unique_ptr<Request>> queue;
+
+static std::mutex models_lock;
+static std::map<std::string, std::pair<int, int>> models;
+
+static const char *socket_path = nullptr;
+
+/* Resolves "method:model" to library ids. Returns false if unknown */
+static bool lookup_model(const std::string &name, int *method_id, int *model_id) {
+    std::lock_guard<std::mutex> guard(models_lock);
+    auto it = models.find(name);
+    if (it != models.end()) {
+        *method_id = it->second.first;
+        *model_id = it->second.second;
+        return true;
+    }
+
+    size_t colon = name.find(':');
+    std::string method = colon == std::string::npos ? default_method : name.substr(0, colon);
+    std::string model = colon == std::string::npos ? name : name.substr(colon + 1);
+
+    *method_id = validate_embedding_method(method.c_str());
+    if (*method_id < 0) return false;
+    *model_id = validate_embedding_model(*method_id, model.c_str(), INPUT_TYPE_TEXT);
+    if (*model_id < 0) return false;
+
+    models[name] = {*method_id, *model_id};
+    return true;
+}
+
+static void send_status(Client *client, uint32_t id, uint8_t type, int32_t status,
+                        const char *message) {
+    std::string frame;
+    remote_begin_frame(frame, id, type | REMOTE_REPLY);
+    remote_put_u32(frame, static_cast<uint32_t>(status));
+    if (status != 0) {
+        size_t len = strlen(message);
+        remote_put_u16(frame, static_cast<uint16_t>(len));
+        frame.append(message, len);
+    }
+    remote_end_frame(frame);
+    client->send_frame(frame);
+}
+
+/* Runs one merged library call and answers every request in it */
+static void run_batch(std::vector<std::unique_ptr<Request>> &group) {
+    std::vector<StringSlice> texts;
+    for (const auto &request : group) {
+        texts.insert(texts.end(), request->texts.begin(), request->texts.end());
+    }
+
+    InputData input_data{INPUT_TYPE_TEXT, nullptr, 0, texts.data(), texts.size()};
+    EmbeddingBatch batch{};
+    int err = generate_embeddings(group.front()->method_id, group.front()->model_id,
+                                  &input_data, &batch);
+    if (err == 0 && batch.n_vectors != texts.size()) {
+        err = -1;
+    }
+
+    size_t offset = 0;
+    for (const auto &request : group) {
+        size_t n = request->texts.size();
+        if (err != 0) {
+            send_status(request->client.get(), request->id, REMOTE_EMBED, err,
+                        "embedding generation failed");
+            continue;
+        }
+
+        std::string frame;
+        frame.reserve(REMOTE_HEADER_SIZE + 12 + n * batch.dim * sizeof(float));
+        remote_begin_frame(frame, request->id, REMOTE_EMBED | REMOTE_REPLY);
+        remote_put_u32(frame, 0);
+        remote_put_u32(frame, static_cast<uint32_t>(n));
+        remote_put_u32(frame, static_cast<uint32_t>(batch.dim));
+        remote_put_floats(frame, batch.data + offset * batch.dim, n * batch.dim);
+        remote_end_frame(frame);
+        request->client->send_frame(frame);
+        offset += n;
+    }
+
+    free_embedding_batch(&batch);
+}
+
+static void batch_worker() {
+    std::unique_lock<std::mutex> guard(queue_lock);
+
+    for (;;) {
+        queue_cv.wait(guard, [] { return !queue.empty(); });
+
+        std::vector<std::unique_ptr<Request>> group;
+        size_t n_texts = 0;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(wait_us);
+
+        // Gather requests for the first queued model, across all clients
+        for (;;) {
+            for (auto it = queue.begin(); it != queue.end();) {
+                Request *request = it->get();
+                bool same = group.empty() ||
+                            (request->method_id == group.front()->method_id &&
+                             request->model_id == group.front()->model_id);
+                if (same && (group.empty() || n_texts + request->texts.size() <= max_batch)) {
+                    n_texts += request->texts.size();
+                    group.push_back(std::move(*it));
+                    it = queue.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+
+            if (n_texts >= max_batch || std::chrono::steady_clock::now() >= deadline) {
+                break;
+            }
+            queue_cv.wait_until(guard, deadline);
+        }
+
+        guard.unlock();
+        run_batch(group);
+        guard.lock();
+    }
+}
+
+static bool recv_all(int fd, unsigned char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = recv(fd, data, len, 0);
+        if (n <= 0) return false;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+/* Parses an EMBED body into request. Returns false if malformed */
+static bool parse_embed(Request *request, std::string *model) {
+    const unsigned char *p = request->frame.data() + 5;
+    const unsigned char *end = request->frame.data() + request->frame.size();
+
+    if (end - p < 2) return false;
+    size_t model_len = remote_get_u16(p);
+    p += 2;
+    if (static_cast<size_t>(end - p) < model_len + 4) return false;
+    model->assign(reinterpret_cast<const char *>(p), model_len);
+    p += model_len;
+
+    uint32_t n = remote_get_u32(p);
+    p += 4;
+    for (uint32_t i = 0; i < n; i++) {
+        if (end - p < 4) return false;
+        size_t len = remote_get_u32(p);
+        p += 4;
+        if (static_cast<size_t>(end - p) < len) return false;
+        request->texts.push_back({reinterpret_cast<const char *>(p), len});
+        p += len;
+    }
+    return true;
+}
+
+static void serve_client(std::shared_ptr<Client> client) {
+    bool greeted = false;
+
+    for (;;) {
+        unsigned char length_bytes[4];
+        if (!recv_all(client->fd, length_bytes, 4)) break;
+        uint32_t length = remote_get_u32(length_bytes);
+        if (length < REMOTE_HEADER_SIZE - 4 || length > REMOTE_MAX_FRAME) break;
+
+        auto request = std::make_unique<Request>();
+        request->frame.resize(length);
+        if (!recv_all(client->fd, request->frame.data(), length)) break;
+
+        request->client = client;
+        request->id = remote_get_u32(request->frame.data());
+        uint8_t type = request->frame[4];
+        const unsigned char *body = request->frame.data() + 5;
+        size_t body_len = length - 5;
+
+        if (!greeted) {
+            bool ok = type == REMOTE_HELLO && body_len >= 6 &&
+                      remote_get_u32(body) == REMOTE_MAGIC &&
+                      remote_get_u16(body + 4) == REMOTE_VERSION;
+            send_status(client.get(), request->id, REMOTE_HELLO, ok ? 0 : -1,
+                        "unsupported protocol version");
+            if (!ok) break;
+            greeted = true;
+            continue;
+        }
+
+        if (type == REMOTE_MODEL) {
+            std::string model;
+            if (body_len >= 2 && body_len - 2 >= remote_get_u16(body)) {
+                model.assign(reinterpret_cast<const char *>(body) + 2, remote_get_u16(body));
+            }
+            int method_id, model_id;
+            if (lookup_model(model, &method_id, &model_id)) {
+                std::string frame;
+                remote_begin_frame(frame, request->id, REMOTE_MODEL | REMOTE_REPLY);
+                remote_put_u32(frame, 0);
+                remote_put_u32(frame, 0);  // dimension not known before the first call
+                remote_end_frame(frame);
+                client->send_frame(frame);
+            } else {
+                send_status(client.get(), request->id, REMOTE_MODEL, -1,
+                            "Invalid or unsupported model");
+            }
+        } else if (type == REMOTE_EMBED) {
+            std::string model;
+            if (!parse_embed(request.get(), &model)) break;
+            if (!lookup_model(model, &request->method_id, &request->model_id)) {
+                send_status(client.get(), request->id, REMOTE_EMBED, -1,
+                            "Invalid or unsupported model");
+                continue;
+            }
+            {
+                std::lock_guard<std::mutex> guard(queue_lock);
+                queue.push_back(std::move(request));
+            }
+            queue_cv.notify_one();
+        } else {
+            send_status(client.get(), request->id, type, -1, "unknown request type");
+        }
+    }
+
+    shutdown(client->fd, SHUT_RDWR);
+}
+
+static void on_signal(int) {
+    if (socket_path) unlink(socket_path);
+    _exit(0);
+}
+
+int main(int argc, char **argv) {
+    unsigned int threads = 1;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        const char *opt = argv[i];
+        const char *val = argv[i + 1];
+        if (!strcmp(opt, "--socket")) socket_path = val;
+        else if (!strcmp(opt, "--threads")) threads = std::max(1, atoi(val));
+        else if (!strcmp(opt, "--max-batch")) max_batch = std::max(1, atoi(val));
+        else if (!strcmp(opt, "--wait-us")) wait_us = std::max(0, atoi(val));
+        else if (!strcmp(opt, "--method")) default_method = val;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if (!socket_path || strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "usage: gembed_remote_server --socket PATH [--threads N] "
+                        "[--max-batch N] [--wait-us N] [--method NAME]\n");
+        return 2;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socket_path);
+    if (listener < 0 ||
+        bind(listener, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0 ||
+        listen(listener, 128) != 0) {
+        fprintf(stderr, "gembed_remote_server: cannot listen on %s: %s\n", socket_path,
+                strerror(errno));
+        return 1;
+    }
+
+    for (unsigned int i = 0; i < threads; i++) {
+        std::thread(batch_worker).detach();
+    }
+
+    for (;;) {
+        int fd = accept(listener, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            fprintf(stderr, "gembed_remote_server: accept failed: %s\n", strerror(errno));
+            return 1;
+        }
+        auto client = std::make_shared<Client>();
+        client->fd = fd;
+        std::thread(serve_client, client).detach();
+    }
+}
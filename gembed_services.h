@@ -0,0 +1,52 @@
+/* Copyright (c) 2025, Joel Díaz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+#ifndef GEMBED_SERVICES_H
+#define GEMBED_SERVICES_H
+
+/* Server services acquired in mysql_gembed.cc and shared by the other units */
+
+#include <mysql/components/component_implementation.h>
+#include <mysql/components/services/component_sys_var_service.h>
+#include <mysql/components/services/log_builtins.h>
+#include <mysql/components/services/mysql_command_services.h>
+#include <mysql/components/services/mysql_current_thread_reader.h>
+#include <mysql/components/services/mysql_thd_attributes.h>
+#include <mysql/components/services/security_context.h>
+#include <mysql/components/services/status_variable_registration.h>
+
+extern REQUIRES_SERVICE_PLACEHOLDER(log_builtins);
+extern REQUIRES_SERVICE_PLACEHOLDER(log_builtins_string);
+extern REQUIRES_SERVICE_PLACEHOLDER(component_sys_variable_register);
+extern REQUIRES_SERVICE_PLACEHOLDER(component_sys_variable_unregister);
+extern REQUIRES_SERVICE_PLACEHOLDER(status_variable_registration);
+extern REQUIRES_SERVICE_PLACEHOLDER(mysql_command_factory);
+extern REQUIRES_SERVICE_PLACEHOLDER(mysql_command_options);
+extern REQUIRES_SERVICE_PLACEHOLDER(mysql_command_query);
+extern REQUIRES_SERVICE_PLACEHOLDER(mysql_command_query_result);
+extern REQUIRES_SERVICE_PLACEHOLDER(mysql_command_field_info);
+extern REQUIRES_SERVICE_PLACEHOLDER(mysql_command_error_info);
+extern REQUIRES_SERVICE_PLACEHOLDER(mysql_command_thread);
+extern REQUIRES_SERVICE_PLACEHOLDER(mysql_current_thread_reader);
+extern REQUIRES_SERVICE_PLACEHOLDER(mysql_thd_attributes);
+extern REQUIRES_SERVICE_PLACEHOLDER(mysql_thd_security_context);
+extern REQUIRES_SERVICE_PLACEHOLDER(mysql_security_context_options);
+
+/* Writes a message prefixed with the component name to the error log */
+void log_message(int severity, const char *msg);
+
+/* True if the calling session's statement was killed or timed out */
+bool session_killed();
+
+#endif /* GEMBED_SERVICES_H */
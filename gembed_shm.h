@@ -0,0 +1,111 @@
+/* Copyright (c) 2025, Joel Díaz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+#ifndef GEMBED_SHM_H
+#define GEMBED_SHM_H
+
+/*
+ * Shared memory layout between the component and the gembed_helper
+ * inference process (Linux only).
+ *
+ * The segment is a header followed by fixed-size slots. A slot is a
+ * single-entry channel: a pool worker claims a free slot, writes its texts
+ * into it and flips the state to REQUEST; a helper thread dedicated to the
+ * slot runs the library on the texts in place and writes the vectors back
+ * over them, then flips the state to RESPONSE. The state word doubles as a
+ * futex, so neither side needs a lock or a syscall while the other is fast.
+ *
+ * Request data:  u64 text lengths[n_texts], then the text bytes
+ * Response data: n_vectors * dim floats
+ */
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__linux__)
+#include <climits>
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define GEMBED_SHM_MAGIC 0x47454D42U  /* "GEMB" */
+#define GEMBED_SHM_VERSION 2
+
+#define HELPER_SLOTS 64
+#define HELPER_SLOT_DATA (4UL * 1024 * 1024)
+
+/* Error a helper returns when the vectors do not fit in the slot */
+#define HELPER_ERR_TOO_BIG -1000
+
+enum Slot_state : uint32_t {
+    SLOT_FREE,      /* nobody owns it */
+    SLOT_CLAIMED,   /* a worker is filling it */
+    SLOT_REQUEST,   /* waiting for the helper */
+    SLOT_RUNNING,   /* the helper is working on it */
+    SLOT_RESPONSE   /* results ready, the worker still owns it */
+};
+
+struct alignas(64) Shm_slot {
+    std::atomic<uint32_t> state;
+    uint32_t runner;  /* generation of the helper that took the request */
+
+    int32_t method_id;
+    int32_t model_id;
+    uint64_t n_texts;
+
+    int32_t err;
+    uint32_t dim;
+    uint64_t n_vectors;
+
+    alignas(64) unsigned char data[HELPER_SLOT_DATA];
+};
+
+struct alignas(64) Shm_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t n_slots;
+
+    /* A helper serves while this matches the generation it was started with */
+    std::atomic<uint32_t> generation;
+
+    /* Bumped whenever a slot is freed, for workers waiting for one */
+    std::atomic<uint32_t> free_seq;
+
+    alignas(64) Shm_slot slots[HELPER_SLOTS];
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free,
+              "shared memory atomics must be lock free");
+
+#if defined(__linux__)
+/* Waits while *word == expected, at most timeout_us. Works across processes */
+static inline void shm_futex_wait(std::atomic<uint32_t> *word, uint32_t expected,
+                                  long timeout_us) {
+    struct timespec timeout;
+    timeout.tv_sec = timeout_us / 1000000;
+    timeout.tv_nsec = (timeout_us % 1000000) * 1000;
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAIT, expected,
+            &timeout, nullptr, 0);
+}
+
+static inline void shm_futex_wake(std::atomic<uint32_t> *word) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAKE, INT_MAX,
+            nullptr, nullptr, 0);
+}
+#endif
+
+#endif /* GEMBED_SHM_H */
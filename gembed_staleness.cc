@@ -0,0 +1,130 @@
+/* Copyright (c) 2025, Joel Díaz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+
+#include "gembed_staleness.h"
+
+#include <cstdint>
+#include <cstdio>
+#include "gembed_hash.h"
+#include "gembed_models.h"
+#include "gembed_services.h"
+
+#define MYSQL_ERRMSG_SIZE 512
+
+/* The hash runs over the bytes of text as given, in the column's charset */
+static long long content_hash(const char *text, size_t len, long long fingerprint) {
+    return static_cast<long long>(xxh64(text, len, static_cast<uint64_t>(fingerprint)));
+}
+
+bool gembed_model_fingerprint_init(UDF_INIT *initid, UDF_ARGS *args, char *message) {
+    if (args->arg_count != 2) {
+        snprintf(message, MYSQL_ERRMSG_SIZE,
+                 "GEMBED_MODEL_FINGERPRINT requires 2 arguments: method, model");
+        return true;
+    }
+    args->arg_type[0] = STRING_RESULT;
+    args->arg_type[1] = STRING_RESULT;
+
+    initid->maybe_null = true;
+    return false;
+}
+
+long long gembed_model_fingerprint(UDF_INIT *, UDF_ARGS *args, unsigned char *is_null,
+                                   unsigned char *error) {
+    if (!args->args[0] || !args->args[1]) {
+        *is_null = 1;
+        return 0;
+    }
+
+    char message[MYSQL_ERRMSG_SIZE];
+    Model_entry *entry = model_registry_get(args->args[0], args->args[1], message,
+                                            sizeof(message));
+    if (!entry) {
+        *error = 1;
+        log_message(ERROR_LEVEL, message);
+        return 0;
+    }
+
+    // Loads the model on first use, like any embedding call would
+    uint64_t fingerprint = model_fingerprint(entry);
+    if (fingerprint == 0) {
+        *error = 1;
+        log_message(ERROR_LEVEL, "Could not fingerprint the model");
+        return 0;
+    }
+    return static_cast<long long>(fingerprint);
+}
+
+bool gembed_hash_init(UDF_INIT *initid, UDF_ARGS *args, char *message) {
+    if (args->arg_count != 1 && args->arg_count != 2) {
+        snprintf(message, MYSQL_ERRMSG_SIZE,
+                 "GEMBED_HASH requires 1 or 2 arguments: text [, model_fingerprint]");
+        return true;
+    }
+    args->arg_type[0] = STRING_RESULT;
+    if (args->arg_count == 2) {
+        args->arg_type[1] = INT_RESULT;
+    }
+
+    initid->maybe_null = true;
+    return false;
+}
+
+long long gembed_hash(UDF_INIT *, UDF_ARGS *args, unsigned char *is_null,
+                      unsigned char *) {
+    if (!args->args[0]) {
+        *is_null = 1;
+        return 0;
+    }
+
+    long long fingerprint = 0;
+    if (args->arg_count == 2 && args->args[1]) {
+        fingerprint = *reinterpret_cast<long long *>(args->args[1]);
+    }
+    return content_hash(args->args[0], args->lengths[0], fingerprint);
+}
+
+bool gembed_stale_init(UDF_INIT *initid, UDF_ARGS *args, char *message) {
+    if (args->arg_count != 3) {
+        snprintf(message, MYSQL_ERRMSG_SIZE,
+                 "GEMBED_STALE requires 3 arguments: stored_hash, "
+                 "model_fingerprint, text");
+        return true;
+    }
+    args->arg_type[0] = INT_RESULT;
+    args->arg_type[1] = INT_RESULT;
+    args->arg_type[2] = STRING_RESULT;
+
+    initid->maybe_null = true;
+    return false;
+}
+
+long long gembed_stale(UDF_INIT *, UDF_ARGS *args, unsigned char *is_null,
+                       unsigned char *) {
+    // Without a text or a model there is nothing to compare against
+    if (!args->args[1] || !args->args[2]) {
+        *is_null = 1;
+        return 0;
+    }
+
+    // A row that was never hashed has never been embedded either
+    if (!args->args[0]) {
+        return 1;
+    }
+
+    long long stored = *reinterpret_cast<long long *>(args->args[0]);
+    long long fingerprint = *reinterpret_cast<long long *>(args->args[1]);
+    return stored != content_hash(args->args[2], args->lengths[2], fingerprint);
+}
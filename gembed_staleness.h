@@ -0,0 +1,43 @@
+/* Copyright (c) 2025, Joel Díaz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+#ifndef GEMBED_STALENESS_H
+#define GEMBED_STALENESS_H
+
+#include <mysql/udf_registration_types.h>
+
+/*
+ * Change detection for incremental re-embedding. GEMBED_HASH() gives a
+ * 64-bit content hash to store next to each vector, seeded with the
+ * fingerprint of the model that produced it. GEMBED_STALE() tells whether
+ * a row must be embedded again because its text or the model changed,
+ * without running the model. GEMBED_MODEL_FINGERPRINT() gives the seed.
+ */
+
+/* UDF: GEMBED_MODEL_FINGERPRINT(method, model) -> BIGINT, see model_fingerprint() */
+bool gembed_model_fingerprint_init(UDF_INIT *initid, UDF_ARGS *args, char *message);
+long long gembed_model_fingerprint(UDF_INIT *initid, UDF_ARGS *args,
+                                   unsigned char *is_null, unsigned char *error);
+
+/* UDF: GEMBED_HASH(text [, model_fingerprint]) -> BIGINT */
+bool gembed_hash_init(UDF_INIT *initid, UDF_ARGS *args, char *message);
+long long gembed_hash(UDF_INIT *initid, UDF_ARGS *args,
+                      unsigned char *is_null, unsigned char *error);
+
+/* UDF: GEMBED_STALE(stored_hash, model_fingerprint, text) -> 1 or 0 */
+bool gembed_stale_init(UDF_INIT *initid, UDF_ARGS *args, char *message);
+long long gembed_stale(UDF_INIT *initid, UDF_ARGS *args,
+                       unsigned char *is_null, unsigned char *error);
+
+#endif /* GEMBED_STALENESS_H */
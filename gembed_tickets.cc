@@ -0,0 +1,383 @@
+/* Copyright (c) 2025, Joel Díaz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+
+#include "gembed_tickets.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "gembed_embed.h"
+#include "gembed_models.h"
+#include "gembed_services.h"
+#include "gembed_vars.h"
+
+#define MYSQL_ERRMSG_SIZE 512
+
+namespace {
+
+enum Ticket_state { TICKET_QUEUED, TICKET_RUNNING, TICKET_DONE, TICKET_FAILED };
+
+struct Ticket {
+    Model_entry *model = nullptr;
+    std::string text;
+    Ticket_state state = TICKET_QUEUED;
+    std::vector<float> vector;
+};
+
+}  // namespace
+
+/* Protects everything below */
+static std::mutex ticket_lock;
+static std::condition_variable ticket_queued;  /* wakes the dispatcher */
+static std::condition_variable ticket_done;    /* wakes GEMBED_WAIT callers */
+
+static std::unordered_map<long long, Ticket> tickets;
+static std::deque<long long> queue;  /* tickets waiting for the dispatcher */
+
+/* Finished tickets in completion order, for expiry */
+static std::deque<std::pair<std::chrono::steady_clock::time_point, long long>> finished;
+
+static long long next_ticket = 0;
+static bool running = false;
+static bool stopping = false;
+static std::thread dispatcher;
+
+/* Drops results nobody collected in time. Called with ticket_lock held */
+static void expire_tickets() {
+    auto cutoff = std::chrono::steady_clock::now() -
+                  std::chrono::seconds(gembed_ticket_ttl_s);
+
+    while (!finished.empty() && finished.front().first < cutoff) {
+        // Already collected tickets are gone from the map
+        if (tickets.erase(finished.front().second)) {
+            gembed_status.tickets_expired.fetch_add(1, std::memory_order_relaxed);
+        }
+        finished.pop_front();
+    }
+}
+
+/*
+ * Takes queued tickets for the model of the oldest one, enough to give
+ * every pool worker a full sub-batch. Called with ticket_lock held.
+ */
+static Model_entry *take_batch(std::vector<long long> &ids,
+                               std::vector<StringSlice> &texts) {
+    Model_entry *model = tickets[queue.front()].model;
+    size_t limit = std::max(1U, gembed_max_batch_size) *
+                   static_cast<size_t>(std::max(1U, gembed_inference_threads));
+
+    for (auto it = queue.begin(); it != queue.end() && ids.size() < limit;) {
+        Ticket &ticket = tickets[*it];
+        if (ticket.model == model) {
+            // Map nodes do not move, the text stays put while running
+            ticket.state = TICKET_RUNNING;
+            ids.push_back(*it);
+            texts.push_back({ticket.text.data(), ticket.text.size()});
+            it = queue.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    return model;
+}
+
+static void dispatcher_main() {
+    std::vector<long long> ids;
+    std::vector<StringSlice> texts;
+    std::vector<float> vectors;
+    std::unique_lock<std::mutex> guard(ticket_lock);
+
+    for (;;) {
+        ticket_queued.wait_for(guard, std::chrono::seconds(1),
+                               [] { return !queue.empty() || stopping; });
+        expire_tickets();
+
+        if (stopping) {
+            break;
+        }
+        if (queue.empty()) {
+            continue;
+        }
+
+        ids.clear();
+        texts.clear();
+        Model_entry *model = take_batch(ids, texts);
+        guard.unlock();
+
+        Embed_options opts;
+        opts.priority = PRIORITY_BULK;
+
+        size_t dim = 0;
+        int err = embed_with_cache(model, texts.data(), texts.size(), opts, vectors, &dim);
+
+        guard.lock();
+        auto now = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < ids.size(); i++) {
+            Ticket &ticket = tickets[ids[i]];
+            ticket.text.clear();
+            ticket.text.shrink_to_fit();
+            if (err == 0) {
+                ticket.vector.assign(vectors.begin() + i * dim,
+                                     vectors.begin() + (i + 1) * dim);
+                ticket.state = TICKET_DONE;
+            } else {
+                ticket.state = TICKET_FAILED;
+            }
+            finished.emplace_back(now, ids[i]);
+        }
+        gembed_status.ticket_queue_length.fetch_sub(ids.size(), std::memory_order_relaxed);
+        gembed_status.tickets_completed.fetch_add(ids.size(), std::memory_order_relaxed);
+        ticket_done.notify_all();
+    }
+}
+
+bool ticket_queue_start() {
+    std::lock_guard<std::mutex> guard(ticket_lock);
+
+    // Numbering from the clock keeps tickets from before a restart from
+    // matching new ones
+    next_ticket = std::chrono::duration_cast<std::chrono::microseconds>(
+                      std::chrono::system_clock::now().time_since_epoch())
+                      .count();
+    stopping = false;
+
+    try {
+        dispatcher = std::thread(dispatcher_main);
+    } catch (const std::system_error &) {
+        log_message(ERROR_LEVEL, "failed to start the ticket dispatcher");
+        return true;
+    }
+
+    running = true;
+    return false;
+}
+
+void ticket_queue_stop() {
+    {
+        std::lock_guard<std::mutex> guard(ticket_lock);
+        if (!running) {
+            return;
+        }
+        stopping = true;
+    }
+
+    ticket_queued.notify_all();
+    dispatcher.join();
+
+    std::lock_guard<std::mutex> guard(ticket_lock);
+    tickets.clear();
+    queue.clear();
+    finished.clear();
+    running = false;
+    gembed_status.ticket_queue_length.store(0, std::memory_order_relaxed);
+    ticket_done.notify_all();
+}
+
+bool gembed_enqueue_init(UDF_INIT *initid, UDF_ARGS *args, char *message) {
+    if (args->arg_count != 3) {
+        snprintf(message, MYSQL_ERRMSG_SIZE,
+                 "GEMBED_ENQUEUE requires 3 arguments: method, model, text");
+        return true;
+    }
+
+    for (unsigned int i = 0; i < args->arg_count; i++) {
+        if (args->arg_type[i] != STRING_RESULT) {
+            snprintf(message, MYSQL_ERRMSG_SIZE, "All arguments must be strings");
+            return true;
+        }
+    }
+
+    initid->maybe_null = true;
+    return false;
+}
+
+long long gembed_enqueue(UDF_INIT *, UDF_ARGS *args,
+                         unsigned char *is_null, unsigned char *error) {
+    const char *method = args->args[0];
+    const char *model = args->args[1];
+    const char *text = args->args[2];
+
+    if (!method || !model || !text) {
+        *is_null = 1;
+        return 0;
+    }
+
+    char message[MYSQL_ERRMSG_SIZE];
+    Model_entry *entry = model_registry_get(method, model, message, sizeof(message));
+    if (!entry) {
+        *error = 1;
+        log_message(ERROR_LEVEL, message);
+        return 0;
+    }
+
+    long long id;
+    {
+        std::lock_guard<std::mutex> guard(ticket_lock);
+        if (!running || stopping) {
+            *error = 1;
+            log_message(ERROR_LEVEL, "Ticket queue is not running");
+            return 0;
+        }
+
+        expire_tickets();
+        if (tickets.size() >= gembed_ticket_queue_size) {
+            *error = 1;
+            log_message(ERROR_LEVEL, "Too many outstanding tickets, see gembed.ticket_queue_size");
+            return 0;
+        }
+
+        id = next_ticket++;
+        Ticket &ticket = tickets[id];
+        ticket.model = entry;
+        ticket.text.assign(text, args->lengths[2]);
+        queue.push_back(id);
+    }
+
+    gembed_status.ticket_queue_length.fetch_add(1, std::memory_order_relaxed);
+    ticket_queued.notify_one();
+    return id;
+}
+
+/* Shared by GEMBED_RESULT and GEMBED_WAIT: takes a ticket and optional timeout */
+static bool check_ticket_args(UDF_INIT *initid, UDF_ARGS *args, char *message,
+                              unsigned int n_args, const char *usage) {
+    if (args->arg_count != n_args) {
+        snprintf(message, MYSQL_ERRMSG_SIZE, "%s", usage);
+        return true;
+    }
+
+    for (unsigned int i = 0; i < args->arg_count; i++) {
+        args->arg_type[i] = INT_RESULT;
+    }
+
+    initid->maybe_null = true;
+    initid->max_length = gembed_vector_max_length;
+    initid->ptr = nullptr;
+    return false;
+}
+
+bool gembed_result_init(UDF_INIT *initid, UDF_ARGS *args, char *message) {
+    return check_ticket_args(initid, args, message, 1,
+                             "GEMBED_RESULT requires 1 argument: ticket");
+}
+
+bool gembed_wait_init(UDF_INIT *initid, UDF_ARGS *args, char *message) {
+    return check_ticket_args(initid, args, message, 2,
+                             "GEMBED_WAIT requires 2 arguments: ticket, timeout_ms");
+}
+
+void gembed_ticket_deinit(UDF_INIT *initid) {
+    if (initid->ptr) {
+        delete[] initid->ptr;
+        initid->ptr = nullptr;
+    }
+}
+
+/* Longest GEMBED_WAIT, and how often a waiting session checks for KILL */
+static const long long MAX_WAIT_MS = 24LL * 3600 * 1000;
+static const std::chrono::milliseconds KILL_CHECK_INTERVAL(100);
+
+/*
+ * Hands out the result of a ticket, waiting up to timeout_ms for it.
+ * Collecting a result, or its failure, frees the ticket. Returns NULL
+ * while the ticket is pending, and when the wait is killed.
+ */
+static char *collect_ticket(UDF_INIT *initid, long long id, long long timeout_ms,
+                            unsigned long *length, unsigned char *is_null,
+                            unsigned char *error) {
+    std::vector<float> vector;
+    {
+        std::unique_lock<std::mutex> guard(ticket_lock);
+        auto deadline = std::chrono::steady_clock::now() +
+                        std::chrono::milliseconds(std::clamp(timeout_ms, 0LL, MAX_WAIT_MS));
+        auto it = tickets.find(id);
+
+        while (it != tickets.end() && it->second.state != TICKET_DONE &&
+               it->second.state != TICKET_FAILED) {
+            // A killed wait leaves the ticket pending; the server reports the kill
+            auto now = std::chrono::steady_clock::now();
+            if (now >= deadline || session_killed()) {
+                break;
+            }
+            ticket_done.wait_until(guard, std::min(deadline, now + KILL_CHECK_INTERVAL));
+            it = tickets.find(id);
+        }
+
+        if (it == tickets.end()) {
+            *error = 1;
+            log_message(ERROR_LEVEL, "Unknown or expired ticket");
+            return nullptr;
+        }
+
+        if (it->second.state == TICKET_FAILED) {
+            tickets.erase(it);
+            *error = 1;
+            log_message(ERROR_LEVEL, "Embedding generation failed");
+            return nullptr;
+        }
+
+        if (it->second.state != TICKET_DONE) {
+            *is_null = 1;
+            return nullptr;
+        }
+
+        vector = std::move(it->second.vector);
+        tickets.erase(it);
+    }
+
+    char *vector_data = store_vector(&initid->ptr, initid->max_length, vector.data(),
+                                     vector.size(), length);
+    if (!vector_data) {
+        *error = 1;
+        log_message(ERROR_LEVEL, "Vector exceeds gembed.vector_max_length");
+    }
+    return vector_data;
+}
+
+char *gembed_result(UDF_INIT *initid, UDF_ARGS *args, char *,
+                    unsigned long *length, unsigned char *is_null,
+                    unsigned char *error) {
+    if (!args->args[0]) {
+        *is_null = 1;
+        return nullptr;
+    }
+
+    long long id = *reinterpret_cast<long long *>(args->args[0]);
+    return collect_ticket(initid, id, 0, length, is_null, error);
+}
+
+char *gembed_wait(UDF_INIT *initid, UDF_ARGS *args, char *,
+                  unsigned long *length, unsigned char *is_null,
+                  unsigned char *error) {
+    if (!args->args[0]) {
+        *is_null = 1;
+        return nullptr;
+    }
+
+    long long id = *reinterpret_cast<long long *>(args->args[0]);
+    long long timeout_ms = args->args[1] ? *reinterpret_cast<long long *>(args->args[1]) : 0;
+    return collect_ticket(initid, id, timeout_ms, length, is_null, error);
+}
@@ -0,0 +1,55 @@
+/* Copyright (c) 2025, Joel Díaz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+#ifndef GEMBED_TICKETS_H
+#define GEMBED_TICKETS_H
+
+#include <mysql/udf_registration_types.h>
+
+/*
+ * Asynchronous embedding. GEMBED_ENQUEUE() queues a text and returns a
+ * ticket at once; a background dispatcher embeds queued texts in large
+ * bulk batches, and GEMBED_RESULT() / GEMBED_WAIT() hand out the vector.
+ *
+ * At most gembed.ticket_queue_size tickets may be outstanding. Results
+ * that are not collected within gembed.ticket_ttl_s seconds are dropped.
+ */
+
+/* Starts the dispatcher thread. Returns true on failure */
+bool ticket_queue_start();
+
+/* Stops the dispatcher; queued and uncollected tickets are dropped */
+void ticket_queue_stop();
+
+/* UDF: GEMBED_ENQUEUE(method, model, text) -> ticket */
+bool gembed_enqueue_init(UDF_INIT *initid, UDF_ARGS *args, char *message);
+long long gembed_enqueue(UDF_INIT *initid, UDF_ARGS *args,
+                         unsigned char *is_null, unsigned char *error);
+
+/* UDF: GEMBED_RESULT(ticket) -> VECTOR, NULL while pending */
+bool gembed_result_init(UDF_INIT *initid, UDF_ARGS *args, char *message);
+char *gembed_result(UDF_INIT *initid, UDF_ARGS *args, char *result,
+                    unsigned long *length, unsigned char *is_null,
+                    unsigned char *error);
+
+/* UDF: GEMBED_WAIT(ticket, timeout_ms) -> VECTOR, NULL on timeout */
+bool gembed_wait_init(UDF_INIT *initid, UDF_ARGS *args, char *message);
+char *gembed_wait(UDF_INIT *initid, UDF_ARGS *args, char *result,
+                  unsigned long *length, unsigned char *is_null,
+                  unsigned char *error);
+
+/* Frees the result buffer of GEMBED_RESULT and GEMBED_WAIT */
+void gembed_ticket_deinit(UDF_INIT *initid);
+
+#endif /* GEMBED_TICKETS_H */
@@ -0,0 +1,99 @@
+/* Copyright (c) 2025, Joel Díaz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+
+#include "gembed_tuner.h"
+
+#include <algorithm>
+#include <cstdint>
+#include "gembed_vars.h"
+
+void Batch_controller::record(size_t n_texts, uint64_t latency_us) {
+    std::lock_guard<std::mutex> guard(lock);
+
+    latencies[next_latency] = static_cast<uint32_t>(std::min<uint64_t>(latency_us, UINT32_MAX));
+    next_latency = (next_latency + 1) % WINDOW;
+    n_latencies = std::min(n_latencies + 1, WINDOW);
+
+    epoch_calls++;
+    epoch_texts += n_texts;
+    epoch_busy_us += std::max<uint64_t>(latency_us, 1);
+
+    if (epoch_calls >= EPOCH_CALLS) {
+        end_epoch();
+    }
+}
+
+unsigned int Batch_controller::batch_size(unsigned int ceiling) const {
+    return std::max(1U, std::min(batch.load(std::memory_order_relaxed), ceiling));
+}
+
+unsigned int Batch_controller::wait_us(unsigned int ceiling) const {
+    return std::min(wait.load(std::memory_order_relaxed), ceiling);
+}
+
+/* Called with lock held */
+void Batch_controller::end_epoch() {
+    uint32_t sorted[WINDOW];
+    std::copy(latencies, latencies + n_latencies, sorted);
+    size_t rank = std::min(n_latencies - 1, n_latencies * 99 / 100);
+    std::nth_element(sorted, sorted + rank, sorted + n_latencies);
+    uint64_t p99 = sorted[rank];
+    last_p99.store(p99, std::memory_order_relaxed);
+
+    unsigned int max_batch = std::max(1U, gembed_max_batch_size);
+    unsigned int max_wait = gembed_max_wait_us;
+    unsigned int current = batch_size(max_batch);
+    unsigned int current_wait = wait_us(max_wait);
+    unsigned int next = current;
+    unsigned int next_wait = current_wait;
+
+    double throughput = static_cast<double>(epoch_texts) * 1e6 / epoch_busy_us;
+    double fill = static_cast<double>(epoch_texts) / (epoch_calls * current);
+
+    if (p99 > gembed_target_p99_us) {
+        // Over the latency target: back off quickly and start climbing afresh.
+        // With no throughput to compare against, the next epoch steps up
+        next = std::max(1U, current * 3 / 4);
+        next_wait = current_wait / 2;
+        direction = +1;
+        last_throughput = 0;
+    } else {
+        // Calls well below the limit say nothing about the batch size
+        if (fill >= 0.5) {
+            // Keep climbing while it pays off, turn around once it stops
+            if (last_throughput > 0 && throughput < last_throughput) {
+                direction = -direction;
+            }
+            unsigned int step = std::max(1U, current / 8);
+            next = direction > 0 ? std::min(max_batch, current + step)
+                                 : std::max(1U, current - std::min(step, current - 1));
+            last_throughput = throughput;
+        }
+
+        // Wait for fuller batches while there is latency headroom
+        if (fill < 0.5 && p99 < gembed_target_p99_us / 2) {
+            next_wait = std::min(max_wait, current_wait + std::max(50U, current_wait / 4));
+        } else if (fill > 0.9) {
+            next_wait = current_wait * 3 / 4;
+        }
+    }
+
+    batch.store(next, std::memory_order_relaxed);
+    wait.store(next_wait, std::memory_order_relaxed);
+
+    epoch_calls = 0;
+    epoch_texts = 0;
+    epoch_busy_us = 0;
+}
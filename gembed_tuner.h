@@ -0,0 +1,72 @@
+/* Copyright (c) 2025, Joel Díaz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+#ifndef GEMBED_TUNER_H
+#define GEMBED_TUNER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+/*
+ * Feedback controller for one model's sub-batch size and batch fill wait.
+ *
+ * Every library call reports its size and latency. Once per epoch the
+ * controller compares rows per second of inference time with the previous
+ * epoch and keeps moving the batch size in whichever direction improved it,
+ * backing off multiplicatively whenever the p99 call latency exceeds
+ * gembed.target_p99_us. The wait window grows while batches run mostly
+ * empty and there is latency headroom, and shrinks otherwise.
+ *
+ * The configured gembed.max_batch_size and gembed.max_wait_us are ceilings.
+ */
+class Batch_controller {
+  public:
+    /* Feeds one library call of n_texts that took latency_us */
+    void record(size_t n_texts, uint64_t latency_us);
+
+    /* Current sub-batch size, at most ceiling */
+    unsigned int batch_size(unsigned int ceiling) const;
+
+    /* Current wait window in microseconds, at most ceiling */
+    unsigned int wait_us(unsigned int ceiling) const;
+
+    /* Most recent p99 estimate in microseconds */
+    uint64_t p99_us() const { return last_p99.load(std::memory_order_relaxed); }
+
+  private:
+    static constexpr size_t EPOCH_CALLS = 32;
+    static constexpr size_t WINDOW = 128;  /* calls kept for the p99 estimate */
+
+    void end_epoch();
+
+    std::atomic<unsigned int> batch{8};
+    std::atomic<unsigned int> wait{0};
+    std::atomic<uint64_t> last_p99{0};
+
+    std::mutex lock;
+    uint32_t latencies[WINDOW] = {};
+    size_t n_latencies = 0;
+    size_t next_latency = 0;
+
+    size_t epoch_calls = 0;
+    size_t epoch_texts = 0;
+    uint64_t epoch_busy_us = 0;
+
+    double last_throughput = 0;
+    int direction = 1;
+};
+
+#endif /* GEMBED_TUNER_H */
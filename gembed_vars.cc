@@ -0,0 +1,575 @@
+/* Copyright (c) 2025, Joel Díaz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+
+#include "gembed_vars.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "gembed_cache.h"
+#include "gembed_disk_cache.h"
+#include "gembed_distance.h"
+#include "gembed_helper.h"
+#include "gembed_models.h"
+#include "gembed_pool.h"
+#include "gembed_remote.h"
+#include "gembed_services.h"
+
+#define COMPONENT_NAME "gembed"
+#define MB (1024UL * 1024UL)
+
+/* Defaults here only matter until registration, which overwrites them */
+unsigned int gembed_max_batch_size = 64;
+unsigned int gembed_cache_size_mb = 64;
+unsigned int gembed_statement_memo_entries = 1024;
+unsigned int gembed_inference_threads = 1;
+unsigned int gembed_max_wait_us = 0;
+bool gembed_adaptive_batching = false;
+unsigned int gembed_target_p99_us = 100000;
+unsigned int gembed_bulk_min_share = 20;
+bool gembed_numa_aware = false;
+char *gembed_inference_cpus = nullptr;
+int gembed_inference_priority = 0;
+bool gembed_inherit_resource_group = false;
+unsigned long gembed_vector_max_length = 65535;
+unsigned long gembed_max_output_size = 16 * MB;
+unsigned int gembed_ticket_queue_size = 100000;
+unsigned int gembed_ticket_ttl_s = 3600;
+unsigned int gembed_backfill_batch_rows = 1000;
+unsigned int gembed_backfill_chunk_rows = 100;
+unsigned int gembed_backfill_max_threads_running = 32;
+unsigned int gembed_backfill_max_lag_s = 10;
+char *gembed_backfill_lag_query = nullptr;
+char *gembed_backfill_checkpoint_schema = nullptr;
+bool gembed_out_of_process = false;
+char *gembed_helper_path = nullptr;
+char *gembed_helper_cgroup = nullptr;
+unsigned int gembed_helper_memory_limit_mb = 0;
+char *gembed_remote_socket = nullptr;
+unsigned int gembed_remote_connections = 4;
+unsigned int gembed_remote_timeout_ms = 30000;
+char *gembed_persistent_cache_dir = nullptr;
+unsigned int gembed_persistent_cache_size_mb = 4096;
+
+gembed_status_t gembed_status;
+
+static_assert(sizeof(status_counter) == sizeof(long long) &&
+                  ATOMIC_LLONG_LOCK_FREE == 2,
+              "status counters are exported as SHOW_LONGLONG");
+
+#define STATUS_VAR(name, counter)                                     \
+    {"gembed." name, reinterpret_cast<char *>(&gembed_status.counter), \
+     SHOW_LONGLONG, SHOW_SCOPE_GLOBAL}
+
+static SHOW_VAR status_vars[] = {
+    STATUS_VAR("cache_hits", cache_hits),
+    STATUS_VAR("cache_misses", cache_misses),
+    STATUS_VAR("cache_evictions", cache_evictions),
+    STATUS_VAR("cache_entries", cache_entries),
+    STATUS_VAR("cache_bytes", cache_bytes),
+    STATUS_VAR("memo_hits", memo_hits),
+    STATUS_VAR("inference_calls", inference_calls),
+    STATUS_VAR("inference_texts", inference_texts),
+    STATUS_VAR("pool_threads", pool_threads),
+    STATUS_VAR("pool_queue_length", pool_queue_length),
+    STATUS_VAR("pool_coalesced_jobs", pool_coalesced_jobs),
+    STATUS_VAR("interactive_jobs", interactive_jobs),
+    STATUS_VAR("interactive_wait_us", interactive_wait_us),
+    STATUS_VAR("bulk_jobs", bulk_jobs),
+    STATUS_VAR("bulk_wait_us", bulk_wait_us),
+    STATUS_VAR("ticket_queue_length", ticket_queue_length),
+    STATUS_VAR("tickets_completed", tickets_completed),
+    STATUS_VAR("tickets_expired", tickets_expired),
+    STATUS_VAR("backfill_jobs_running", backfill_jobs_running),
+    STATUS_VAR("backfill_rows", backfill_rows),
+    STATUS_VAR("backfill_throttle_waits", backfill_throttle_waits),
+    STATUS_VAR("helper_pid", helper_pid),
+    STATUS_VAR("helper_restarts", helper_restarts),
+    STATUS_VAR("remote_connections", remote_connections),
+    STATUS_VAR("remote_requests", remote_requests),
+    STATUS_VAR("remote_failures", remote_failures),
+    STATUS_VAR("persistent_cache_hits", persistent_cache_hits),
+    STATUS_VAR("persistent_cache_misses", persistent_cache_misses),
+    STATUS_VAR("persistent_cache_entries", persistent_cache_entries),
+    STATUS_VAR("persistent_cache_bytes", persistent_cache_bytes),
+    STATUS_VAR("persistent_cache_compactions", persistent_cache_compactions),
+    STATUS_VAR("topk_rows", topk_rows),
+    STATUS_VAR("topk_rows_abandoned", topk_rows_abandoned),
+    {"gembed.adaptive_state", reinterpret_cast<char *>(&model_adaptive_state),
+     SHOW_FUNC, SHOW_SCOPE_GLOBAL},
+    {"gembed.distance_isa", reinterpret_cast<char *>(&distance_isa_show),
+     SHOW_FUNC, SHOW_SCOPE_GLOBAL},
+    {nullptr, nullptr, SHOW_UNDEF, SHOW_SCOPE_UNDEF}};
+
+static bool status_vars_registered = false;
+
+/* Names of the registered system variables, in registration order */
+static std::vector<const char *> registered_sysvars;
+
+static void update_cache_size_mb(MYSQL_THD, SYS_VAR *, void *var_ptr,
+                                 const void *save) {
+    unsigned int size_mb = *static_cast<const unsigned int *>(save);
+    *static_cast<unsigned int *>(var_ptr) = size_mb;
+    embedding_cache_set_capacity(size_mb * MB);
+}
+
+static void update_inference_threads(MYSQL_THD, SYS_VAR *, void *var_ptr,
+                                     const void *save) {
+    unsigned int n_threads = *static_cast<const unsigned int *>(save);
+    *static_cast<unsigned int *>(var_ptr) = n_threads;
+    inference_pool_resize(n_threads);
+}
+
+static int check_cpu_list(MYSQL_THD, SYS_VAR *, void *save,
+                          st_mysql_value *value) {
+    char buf[1024];
+    int len = sizeof(buf);
+    const char *str = value->val_str(value, buf, &len);
+
+    if (!str) {
+        *static_cast<const char **>(save) = nullptr;
+        return 0;
+    }
+
+    // The server copies the value before update, it only has to outlive this statement
+    thread_local std::string checked;
+    checked.assign(str, len);
+
+    std::vector<int> cpus;
+    if (!parse_cpu_list(checked.c_str(), cpus)) {
+        return 1;
+    }
+
+    *static_cast<const char **>(save) = checked.c_str();
+    return 0;
+}
+
+/* The helper process runs with the workers' CPUs and priority */
+static void configure_helper() {
+    helper_configure(gembed_helper_path, gembed_helper_cgroup,
+                     gembed_inference_cpus, gembed_inference_priority,
+                     gembed_helper_memory_limit_mb);
+}
+
+static void update_inference_cpus(MYSQL_THD, SYS_VAR *, void *var_ptr,
+                                  const void *save) {
+    char *cpu_list = *static_cast<char *const *>(save);
+    *static_cast<char **>(var_ptr) = cpu_list;
+    inference_pool_set_cpus(cpu_list);
+    configure_helper();
+}
+
+static void update_inference_priority(MYSQL_THD, SYS_VAR *, void *var_ptr,
+                                      const void *save) {
+    *static_cast<int *>(var_ptr) = *static_cast<const int *>(save);
+    inference_pool_placement_changed();
+    configure_helper();
+}
+
+static void update_helper_str(MYSQL_THD, SYS_VAR *, void *var_ptr,
+                              const void *save) {
+    *static_cast<char **>(var_ptr) = *static_cast<char *const *>(save);
+    configure_helper();
+}
+
+static void update_helper_memory_limit_mb(MYSQL_THD, SYS_VAR *, void *var_ptr,
+                                          const void *save) {
+    *static_cast<unsigned int *>(var_ptr) = *static_cast<const unsigned int *>(save);
+    configure_helper();
+}
+
+static void update_remote_socket(MYSQL_THD, SYS_VAR *, void *var_ptr,
+                                 const void *save) {
+    char *path = *static_cast<char *const *>(save);
+    *static_cast<char **>(var_ptr) = path;
+    remote_set_socket(path);
+}
+
+static void update_persistent_cache_size_mb(MYSQL_THD, SYS_VAR *, void *var_ptr,
+                                            const void *save) {
+    *static_cast<unsigned int *>(var_ptr) = *static_cast<const unsigned int *>(save);
+    disk_cache_size_changed();
+}
+
+static void log_register_failure(const char *name) {
+    char msg[128];
+    snprintf(msg, sizeof(msg), "failed to register system variable %s.%s",
+             COMPONENT_NAME, name);
+    log_message(ERROR_LEVEL, msg);
+}
+
+static bool register_uint_var(const char *name, const char *comment,
+                              unsigned int *value, unsigned int def_val,
+                              unsigned int min_val, unsigned int max_val,
+                              mysql_sys_var_update_func update = nullptr) {
+    INTEGRAL_CHECK_ARG(uint) arg;
+    arg.def_val = def_val;
+    arg.min_val = min_val;
+    arg.max_val = max_val;
+    arg.blk_sz = 0;
+
+    if (mysql_service_component_sys_variable_register->register_variable(
+            COMPONENT_NAME, name, PLUGIN_VAR_INT | PLUGIN_VAR_UNSIGNED,
+            comment, nullptr, update, &arg, value)) {
+        log_register_failure(name);
+        return true;
+    }
+    registered_sysvars.push_back(name);
+    return false;
+}
+
+static bool register_ulong_var(const char *name, const char *comment,
+                               unsigned long *value, unsigned long def_val,
+                               unsigned long min_val, unsigned long max_val,
+                               mysql_sys_var_update_func update = nullptr) {
+    INTEGRAL_CHECK_ARG(ulong) arg;
+    arg.def_val = def_val;
+    arg.min_val = min_val;
+    arg.max_val = max_val;
+    arg.blk_sz = 0;
+
+    if (mysql_service_component_sys_variable_register->register_variable(
+            COMPONENT_NAME, name, PLUGIN_VAR_LONG | PLUGIN_VAR_UNSIGNED,
+            comment, nullptr, update, &arg, value)) {
+        log_register_failure(name);
+        return true;
+    }
+    registered_sysvars.push_back(name);
+    return false;
+}
+
+static bool register_int_var(const char *name, const char *comment,
+                             int *value, int def_val, int min_val, int max_val,
+                             mysql_sys_var_update_func update = nullptr) {
+    INTEGRAL_CHECK_ARG(int) arg;
+    arg.def_val = def_val;
+    arg.min_val = min_val;
+    arg.max_val = max_val;
+    arg.blk_sz = 0;
+
+    if (mysql_service_component_sys_variable_register->register_variable(
+            COMPONENT_NAME, name, PLUGIN_VAR_INT, comment, nullptr, update,
+            &arg, value)) {
+        log_register_failure(name);
+        return true;
+    }
+    registered_sysvars.push_back(name);
+    return false;
+}
+
+static bool register_str_var(const char *name, const char *comment,
+                             char **value, const char *def_val,
+                             mysql_sys_var_check_func check = nullptr,
+                             mysql_sys_var_update_func update = nullptr,
+                             int extra_flags = 0) {
+    STR_CHECK_ARG(str) arg;
+    arg.def_val = const_cast<char *>(def_val);
+
+    if (mysql_service_component_sys_variable_register->register_variable(
+            COMPONENT_NAME, name, PLUGIN_VAR_STR | PLUGIN_VAR_MEMALLOC | extra_flags,
+            comment, check, update, &arg, value)) {
+        log_register_failure(name);
+        return true;
+    }
+    registered_sysvars.push_back(name);
+    return false;
+}
+
+static bool register_bool_var(const char *name, const char *comment,
+                              bool *value, bool def_val, int extra_flags = 0) {
+    BOOL_CHECK_ARG(bool) arg;
+    arg.def_val = def_val;
+
+    if (mysql_service_component_sys_variable_register->register_variable(
+            COMPONENT_NAME, name, PLUGIN_VAR_BOOL | extra_flags, comment,
+            nullptr, nullptr, &arg, value)) {
+        log_register_failure(name);
+        return true;
+    }
+    registered_sysvars.push_back(name);
+    return false;
+}
+
+static bool register_sysvars() {
+    if (register_uint_var("max_batch_size",
+                          "Maximum number of texts passed to the embedding "
+                          "library in a single call",
+                          &gembed_max_batch_size, 64, 1, 65536)) {
+        return true;
+    }
+
+    if (register_uint_var("cache_size_mb",
+                          "Memory budget of the shared embedding cache in "
+                          "MiB, 0 disables it",
+                          &gembed_cache_size_mb, 64, 0, 1024 * 1024,
+                          update_cache_size_mb)) {
+        return true;
+    }
+
+    if (register_uint_var("statement_memo_entries",
+                          "Distinct texts each EMBED_TEXT or EMBED_TEXTS call "
+                          "remembers for the rest of its statement, 0 "
+                          "disables the memo",
+                          &gembed_statement_memo_entries, 1024, 0, 1048576)) {
+        return true;
+    }
+
+    if (register_uint_var("inference_threads",
+                          "Number of inference pool workers, defaults to the "
+                          "number of physical cores",
+                          &gembed_inference_threads, physical_core_count(), 1,
+                          1024, update_inference_threads)) {
+        return true;
+    }
+
+    if (register_uint_var("max_wait_us",
+                          "Microseconds a worker waits for more requests for "
+                          "the same model before running a partial batch",
+                          &gembed_max_wait_us, 0, 0, 1000000)) {
+        return true;
+    }
+
+    if (register_bool_var("adaptive_batching",
+                          "Tune the batch size and wait window of each model "
+                          "from measured latency, up to max_batch_size and "
+                          "max_wait_us",
+                          &gembed_adaptive_batching, false)) {
+        return true;
+    }
+
+    if (register_uint_var("target_p99_us",
+                          "p99 latency in microseconds of a library call that "
+                          "adaptive batching must stay under",
+                          &gembed_target_p99_us, 100000, 1000, 60000000)) {
+        return true;
+    }
+
+    if (register_uint_var("bulk_min_share",
+                          "Percentage of dispatches reserved for bulk work "
+                          "while interactive requests are queued",
+                          &gembed_bulk_min_share, 20, 0, 100)) {
+        return true;
+    }
+
+    if (register_bool_var("numa_aware",
+                          "Split the inference pool into one worker group per "
+                          "NUMA node, pinned to its CPUs, and serve each "
+                          "request on the caller's node",
+                          &gembed_numa_aware, false,
+                          PLUGIN_VAR_READONLY | PLUGIN_VAR_PERSIST_AS_READ_ONLY)) {
+        return true;
+    }
+
+    if (register_str_var("inference_cpus",
+                         "CPUs the inference workers may run on, as a list "
+                         "like 0-3,8. Empty means no restriction",
+                         &gembed_inference_cpus, "", check_cpu_list,
+                         update_inference_cpus)) {
+        return true;
+    }
+
+    if (register_int_var("inference_priority",
+                         "Nice value of the inference workers, as in a "
+                         "resource group THREAD_PRIORITY",
+                         &gembed_inference_priority, 0, -20, 19,
+                         update_inference_priority)) {
+        return true;
+    }
+
+    if (register_bool_var("inherit_resource_group",
+                          "Run inference with the CPU affinity and priority "
+                          "of the calling thread, as set by its resource group",
+                          &gembed_inherit_resource_group, false)) {
+        return true;
+    }
+
+    if (register_ulong_var("vector_max_length",
+                           "Maximum size in bytes of a vector returned by "
+                           "EMBED_TEXT",
+                           &gembed_vector_max_length, 65535, 1024,
+                           1024 * MB)) {
+        return true;
+    }
+
+    if (register_ulong_var("max_output_size",
+                           "Maximum size in bytes of the JSON document "
+                           "returned by EMBED_TEXTS",
+                           &gembed_max_output_size, 16 * MB, 64 * 1024,
+                           1024 * MB)) {
+        return true;
+    }
+
+    if (register_uint_var("ticket_queue_size",
+                          "Maximum number of GEMBED_ENQUEUE tickets that are "
+                          "queued or waiting to be collected",
+                          &gembed_ticket_queue_size, 100000, 1, 100000000)) {
+        return true;
+    }
+
+    if (register_uint_var("ticket_ttl_s",
+                          "Seconds a finished ticket is kept for GEMBED_RESULT "
+                          "or GEMBED_WAIT before it is dropped",
+                          &gembed_ticket_ttl_s, 3600, 1, 7 * 24 * 3600)) {
+        return true;
+    }
+
+    if (register_uint_var("backfill_batch_rows",
+                          "Rows a GEMBED_BACKFILL job reads and embeds at once",
+                          &gembed_backfill_batch_rows, 1000, 1, 1000000)) {
+        return true;
+    }
+
+    if (register_uint_var("backfill_chunk_rows",
+                          "Rows a GEMBED_BACKFILL job writes per transaction",
+                          &gembed_backfill_chunk_rows, 100, 1, 100000)) {
+        return true;
+    }
+
+    if (register_uint_var("backfill_max_threads_running",
+                          "Backfill jobs pause while Threads_running is above "
+                          "this, 0 disables the check",
+                          &gembed_backfill_max_threads_running, 32, 0, 100000)) {
+        return true;
+    }
+
+    if (register_uint_var("backfill_max_lag_s",
+                          "Backfill jobs pause while replication lag in seconds "
+                          "is above this, 0 disables the check",
+                          &gembed_backfill_max_lag_s, 10, 0, 86400)) {
+        return true;
+    }
+
+    if (register_str_var("backfill_lag_query",
+                         "Query returning replication lag in seconds, e.g. from "
+                         "a heartbeat table. Empty uses this server's applier",
+                         &gembed_backfill_lag_query, "")) {
+        return true;
+    }
+
+    if (register_str_var("backfill_checkpoint_schema",
+                         "Schema holding the gembed_backfill_checkpoint table. "
+                         "Empty uses the schema of the table being backfilled",
+                         &gembed_backfill_checkpoint_schema, "")) {
+        return true;
+    }
+
+    if (register_bool_var("out_of_process",
+                          "Run the embedding library in a separate "
+                          "gembed_helper process (Linux only)",
+                          &gembed_out_of_process, false,
+                          PLUGIN_VAR_READONLY | PLUGIN_VAR_PERSIST_AS_READ_ONLY)) {
+        return true;
+    }
+
+    if (register_str_var("helper_path",
+                         "Path of the gembed_helper executable, used from the "
+                         "next start. Empty means the plugin directory",
+                         &gembed_helper_path, "", nullptr, update_helper_str)) {
+        return true;
+    }
+
+    if (register_str_var("helper_cgroup",
+                         "cgroup v2 directory the helper process joins at "
+                         "start. Empty leaves it in mysqld's cgroup",
+                         &gembed_helper_cgroup, "", nullptr, update_helper_str)) {
+        return true;
+    }
+
+    if (register_uint_var("helper_memory_limit_mb",
+                          "Address space limit of the helper process in MiB, "
+                          "0 for none",
+                          &gembed_helper_memory_limit_mb, 0, 0, 1024 * 1024,
+                          update_helper_memory_limit_mb)) {
+        return true;
+    }
+
+    if (register_str_var("remote_socket",
+                         "Unix socket of the inference server used by the "
+                         "remote method",
+                         &gembed_remote_socket, "", nullptr,
+                         update_remote_socket)) {
+        return true;
+    }
+
+    if (register_uint_var("remote_connections",
+                          "Connections to the remote inference server; each "
+                          "carries any number of requests at once",
+                          &gembed_remote_connections, 4, 1, 64)) {
+        return true;
+    }
+
+    if (register_uint_var("remote_timeout_ms",
+                          "Milliseconds to wait for the remote inference "
+                          "server to answer a request",
+                          &gembed_remote_timeout_ms, 30000, 100, 3600000)) {
+        return true;
+    }
+
+    if (register_str_var("persistent_cache_dir",
+                         "Directory of the on-disk embedding cache that "
+                         "survives restarts, empty = off",
+                         &gembed_persistent_cache_dir, "", nullptr, nullptr,
+                         PLUGIN_VAR_READONLY | PLUGIN_VAR_PERSIST_AS_READ_ONLY)) {
+        return true;
+    }
+
+    if (register_uint_var("persistent_cache_size_mb",
+                          "Disk budget of the persistent embedding cache in "
+                          "megabytes",
+                          &gembed_persistent_cache_size_mb, 4096, 256,
+                          1024 * 1024, update_persistent_cache_size_mb)) {
+        return true;
+    }
+
+    return false;
+}
+
+bool register_component_variables() {
+    if (register_sysvars()) {
+        unregister_component_variables();
+        return true;
+    }
+
+    // Registration may have loaded persisted values, apply them
+    embedding_cache_set_capacity(gembed_cache_size_mb * MB);
+    inference_pool_set_cpus(gembed_inference_cpus);
+    configure_helper();
+    remote_set_socket(gembed_remote_socket);
+
+    if (mysql_service_status_variable_registration->register_variable(
+            status_vars)) {
+        log_message(ERROR_LEVEL, "failed to register status variables");
+        unregister_component_variables();
+        return true;
+    }
+    status_vars_registered = true;
+
+    return false;
+}
+
+void unregister_component_variables() {
+    if (status_vars_registered) {
+        mysql_service_status_variable_registration->unregister_variable(
+            status_vars);
+        status_vars_registered = false;
+    }
+
+    for (auto it = registered_sysvars.rbegin(); it != registered_sysvars.rend();
+         ++it) {
+        mysql_service_component_sys_variable_unregister->unregister_variable(
+            COMPONENT_NAME, *it);
+    }
+    registered_sysvars.clear();
+}
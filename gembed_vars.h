@@ -0,0 +1,105 @@
+/* Copyright (c) 2025, Joel Díaz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+#ifndef GEMBED_VARS_H
+#define GEMBED_VARS_H
+
+#include <atomic>
+
+/*
+ * System variables, visible as gembed.<name>.
+ * All but numa_aware, out_of_process and persistent_cache_dir are dynamic
+ * and can be saved with SET PERSIST; those are read at startup and set with
+ * SET PERSIST_ONLY.
+ */
+extern unsigned int gembed_max_batch_size;      /* texts per generate_embeddings() call */
+extern unsigned int gembed_cache_size_mb;       /* embedding cache budget, 0 = off */
+extern unsigned int gembed_statement_memo_entries;  /* distinct texts memoized per call site */
+extern unsigned int gembed_inference_threads;   /* inference pool workers */
+extern unsigned int gembed_max_wait_us;         /* batch fill wait window */
+extern bool gembed_adaptive_batching;           /* tune batch size and wait per model */
+extern unsigned int gembed_target_p99_us;       /* latency target of the tuner */
+extern unsigned int gembed_bulk_min_share;      /* percent of dispatches kept for bulk */
+extern bool gembed_numa_aware;                  /* per-node worker groups, read only */
+extern char *gembed_inference_cpus;             /* CPU list for workers, empty = any */
+extern int gembed_inference_priority;           /* worker nice value */
+extern bool gembed_inherit_resource_group;      /* run jobs with the caller's placement */
+extern unsigned long gembed_vector_max_length;  /* EMBED_TEXT result size limit, bytes */
+extern unsigned long gembed_max_output_size;    /* EMBED_TEXTS result size limit, bytes */
+extern unsigned int gembed_ticket_queue_size;   /* outstanding GEMBED_ENQUEUE tickets */
+extern unsigned int gembed_ticket_ttl_s;        /* lifetime of an uncollected result */
+extern unsigned int gembed_backfill_batch_rows; /* rows read and embedded at once */
+extern unsigned int gembed_backfill_chunk_rows; /* rows per backfill transaction */
+extern unsigned int gembed_backfill_max_threads_running;  /* throttle, 0 = off */
+extern unsigned int gembed_backfill_max_lag_s;  /* throttle, 0 = off */
+extern char *gembed_backfill_lag_query;         /* lag in seconds, empty = local applier */
+extern char *gembed_backfill_checkpoint_schema;  /* empty = the table's schema */
+extern bool gembed_out_of_process;              /* inference in gembed_helper, read only */
+extern char *gembed_helper_path;                /* helper executable, empty = plugin_dir */
+extern char *gembed_helper_cgroup;              /* cgroup v2 directory for the helper */
+extern unsigned int gembed_helper_memory_limit_mb;  /* helper address space, 0 = none */
+extern char *gembed_remote_socket;              /* inference server for `remote` */
+extern unsigned int gembed_remote_connections;  /* connections to the server */
+extern unsigned int gembed_remote_timeout_ms;   /* reply deadline of a remote request */
+extern char *gembed_persistent_cache_dir;       /* on-disk cache, empty = off, read only */
+extern unsigned int gembed_persistent_cache_size_mb;  /* on-disk cache budget */
+
+/* Status counters, visible as gembed.<name> in SHOW GLOBAL STATUS */
+typedef std::atomic<long long> status_counter;
+
+struct gembed_status_t {
+    status_counter cache_hits;
+    status_counter cache_misses;
+    status_counter cache_evictions;
+    status_counter cache_entries;
+    status_counter cache_bytes;
+    status_counter memo_hits;
+    status_counter inference_calls;
+    status_counter inference_texts;
+    status_counter pool_threads;
+    status_counter pool_queue_length;
+    status_counter pool_coalesced_jobs;
+    status_counter interactive_jobs;
+    status_counter interactive_wait_us;
+    status_counter bulk_jobs;
+    status_counter bulk_wait_us;
+    status_counter ticket_queue_length;
+    status_counter tickets_completed;
+    status_counter tickets_expired;
+    status_counter backfill_jobs_running;
+    status_counter backfill_rows;
+    status_counter backfill_throttle_waits;
+    status_counter helper_pid;
+    status_counter helper_restarts;
+    status_counter remote_connections;
+    status_counter remote_requests;
+    status_counter remote_failures;
+    status_counter persistent_cache_hits;
+    status_counter persistent_cache_misses;
+    status_counter persistent_cache_entries;
+    status_counter persistent_cache_bytes;
+    status_counter persistent_cache_compactions;
+    status_counter topk_rows;
+    status_counter topk_rows_abandoned;
+};
+
+extern gembed_status_t gembed_status;
+
+/* Registers every system and status variable. Returns true on failure */
+bool register_component_variables();
+
+/* Unregisters whatever register_component_variables() registered */
+void unregister_component_variables();
+
+#endif /* GEMBED_VARS_H */
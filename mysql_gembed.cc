@@ -22,16 +22,56 @@
 #include <mysql/components/services/udf_metadata.h>
 #include <mysql/components/services/udf_registration.h>
 #include <mysql/components/services/log_builtins.h>
+#include <mysql/components/services/component_sys_var_service.h>
+#include <mysql/components/services/status_variable_registration.h>
+#include <mysql/components/services/mysql_command_services.h>
+#include <mysql/components/services/mysql_current_thread_reader.h>
+#include <mysql/components/services/mysql_thd_attributes.h>
+#include <mysql/components/services/security_context.h>
 #include <mysqld_error.h>
+#include <algorithm>
+#include <cstdint>
 #include <cstring>
+#include <memory>
+#include <vector>
 #include "mysql_gembed.h"
+#include "gembed_backfill.h"
+#include "gembed_cache.h"
+#include "gembed_disk_cache.h"
+#include "gembed_distance.h"
+#include "gembed_embed.h"
+#include "gembed_helper.h"
+#include "gembed_models.h"
+#include "gembed_options.h"
+#include "gembed_pool.h"
+#include "gembed_quantize.h"
+#include "gembed_remote.h"
+#include "gembed_services.h"
+#include "gembed_staleness.h"
+#include "gembed_tickets.h"
+#include "gembed_vars.h"
 
 #define MYSQL_ERRMSG_SIZE 512
 
 REQUIRES_SERVICE_PLACEHOLDER(mysql_udf_metadata);
 REQUIRES_SERVICE_PLACEHOLDER(udf_registration);
+REQUIRES_SERVICE_PLACEHOLDER(udf_registration_aggregate);
 REQUIRES_SERVICE_PLACEHOLDER(log_builtins);
 REQUIRES_SERVICE_PLACEHOLDER(log_builtins_string);
+REQUIRES_SERVICE_PLACEHOLDER(component_sys_variable_register);
+REQUIRES_SERVICE_PLACEHOLDER(component_sys_variable_unregister);
+REQUIRES_SERVICE_PLACEHOLDER(status_variable_registration);
+REQUIRES_SERVICE_PLACEHOLDER(mysql_command_factory);
+REQUIRES_SERVICE_PLACEHOLDER(mysql_command_options);
+REQUIRES_SERVICE_PLACEHOLDER(mysql_command_query);
+REQUIRES_SERVICE_PLACEHOLDER(mysql_command_query_result);
+REQUIRES_SERVICE_PLACEHOLDER(mysql_command_field_info);
+REQUIRES_SERVICE_PLACEHOLDER(mysql_command_error_info);
+REQUIRES_SERVICE_PLACEHOLDER(mysql_command_thread);
+REQUIRES_SERVICE_PLACEHOLDER(mysql_current_thread_reader);
+REQUIRES_SERVICE_PLACEHOLDER(mysql_thd_attributes);
+REQUIRES_SERVICE_PLACEHOLDER(mysql_thd_security_context);
+REQUIRES_SERVICE_PLACEHOLDER(mysql_security_context_options);
 
 BEGIN_COMPONENT_PROVIDES(component_mysql_gembed)
 END_COMPONENT_PROVIDES();
@@ -39,8 +79,23 @@ END_COMPONENT_PROVIDES();
 BEGIN_COMPONENT_REQUIRES(component_mysql_gembed)
   REQUIRES_SERVICE(mysql_udf_metadata),
   REQUIRES_SERVICE(udf_registration),
+  REQUIRES_SERVICE(udf_registration_aggregate),
   REQUIRES_SERVICE(log_builtins),
   REQUIRES_SERVICE(log_builtins_string),
+  REQUIRES_SERVICE(component_sys_variable_register),
+  REQUIRES_SERVICE(component_sys_variable_unregister),
+  REQUIRES_SERVICE(status_variable_registration),
+  REQUIRES_SERVICE(mysql_command_factory),
+  REQUIRES_SERVICE(mysql_command_options),
+  REQUIRES_SERVICE(mysql_command_query),
+  REQUIRES_SERVICE(mysql_command_query_result),
+  REQUIRES_SERVICE(mysql_command_field_info),
+  REQUIRES_SERVICE(mysql_command_error_info),
+  REQUIRES_SERVICE(mysql_command_thread),
+  REQUIRES_SERVICE(mysql_current_thread_reader),
+  REQUIRES_SERVICE(mysql_thd_attributes),
+  REQUIRES_SERVICE(mysql_thd_security_context),
+  REQUIRES_SERVICE(mysql_security_context_options),
 END_COMPONENT_REQUIRES();
 
 /* Component metadata */
@@ -63,40 +118,149 @@ static char *embed_texts(UDF_INIT *initid, UDF_ARGS *args,
                          char *result, unsigned long *length,
                          unsigned char *is_null, unsigned char *error);
 
-static void log_message(int severity, const char *msg) {
+void log_message(int severity, const char *msg) {
     if (mysql_service_log_builtins && mysql_service_log_builtins->message) {
         mysql_service_log_builtins->message(severity, ER_LOG_PRINTF_MSG,
                                             "component_mysql_gembed: %s", msg);
     }
 }
 
-/* UDF: EMBED_TEXT(method, model, text) -> VECTOR */
-static bool embed_text_init(UDF_INIT *initid, UDF_ARGS *args, char *message) {
-    if (args->arg_count != 3) {
+bool session_killed() {
+    MYSQL_THD thd = nullptr;
+    uint16_t status = STATUS_SESSION_OK;
+    if (mysql_service_mysql_current_thread_reader->get(&thd) || !thd ||
+        mysql_service_mysql_thd_attributes->get(thd, "thd_status", &status)) {
+        return false;
+    }
+    return status != STATUS_SESSION_OK;
+}
+
+/*
+ * Reads the optional options argument (index 3) into opts.
+ * A NULL or missing argument leaves the defaults. Returns true on error.
+ */
+static bool read_options(UDF_ARGS *args, Embed_options *opts, char *message) {
+    if (args->arg_count < 4 || !args->args[3]) {
+        return false;
+    }
+    return parse_embed_options(args->args[3], args->lengths[3], opts,
+                               message, MYSQL_ERRMSG_SIZE);
+}
+
+/*
+ * Checks that the calibration the options carry, if any, is of vectors of
+ * dim dimensions. Returns true with message filled if it is not.
+ */
+static bool check_ranges(const Embed_options &opts, size_t dim, char *message) {
+    if (opts.ranges && opts.ranges->mul.size() != dim) {
         snprintf(message, MYSQL_ERRMSG_SIZE,
-                "EMBED_TEXT requires 3 arguments: method, model, text");
+                 "calibration is of %zu dimensions, the vectors have %zu",
+                 opts.ranges->mul.size(), dim);
         return true;
     }
+    return false;
+}
 
-    if (args->arg_type[0] != STRING_RESULT ||
-        args->arg_type[1] != STRING_RESULT ||
-        args->arg_type[2] != STRING_RESULT) {
-        snprintf(message, MYSQL_ERRMSG_SIZE, "All arguments must be strings");
+/*
+ * Applies the dims option to n vectors of *dim dimensions, repointing
+ * vectors into truncated. Returns true with message filled if the model
+ * has fewer dimensions.
+ */
+static bool apply_dims(const Embed_options &opts, size_t n, const float **vectors,
+                       size_t *dim, std::vector<float> *truncated, char *message) {
+    if (opts.dims == 0) {
+        return false;
+    }
+    if (opts.dims > *dim) {
+        snprintf(message, MYSQL_ERRMSG_SIZE, "dims is more than the %zu dimensions of the model",
+                 *dim);
+        return true;
+    }
+
+    truncated->resize(n * opts.dims);
+    truncate_vectors(*vectors, n, *dim, opts.dims, truncated->data());
+    *vectors = truncated->data();
+    *dim = opts.dims;
+    return false;
+}
+
+/*
+ * The model and options of a row into *opts. With constant arguments they
+ * are resolved on the first row and kept in state, so later rows take
+ * neither the registry lock nor an options parse. Options that do not say
+ * otherwise get priority. Returns NULL with message filled on error.
+ */
+static Model_entry *resolve_embed_args(Embed_udf_state *state, UDF_ARGS *args,
+                                       Inference_priority priority, Embed_options *opts,
+                                       char *message) {
+    if (state->model) {
+        *opts = state->opts;
+        return state->model;
+    }
+
+    Model_entry *entry =
+        model_registry_get(args->args[0], args->args[1], message, MYSQL_ERRMSG_SIZE);
+    if (!entry) {
+        return nullptr;
+    }
+
+    opts->priority = priority;
+    if (read_options(args, opts, message)) {
+        return nullptr;
+    }
+
+    if (state->constant_args) {
+        state->model = entry;
+        state->opts = *opts;
+    }
+    return entry;
+}
+
+/* Whether method, model and options are constant, so each call site resolves them once */
+static bool embed_args_constant(const UDF_ARGS *args) {
+    return args->args[0] && args->args[1] && (args->arg_count < 4 || args->args[3]);
+}
+
+/* Checks the argument count and types shared by EMBED_TEXT and EMBED_TEXTS */
+static bool check_embed_args(UDF_ARGS *args, const char *usage, char *message) {
+    if (args->arg_count != 3 && args->arg_count != 4) {
+        snprintf(message, MYSQL_ERRMSG_SIZE, "%s", usage);
+        return true;
+    }
+
+    for (unsigned int i = 0; i < args->arg_count; i++) {
+        if (args->arg_type[i] != STRING_RESULT) {
+            snprintf(message, MYSQL_ERRMSG_SIZE, "All arguments must be strings");
+            return true;
+        }
+    }
+
+    // Constant options are validated up front
+    Embed_options opts;
+    return read_options(args, &opts, message);
+}
+
+/* UDF: EMBED_TEXT(method, model, text [, options]) -> VECTOR */
+static bool embed_text_init(UDF_INIT *initid, UDF_ARGS *args, char *message) {
+    if (check_embed_args(args,
+                         "EMBED_TEXT requires 3 or 4 arguments: method, model, "
+                         "text [, options]",
+                         message)) {
         return true;
     }
 
     initid->maybe_null = true;
-    initid->max_length = 65535;
-    initid->ptr = nullptr;
+    initid->max_length = gembed_vector_max_length;
+    Embed_udf_state *state = new Embed_udf_state();
+    state->constant_args = embed_args_constant(args);
+    initid->ptr = reinterpret_cast<char *>(state);
 
     return false;
 }
 
 static void embed_text_deinit(UDF_INIT *initid) {
-    if (initid->ptr) {
-        delete[] initid->ptr;
-        initid->ptr = nullptr;
-    }
+    delete reinterpret_cast<Embed_udf_state *>(initid->ptr);
+    initid->ptr = nullptr;
 }
 
 static char *embed_text(UDF_INIT *initid, UDF_ARGS *args,
@@ -111,85 +275,75 @@ static char *embed_text(UDF_INIT *initid, UDF_ARGS *args,
         return nullptr;
     }
 
-    int method_id = validate_embedding_method(method);
-    if (method_id < 0) {
+    // A single text is interactive unless the caller says otherwise
+    Embed_udf_state *state = reinterpret_cast<Embed_udf_state *>(initid->ptr);
+    char message[MYSQL_ERRMSG_SIZE];
+    Embed_options opts;
+    Model_entry *entry =
+        resolve_embed_args(state, args, PRIORITY_INTERACTIVE, &opts, message);
+    if (!entry) {
         *error = 1;
-        log_message(ERROR_LEVEL, "Invalid embedding method");
-        return nullptr;
-    }
-
-    int model_id = validate_embedding_model(method_id, model, INPUT_TYPE_TEXT);
-    if (model_id < 0) {
-        *error = 1;
-        log_message(ERROR_LEVEL, "Invalid or unsupported model");
+        log_message(ERROR_LEVEL, message);
         return nullptr;
     }
 
     StringSlice text_input{ text, args->lengths[2] };
 
-    InputData input_data{
-        INPUT_TYPE_TEXT,
-        nullptr,
-        0,
-        &text_input,
-        1
-    };
-
-    EmbeddingBatch batch;
-    int err = generate_embeddings(method_id, model_id, &input_data, &batch);
+    // Repeated values of a low-cardinality column come straight from the memo,
+    // the floats of either path are quantized for compact outputs
+    size_t dim = 0;
+    const float *vec = state->memo.find(entry, text, text_input.len, &dim);
+    std::vector<float> embedding;
+    Disk_cache_hit pinned;
+    if (!vec) {
+        if (embed_one(entry, text_input, opts, embedding, &pinned, &vec, &dim) != 0) {
+            *error = 1;
+            log_message(ERROR_LEVEL, "Embedding generation failed");
+            return nullptr;
+        }
+        state->memo.add(entry, text, text_input.len, vec, dim);
+    }
 
-    if (err != 0 || batch.n_vectors != 1) {
-        free_embedding_batch(&batch);
+    std::vector<float> truncated;
+    if (apply_dims(opts, 1, &vec, &dim, &truncated, message) ||
+        check_ranges(opts, dim, message)) {
         *error = 1;
-        log_message(ERROR_LEVEL, "Embedding generation failed");
+        log_message(ERROR_LEVEL, message);
         return nullptr;
     }
 
-    // MySQL 9.0 VECTOR format: dimension count (4 bytes) + float array
-    size_t vector_size = sizeof(uint32_t) + (batch.dim * sizeof(float));
-    char *vector_data = new char[vector_size];
-
-    *reinterpret_cast<uint32_t*>(vector_data) = static_cast<uint32_t>(batch.dim);
-    memcpy(vector_data + sizeof(uint32_t), batch.data, batch.dim * sizeof(float));
-
-    free_embedding_batch(&batch);
-
-    if (initid->ptr) {
-        delete[] initid->ptr;
+    char *vector_data = store_output(&state->result, initid->max_length, opts,
+                                     opts.ranges.get(), vec, dim, length);
+    if (!vector_data) {
+        *error = 1;
+        log_message(ERROR_LEVEL, "Vector exceeds gembed.vector_max_length");
+        return nullptr;
     }
-    initid->ptr = vector_data;
-    *length = vector_size;
 
     return vector_data;
 }
 
-/* UDF: EMBED_TEXTS(method, model, JSON_ARRAY(texts)) -> JSON_ARRAY(vectors) */
+/* UDF: EMBED_TEXTS(method, model, JSON_ARRAY(texts) [, options]) -> JSON_ARRAY(vectors) */
 static bool embed_texts_init(UDF_INIT *initid, UDF_ARGS *args, char *message) {
-    if (args->arg_count != 3) {
-        snprintf(message, MYSQL_ERRMSG_SIZE,
-                "EMBED_TEXTS requires 3 arguments: method, model, texts_json");
-        return true;
-    }
-
-    if (args->arg_type[0] != STRING_RESULT ||
-        args->arg_type[1] != STRING_RESULT ||
-        args->arg_type[2] != STRING_RESULT) {
-        snprintf(message, MYSQL_ERRMSG_SIZE, "All arguments must be strings");
+    if (check_embed_args(args,
+                         "EMBED_TEXTS requires 3 or 4 arguments: method, model, "
+                         "texts_json [, options]",
+                         message)) {
         return true;
     }
 
     initid->maybe_null = true;
-    initid->max_length = 1024 * 1024;
-    initid->ptr = nullptr;
+    initid->max_length = gembed_max_output_size;
+    Embed_udf_state *state = new Embed_udf_state();
+    state->constant_args = embed_args_constant(args);
+    initid->ptr = reinterpret_cast<char *>(state);
 
     return false;
 }
 
 static void embed_texts_deinit(UDF_INIT *initid) {
-    if (initid->ptr) {
-        delete[] initid->ptr;
-        initid->ptr = nullptr;
-    }
+    delete reinterpret_cast<Embed_udf_state *>(initid->ptr);
+    initid->ptr = nullptr;
 }
 
 static int parse_json_string_array(const char *json, size_t json_len,
@@ -275,6 +429,80 @@ static int parse_json_string_array(const char *json, size_t json_len,
     return 0;
 }
 
+/*
+ * Ensures there is room for one more formatted value plus the closing
+ * brackets, doubling the buffer up to limit. Returns false past the limit.
+ */
+static bool json_reserve(char **buf, size_t *capacity, size_t len, size_t limit) {
+    const size_t headroom = 64;  // longest "%.6f" float plus separators
+
+    if (len + headroom <= *capacity) {
+        return true;
+    }
+    if (len + headroom > limit) {
+        return false;
+    }
+
+    size_t new_capacity = std::min(limit, std::max(*capacity * 2, len + headroom));
+    char *grown = new char[new_capacity];
+    memcpy(grown, *buf, len);
+    delete[] *buf;
+    *buf = grown;
+    *capacity = new_capacity;
+    return true;
+}
+
+/*
+ * EMBED_TEXTS output for the compact formats: a JSON array with each vector
+ * as a hex string of the bytes EMBED_TEXT returns, for UNHEX().
+ */
+static char *store_quantized_json(UDF_INIT *initid,
+                                  const Embed_options &opts, const float *vectors,
+                                  size_t n, size_t dim, unsigned long *length,
+                                  unsigned char *error) {
+    char message[MYSQL_ERRMSG_SIZE];
+    if (check_ranges(opts, dim, message)) {
+        *error = 1;
+        log_message(ERROR_LEVEL, message);
+        return nullptr;
+    }
+
+    size_t size = quantized_size(opts.output, dim);
+    size_t json_len = 2 + n * (2 * size + 3) - 1;
+    if (json_len > initid->max_length) {
+        *error = 1;
+        log_message(ERROR_LEVEL, "Output exceeds gembed.max_output_size");
+        return nullptr;
+    }
+
+    static const char hex[] = "0123456789ABCDEF";
+    std::vector<char> bytes(size);
+    char *json_output = new char[json_len];
+    char *p = json_output;
+
+    *p++ = '[';
+    for (size_t i = 0; i < n; i++) {
+        quantize_vector(opts.output, opts.ranges.get(), vectors + i * dim, dim, bytes.data());
+        if (i > 0) {
+            *p++ = ',';
+        }
+        *p++ = '"';
+        for (char byte : bytes) {
+            *p++ = hex[static_cast<unsigned char>(byte) >> 4];
+            *p++ = hex[static_cast<unsigned char>(byte) & 0xF];
+        }
+        *p++ = '"';
+    }
+    *p++ = ']';
+
+    Embed_udf_state *state = reinterpret_cast<Embed_udf_state *>(initid->ptr);
+    delete[] state->result;
+    state->result = json_output;
+    *length = json_len;
+
+    return json_output;
+}
+
 static char *embed_texts(UDF_INIT *initid, UDF_ARGS *args,
                          char * /*result*/, unsigned long *length,
                          unsigned char *is_null, unsigned char *error) {
@@ -287,17 +515,14 @@ static char *embed_texts(UDF_INIT *initid, UDF_ARGS *args,
         return nullptr;
     }
 
-    int method_id = validate_embedding_method(method);
-    if (method_id < 0) {
+    // Batches are bulk work unless the caller says otherwise
+    Embed_udf_state *state = reinterpret_cast<Embed_udf_state *>(initid->ptr);
+    char message[MYSQL_ERRMSG_SIZE];
+    Embed_options opts;
+    Model_entry *entry = resolve_embed_args(state, args, PRIORITY_BULK, &opts, message);
+    if (!entry) {
         *error = 1;
-        log_message(ERROR_LEVEL, "Invalid embedding method in batch");
-        return nullptr;
-    }
-
-    int model_id = validate_embedding_model(method_id, model, INPUT_TYPE_TEXT);
-    if (model_id < 0) {
-        *error = 1;
-        log_message(ERROR_LEVEL, "Invalid or unsupported model in batch");
+        log_message(ERROR_LEVEL, message);
         return nullptr;
     }
 
@@ -322,16 +547,10 @@ static char *embed_texts(UDF_INIT *initid, UDF_ARGS *args,
         inputs[i].len = string_lengths[i];
     }
 
-    InputData input_data{
-        INPUT_TYPE_TEXT,
-        nullptr,
-        0,
-        inputs,
-        n_strings
-    };
-
-    EmbeddingBatch batch;
-    int err = generate_embeddings(method_id, model_id, &input_data, &batch);
+    std::vector<float> embeddings;
+    size_t dim = 0;
+    int err = embed_with_memo(&state->memo, entry, inputs, n_strings, opts,
+                              embeddings, &dim);
 
     for (size_t i = 0; i < n_strings; i++) {
         delete[] strings[i];
@@ -341,38 +560,50 @@ static char *embed_texts(UDF_INIT *initid, UDF_ARGS *args,
     delete[] inputs;
 
     if (err != 0) {
-        free_embedding_batch(&batch);
         *error = 1;
         log_message(ERROR_LEVEL, "Batch embedding generation failed");
         return nullptr;
     }
 
-    size_t json_capacity = 1024 * 1024;
+    const float *vectors = embeddings.data();
+    std::vector<float> truncated;
+    if (apply_dims(opts, n_strings, &vectors, &dim, &truncated, message)) {
+        *error = 1;
+        log_message(ERROR_LEVEL, message);
+        return nullptr;
+    }
+
+    if (opts.output != OUTPUT_FLOAT32) {
+        return store_quantized_json(initid, opts, vectors, n_strings, dim, length, error);
+    }
+
+    // Roughly 10 bytes per "%.6f," value, grown on demand up to max_length
+    size_t json_limit = initid->max_length;
+    size_t json_capacity = std::min(json_limit, n_strings * dim * 10 + 64);
     char *json_output = new char[json_capacity];
     size_t json_len = 0;
 
     json_len += snprintf(json_output + json_len, json_capacity - json_len, "[");
 
-    for (size_t i = 0; i < batch.n_vectors; i++) {
+    for (size_t i = 0; i < n_strings; i++) {
         if (i > 0) {
             json_len += snprintf(json_output + json_len, json_capacity - json_len, ",");
         }
         json_len += snprintf(json_output + json_len, json_capacity - json_len, "[");
 
-        for (size_t j = 0; j < batch.dim; j++) {
-            if (j > 0) {
-                json_len += snprintf(json_output + json_len, json_capacity - json_len, ",");
-            }
-            json_len += snprintf(json_output + json_len, json_capacity - json_len,
-                               "%.6f", batch.data[i * batch.dim + j]);
-
-            if (json_len > json_capacity - 1000) {
+        for (size_t j = 0; j < dim; j++) {
+            if (!json_reserve(&json_output, &json_capacity, json_len, json_limit)) {
                 delete[] json_output;
-                free_embedding_batch(&batch);
                 *error = 1;
-                log_message(ERROR_LEVEL, "Output too large for batch");
+                log_message(ERROR_LEVEL, "Output exceeds gembed.max_output_size");
                 return nullptr;
             }
+
+            if (j > 0) {
+                json_len += snprintf(json_output + json_len, json_capacity - json_len, ",");
+            }
+            json_len += snprintf(json_output + json_len, json_capacity - json_len,
+                               "%.6f", vectors[i * dim + j]);
         }
 
         json_len += snprintf(json_output + json_len, json_capacity - json_len, "]");
@@ -380,42 +611,293 @@ static char *embed_texts(UDF_INIT *initid, UDF_ARGS *args,
 
     json_len += snprintf(json_output + json_len, json_capacity - json_len, "]");
 
-    free_embedding_batch(&batch);
-
-    if (initid->ptr) {
-        delete[] initid->ptr;
-    }
-    initid->ptr = json_output;
+    delete[] state->result;
+    state->result = json_output;
     *length = json_len;
 
     return json_output;
 }
 
+/* UDF: GEMBED_CALIBRATE(method, model, JSON_ARRAY(texts) [, options]) -> calibration */
+static bool gembed_calibrate_init(UDF_INIT *initid, UDF_ARGS *args, char *message) {
+    if (check_embed_args(args,
+                         "GEMBED_CALIBRATE requires 3 or 4 arguments: method, "
+                         "model, texts_json [, options]",
+                         message)) {
+        return true;
+    }
+
+    initid->maybe_null = true;
+    initid->max_length = gembed_max_output_size;
+    initid->ptr = reinterpret_cast<char *>(new Embed_udf_state());
+    return false;
+}
+
+static void gembed_calibrate_deinit(UDF_INIT *initid) {
+    delete reinterpret_cast<Embed_udf_state *>(initid->ptr);
+    initid->ptr = nullptr;
+}
+
+/*
+ * Embeds a sample of texts and returns the per-dimension ranges of their
+ * vectors as a calibration, see gembed_quantize.h. Callers store it and
+ * pass its HEX() back as '{"output": "int8", "calibration": ...}', so the
+ * vectors written with it can be compared and decoded later. With a dims
+ * option the ranges are of vectors truncated to it.
+ */
+static char *gembed_calibrate(UDF_INIT *initid, UDF_ARGS *args, char * /*result*/,
+                              unsigned long *length, unsigned char *is_null,
+                              unsigned char *error) {
+    const char *method = args->args[0];
+    const char *model = args->args[1];
+    const char *texts_json = args->args[2];
+
+    if (!method || !model || !texts_json) {
+        *is_null = 1;
+        return nullptr;
+    }
+
+    char message[MYSQL_ERRMSG_SIZE];
+    Model_entry *entry = model_registry_get(method, model, message, sizeof(message));
+    if (!entry) {
+        *error = 1;
+        log_message(ERROR_LEVEL, message);
+        return nullptr;
+    }
+
+    Embed_options opts;
+    opts.priority = PRIORITY_BULK;
+
+    if (read_options(args, &opts, message)) {
+        *error = 1;
+        log_message(ERROR_LEVEL, message);
+        return nullptr;
+    }
+
+    char **strings = nullptr;
+    size_t *string_lengths = nullptr;
+    size_t n_strings = 0;
+
+    if (parse_json_string_array(texts_json, args->lengths[2], &strings, &string_lengths, &n_strings) != 0) {
+        *error = 1;
+        log_message(ERROR_LEVEL, "Failed to parse JSON array");
+        return nullptr;
+    }
+
+    // Fewer samples leave nothing for the percentiles to trim
+    if (n_strings < INT8_CALIBRATION_MIN_SAMPLES) {
+        for (size_t i = 0; i < n_strings; i++) {
+            delete[] strings[i];
+        }
+        delete[] strings;
+        delete[] string_lengths;
+        *error = 1;
+        snprintf(message, sizeof(message), "GEMBED_CALIBRATE needs at least %d texts",
+                 INT8_CALIBRATION_MIN_SAMPLES);
+        log_message(ERROR_LEVEL, message);
+        return nullptr;
+    }
+
+    std::vector<StringSlice> inputs(n_strings);
+    for (size_t i = 0; i < n_strings; i++) {
+        inputs[i].ptr = strings[i];
+        inputs[i].len = string_lengths[i];
+    }
+
+    std::vector<float> embeddings;
+    size_t dim = 0;
+    int err = embed_with_cache(entry, inputs.data(), n_strings, opts, embeddings, &dim);
+
+    for (size_t i = 0; i < n_strings; i++) {
+        delete[] strings[i];
+    }
+    delete[] strings;
+    delete[] string_lengths;
+
+    if (err != 0) {
+        *error = 1;
+        log_message(ERROR_LEVEL, "Calibration failed");
+        return nullptr;
+    }
+
+    const float *vectors = embeddings.data();
+    std::vector<float> truncated;
+    if (apply_dims(opts, n_strings, &vectors, &dim, &truncated, message)) {
+        *error = 1;
+        log_message(ERROR_LEVEL, message);
+        return nullptr;
+    }
+
+    Int8_ranges ranges;
+    if (!int8_calibrate(vectors, n_strings, dim, &ranges)) {
+        *error = 1;
+        log_message(ERROR_LEVEL, "Calibration failed");
+        return nullptr;
+    }
+
+    size_t size = int8_calibration_size(dim);
+    if (size > initid->max_length) {
+        *error = 1;
+        log_message(ERROR_LEVEL, "Output exceeds gembed.max_output_size");
+        return nullptr;
+    }
+
+    Embed_udf_state *state = reinterpret_cast<Embed_udf_state *>(initid->ptr);
+    delete[] state->result;
+    state->result = new char[size];
+    int8_calibration_write(ranges, state->result);
+    *length = size;
+    return state->result;
+}
+
+/* Scalar functions provided by the component */
+static const struct {
+    const char *name;
+    Item_result return_type;
+    Udf_func_any func;
+    Udf_func_init init;
+    Udf_func_deinit deinit;
+} component_udfs[] = {
+    {"EMBED_TEXT", STRING_RESULT, (Udf_func_any)embed_text,
+     embed_text_init, embed_text_deinit},
+    {"EMBED_TEXTS", STRING_RESULT, (Udf_func_any)embed_texts,
+     embed_texts_init, embed_texts_deinit},
+    {"GEMBED_CALIBRATE", STRING_RESULT, (Udf_func_any)gembed_calibrate,
+     gembed_calibrate_init, gembed_calibrate_deinit},
+    {"GEMBED_DOT", REAL_RESULT, (Udf_func_any)gembed_dot,
+     gembed_distance_init, nullptr},
+    {"GEMBED_COSINE", REAL_RESULT, (Udf_func_any)gembed_cosine,
+     gembed_distance_init, nullptr},
+    {"GEMBED_L2", REAL_RESULT, (Udf_func_any)gembed_l2,
+     gembed_distance_init, nullptr},
+    {"GEMBED_ENQUEUE", INT_RESULT, (Udf_func_any)gembed_enqueue,
+     gembed_enqueue_init, nullptr},
+    {"GEMBED_RESULT", STRING_RESULT, (Udf_func_any)gembed_result,
+     gembed_result_init, gembed_ticket_deinit},
+    {"GEMBED_WAIT", STRING_RESULT, (Udf_func_any)gembed_wait,
+     gembed_wait_init, gembed_ticket_deinit},
+    {"GEMBED_BACKFILL", INT_RESULT, (Udf_func_any)gembed_backfill,
+     gembed_backfill_init, nullptr},
+    {"GEMBED_BACKFILL_STATUS", STRING_RESULT, (Udf_func_any)gembed_backfill_status,
+     gembed_backfill_status_init, gembed_backfill_status_deinit},
+    {"GEMBED_BACKFILL_CANCEL", INT_RESULT, (Udf_func_any)gembed_backfill_cancel,
+     gembed_backfill_cancel_init, nullptr},
+    {"GEMBED_RESTART_HELPER", INT_RESULT, (Udf_func_any)gembed_restart_helper,
+     gembed_restart_helper_init, nullptr},
+    {"GEMBED_MODEL_FINGERPRINT", INT_RESULT, (Udf_func_any)gembed_model_fingerprint,
+     gembed_model_fingerprint_init, nullptr},
+    {"GEMBED_HASH", INT_RESULT, (Udf_func_any)gembed_hash,
+     gembed_hash_init, nullptr},
+    {"GEMBED_STALE", INT_RESULT, (Udf_func_any)gembed_stale,
+     gembed_stale_init, nullptr},
+};
+
+static const size_t n_component_udfs = sizeof(component_udfs) / sizeof(component_udfs[0]);
+
+/* Aggregate functions provided by the component */
+static const struct {
+    const char *name;
+    Item_result return_type;
+    Udf_func_any func;
+    Udf_func_init init;
+    Udf_func_deinit deinit;
+    Udf_func_add add;
+    Udf_func_clear clear;
+} component_aggregate_udfs[] = {
+    {"GEMBED_TOPK", STRING_RESULT, (Udf_func_any)gembed_topk,
+     gembed_topk_init, gembed_topk_deinit, gembed_topk_add, gembed_topk_clear},
+    {"GEMBED_TOPK_MULTI", STRING_RESULT, (Udf_func_any)gembed_topk_multi,
+     gembed_topk_multi_init, gembed_topk_multi_deinit, gembed_topk_multi_add,
+     gembed_topk_multi_clear},
+};
+
+static const size_t n_component_aggregate_udfs =
+    sizeof(component_aggregate_udfs) / sizeof(component_aggregate_udfs[0]);
+
+/* Unregisters the first n functions of component_udfs */
+static void unregister_udfs(size_t n) {
+    int was_present = 0;
+    while (n > 0) {
+        n--;
+        mysql_service_udf_registration->udf_unregister(component_udfs[n].name,
+                                                        &was_present);
+    }
+}
+
+/* Unregisters the first n functions of component_aggregate_udfs */
+static void unregister_aggregate_udfs(size_t n) {
+    int was_present = 0;
+    while (n > 0) {
+        n--;
+        mysql_service_udf_registration_aggregate->udf_unregister(
+            component_aggregate_udfs[n].name, &was_present);
+    }
+}
+
+/* Stops everything component_mysql_gembed_init() started */
+static void stop_services() {
+    backfill_stop();
+    ticket_queue_stop();
+    inference_pool_stop();
+    helper_stop();
+    remote_stop();
+    disk_cache_close();
+    unregister_component_variables();
+}
+
 /* Component initialization */
 static mysql_service_status_t component_mysql_gembed_init() {
     log_message(INFORMATION_LEVEL, "initializing...");
 
-    if (mysql_service_udf_registration->udf_register(
-            "EMBED_TEXT",
-            Item_result::STRING_RESULT,
-            (Udf_func_any)embed_text,
-            embed_text_init,
-            embed_text_deinit)) {
-        log_message(ERROR_LEVEL, "Failed to register EMBED_TEXT");
+    if (register_component_variables()) {
         return 1;
     }
 
-    if (mysql_service_udf_registration->udf_register(
-            "EMBED_TEXTS",
-            Item_result::STRING_RESULT,
-            (Udf_func_any)embed_texts,
-            embed_texts_init,
-            embed_texts_deinit)) {
-        log_message(ERROR_LEVEL, "Failed to register EMBED_TEXTS");
-        mysql_service_udf_registration->udf_unregister("EMBED_TEXT", nullptr);
+    disk_cache_open();
+    distance_kernels_init();
+
+    if (helper_start() || inference_pool_start(gembed_inference_threads) ||
+        ticket_queue_start()) {
+        stop_services();
         return 1;
     }
 
+    for (size_t i = 0; i < n_component_udfs; i++) {
+        if (mysql_service_udf_registration->udf_register(
+                component_udfs[i].name,
+                component_udfs[i].return_type,
+                component_udfs[i].func,
+                component_udfs[i].init,
+                component_udfs[i].deinit)) {
+            char msg[128];
+            snprintf(msg, sizeof(msg), "Failed to register %s", component_udfs[i].name);
+            log_message(ERROR_LEVEL, msg);
+            unregister_udfs(i);
+            stop_services();
+            return 1;
+        }
+    }
+
+    for (size_t i = 0; i < n_component_aggregate_udfs; i++) {
+        if (mysql_service_udf_registration_aggregate->udf_register(
+                component_aggregate_udfs[i].name,
+                component_aggregate_udfs[i].return_type,
+                component_aggregate_udfs[i].func,
+                component_aggregate_udfs[i].init,
+                component_aggregate_udfs[i].deinit,
+                component_aggregate_udfs[i].add,
+                component_aggregate_udfs[i].clear)) {
+            char msg[128];
+            snprintf(msg, sizeof(msg), "Failed to register %s",
+                     component_aggregate_udfs[i].name);
+            log_message(ERROR_LEVEL, msg);
+            unregister_aggregate_udfs(i);
+            unregister_udfs(n_component_udfs);
+            stop_services();
+            return 1;
+        }
+    }
+
     log_message(INFORMATION_LEVEL, "functions registered successfully");
     return 0;
 }
@@ -424,9 +906,11 @@ static mysql_service_status_t component_mysql_gembed_init() {
 static mysql_service_status_t component_mysql_gembed_deinit() {
     log_message(INFORMATION_LEVEL, "shutting down...");
 
-    int was_present = 0;
-    mysql_service_udf_registration->udf_unregister("EMBED_TEXT", &was_present);
-    mysql_service_udf_registration->udf_unregister("EMBED_TEXTS", &was_present);
+    unregister_aggregate_udfs(n_component_aggregate_udfs);
+    unregister_udfs(n_component_udfs);
+    stop_services();
+    embedding_cache_clear();
+    model_registry_clear();
 
     log_message(INFORMATION_LEVEL, "functions unregistered");
     return 0;
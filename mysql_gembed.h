@@ -78,6 +78,24 @@ extern int generate_embeddings(
 /* Frees memory allocated for an embedding batch */
 extern void free_embedding_batch(EmbeddingBatch *batch);
 
+/*
+ * Optional entry points. Library builds that predate them do not export
+ * them. The build probes libgembed.a and records in gembed_features.h
+ * which it has as GEMBED_HAVE_<NAME>; reference one only under its macro.
+ */
+#if defined(__has_include)
+#if __has_include("gembed_features.h")
+#include "gembed_features.h"
+#endif
+#endif
+
+#ifndef GEMBED_FEATURES_H
+#define GEMBED_HAVE_BIND_REPLICA 0
+#endif
+
+/* Selects the model replica used by the calling thread (one per NUMA node) */
+extern void gembed_bind_replica(int replica);
+
 #ifdef __cplusplus
 }
 #endif